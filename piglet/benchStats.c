@@ -0,0 +1,65 @@
+/*
+   benchStats.c
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "benchStats.h"
+
+/*
+ * Local function prototypes
+ */
+static int compareDoubles( const void *a, const void *b );
+
+/*
+ * Start of code
+ */
+double benchStats_now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void benchStats_sort( double *values, int count )
+{
+  qsort( values, count, sizeof( double ), compareDoubles );
+}
+
+double benchStats_percentile( const double *sorted, int count, double p )
+{
+  int rank = (int) ceil( p * count );
+
+  if( rank < 1 )
+    rank = 1;
+  if( rank > count )
+    rank = count;
+
+  return sorted[ rank - 1 ];
+}
+
+void benchStats_writeJsonString( FILE *file, const char *string )
+{
+  const unsigned char *c;
+
+  fputc( '"', file );
+  for( c = (const unsigned char *) string; *c != '\0'; c++ )
+    if( (*c == '"') || (*c == '\\') )
+      fprintf( file, "\\%c", *c );
+    else if( *c < 0x20 )
+      fprintf( file, "\\u%04x", *c );
+    else
+      fputc( *c, file );
+  fputc( '"', file );
+}
+
+static int compareDoubles( const void *a, const void *b )
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
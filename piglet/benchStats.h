@@ -0,0 +1,21 @@
+/*
+   benchStats.h
+
+   Timing and reporting helpers shared by the benchmarks.
+*/
+
+#ifndef BENCH_STATS_H
+#define BENCH_STATS_H
+
+#include <stdio.h>
+
+/* Monotonic seconds */
+double benchStats_now( void );
+/* Sorts ascending, for benchStats_percentile */
+void benchStats_sort( double *values, int count );
+/* Nearest rank, p from 0 to 1; count must not be 0 */
+double benchStats_percentile( const double *sorted, int count, double p );
+/* Writes string as a quoted JSON string */
+void benchStats_writeJsonString( FILE *file, const char *string );
+
+#endif
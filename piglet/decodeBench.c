@@ -0,0 +1,329 @@
+/*
+ *  decodeBench.c
+ *
+ * Measures tile decoding throughput of each decoder built in (see
+ * tileDecoder.h), to RGB and to RGB565, over the tiles of a TMS directory
+ * tree. For comparison, libpng is also run the way piglet used to, with
+ * png_read_png into libpng's rows and a copy of each row.
+ *
+ * usage: decodeBench <tile directory> [max tiles] [rounds]
+ *
+ * Tiles are read into memory first, so only decoding is measured. MB/s is
+ * of decoded RGB or RGB565 pixels.
+ */
+
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <png.h>
+
+#include "tileDecoder.h"
+
+#define BUFFER_SIZE (1024 * 1024 * 3)
+
+typedef struct
+{
+  unsigned char *data;
+  size_t size;
+} sBenchTile, *BenchTile;
+
+typedef struct
+{
+  const unsigned char *buffer;
+  size_t remainingBytes;
+} sMemPNG, *MemPNG;
+
+/*
+ * Local function prototypes
+ */
+static int readTiles( const char *path, int maxTiles );
+static bool parseNumber( const char *name, uint32_t *number );
+static unsigned char *readFile( const char *filename, size_t *size );
+static void runDecoder( const sTileDecoder *decoder, TilePixelFormat format,
+			int rounds );
+static bool isPng( const unsigned char *data, size_t size );
+static Error pngReadPngDecode( const unsigned char *data, size_t size,
+			       TileImage image );
+static void png_memoryReadFunc( png_structp png_ptr, png_bytep outBytes,
+				png_size_t byteCountToRead );
+static double now( void );
+
+/*
+ * Global data
+ */
+static sBenchTile *tiles;
+static int tileCount;
+static unsigned char *buffer;
+
+/* the PNG decoding piglet used before tileDecoder */
+static const sTileDecoder readPngDecoder = { "png_read_png", isPng,
+					     pngReadPngDecode };
+
+/*
+ * Start of code
+ */
+int main( int argc, char **argv )
+{
+  int maxTiles = 1000, rounds = 3, i;
+
+  if( argc < 2 )
+  {
+    fprintf( stderr, "usage: %s <tile directory> [max tiles] [rounds]\n",
+	     argv[0] );
+    return 1;
+  }
+  if( argc > 2 )
+    maxTiles = atoi( argv[2] );
+  if( argc > 3 )
+    rounds = atoi( argv[3] );
+
+  tiles = calloc( maxTiles, sizeof( sBenchTile ) );
+  buffer = malloc( BUFFER_SIZE );
+  assert( (tiles != NULL) && (buffer != NULL) );
+
+  readTiles( argv[1], maxTiles );
+  if( tileCount == 0 )
+  {
+    fprintf( stderr, "no tiles in %s\n", argv[1] );
+    return 1;
+  }
+
+  printf( "%d tiles, %d rounds\n", tileCount, rounds );
+  printf( "%-14s %-7s %7s %10s %10s\n", "decoder", "format", "tiles",
+	  "ms/tile", "MB/s" );
+
+  for( i = 0; tileDecoders[i] != NULL; i++ )
+  {
+    runDecoder( tileDecoders[i], TILE_PIXELS_RGB, rounds );
+    runDecoder( tileDecoders[i], TILE_PIXELS_RGB565, rounds );
+  }
+  runDecoder( &readPngDecoder, TILE_PIXELS_RGB, rounds );
+
+  return 0;
+}
+
+/* Reads up to maxTiles tiles of any kind from the tree at path */
+static int readTiles( const char *path, int maxTiles )
+{
+  DIR *zDir, *xDir, *yDir;
+  struct dirent *zEnt, *xEnt, *yEnt;
+  char dirPath[ 1024 ], filename[ 1280 ];
+  uint32_t number;
+
+  zDir = opendir( path );
+  if( zDir == NULL )
+  {
+    perror( path );
+    exit( 1 );
+  }
+
+  while( ((zEnt = readdir( zDir )) != NULL) && (tileCount < maxTiles) )
+  {
+    if( !parseNumber( zEnt->d_name, &number ) )
+      continue;
+
+    snprintf( dirPath, sizeof( dirPath ), "%s/%s", path, zEnt->d_name );
+    xDir = opendir( dirPath );
+    if( xDir == NULL )
+      continue;
+
+    while( ((xEnt = readdir( xDir )) != NULL) && (tileCount < maxTiles) )
+    {
+      if( !parseNumber( xEnt->d_name, &number ) )
+	continue;
+
+      snprintf( dirPath, sizeof( dirPath ), "%s/%s/%s", path, zEnt->d_name,
+		xEnt->d_name );
+      yDir = opendir( dirPath );
+      if( yDir == NULL )
+	continue;
+
+      while( ((yEnt = readdir( yDir )) != NULL) && (tileCount < maxTiles) )
+      {
+	if( !isdigit( (unsigned char) yEnt->d_name[0] ) )
+	  continue;
+
+	snprintf( filename, sizeof( filename ), "%s/%s", dirPath,
+		  yEnt->d_name );
+	tiles[ tileCount ].data = readFile( filename,
+					    &(tiles[ tileCount ].size) );
+	if( tiles[ tileCount ].data != NULL )
+	  tileCount++;
+      }
+      closedir( yDir );
+    }
+    closedir( xDir );
+  }
+  closedir( zDir );
+
+  return tileCount;
+}
+
+/* Parses directory names like "17" */
+static bool parseNumber( const char *name, uint32_t *number )
+{
+  const char *p;
+
+  if( !isdigit( (unsigned char) name[0] ) )
+    return false;
+
+  for( p = name; isdigit( (unsigned char) *p ); p++ )
+    ;
+
+  if( *p != '\0' )
+    return false;
+
+  *number = strtoul( name, NULL, 10 );
+  return true;
+}
+
+static unsigned char *readFile( const char *filename, size_t *size )
+{
+  unsigned char *data;
+  struct stat st;
+  FILE *file;
+
+  if( (stat( filename, &st ) != 0) || !S_ISREG( st.st_mode ) ||
+      (st.st_size == 0) )
+    return NULL;
+
+  file = fopen( filename, "rb" );
+  if( file == NULL )
+    return NULL;
+
+  data = malloc( st.st_size );
+  assert( data != NULL );
+
+  if( fread( data, st.st_size, 1, file ) != 1 )
+  {
+    free( data );
+    data = NULL;
+  }
+  fclose( file );
+
+  *size = st.st_size;
+  return data;
+}
+
+/* Decodes every tile the decoder reads, rounds times, and prints the rate */
+static void runDecoder( const sTileDecoder *decoder, TilePixelFormat format,
+			int rounds )
+{
+  sTileImage image;
+  double start, seconds;
+  size_t decodedBytes = 0;
+  int round, i, decoded = 0;
+  Error error;
+
+  image.pixels = buffer;
+  image.size = BUFFER_SIZE;
+  image.format = format;
+
+  start = now();
+  for( round = 0; round < rounds; round++ )
+    for( i = 0; i < tileCount; i++ )
+    {
+      if( !decoder->accepts( tiles[i].data, tiles[i].size ) )
+	continue;
+
+      error = decoder->decode( tiles[i].data, tiles[i].size, &image );
+      if( error != NULL )
+      {
+	ErrReport( error );
+	ErrDispose( error, true );
+	continue;
+      }
+
+      decoded++;
+      decodedBytes += (size_t) image.width * image.height *
+	tileDecoder_pixelBytes( format );
+    }
+  seconds = now() - start;
+
+  if( decoded == 0 )
+    return;
+
+  printf( "%-14s %-7s %7d %10.3f %10.1f\n", decoder->name,
+	  (format == TILE_PIXELS_RGB) ? "RGB" : "RGB565", decoded / rounds,
+	  seconds * 1000 / decoded, decodedBytes / seconds / 1e6 );
+}
+
+static bool isPng( const unsigned char *data, size_t size )
+{
+  return (size >= 8) && (png_sig_cmp( (png_const_bytep) data, 0, 8 ) == 0);
+}
+
+/* png_read_png into libpng's own rows, then a copy of each row */
+static Error pngReadPngDecode( const unsigned char *data, size_t size,
+			       TileImage image )
+{
+  png_structp png_ptr;
+  png_infop info_ptr;
+  png_bytepp rows;
+  sMemPNG memPNG;
+  size_t rowBytes;
+  int y;
+
+  memPNG.buffer = data;
+  memPNG.remainingBytes = size;
+
+  png_ptr = png_create_read_struct( PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
+  info_ptr = png_create_info_struct( png_ptr );
+  assert( (png_ptr != NULL) && (info_ptr != NULL) );
+
+  if( setjmp( png_jmpbuf( png_ptr ) ) )
+  {
+    png_destroy_read_struct( &png_ptr, &info_ptr, NULL );
+    return ErrNew( ERR_APP, 0, NULL, "png_read_png: corrupt PNG" );
+  }
+
+  png_set_read_fn( png_ptr, &memPNG, png_memoryReadFunc );
+  png_read_png( png_ptr, info_ptr, PNG_TRANSFORM_STRIP_16 |
+		PNG_TRANSFORM_PACKING | PNG_TRANSFORM_EXPAND, NULL );
+
+  image->width = png_get_image_width( png_ptr, info_ptr );
+  image->height = png_get_image_height( png_ptr, info_ptr );
+  rowBytes = png_get_rowbytes( png_ptr, info_ptr );
+  if( rowBytes * image->height > image->size )
+  {
+    png_destroy_read_struct( &png_ptr, &info_ptr, NULL );
+    return ErrNew( ERR_APP, 0, NULL, "png_read_png: image too large" );
+  }
+
+  rows = png_get_rows( png_ptr, info_ptr );
+  for( y = 0; y < image->height; y++ )
+    memcpy( image->pixels + rowBytes * y, rows[y], rowBytes );
+
+  png_destroy_read_struct( &png_ptr, &info_ptr, NULL );
+
+  return NULL;
+}
+
+static void png_memoryReadFunc( png_structp png_ptr, png_bytep outBytes,
+				png_size_t byteCountToRead )
+{
+  MemPNG memPNG = (MemPNG) png_get_io_ptr(png_ptr);
+
+  if( byteCountToRead > memPNG->remainingBytes )
+    png_error( png_ptr, "truncated PNG" );
+
+  memcpy( outBytes, memPNG->buffer, byteCountToRead );
+  memPNG->remainingBytes -= byteCountToRead;
+  memPNG->buffer += byteCountToRead;
+}
+
+static double now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
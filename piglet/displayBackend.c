@@ -0,0 +1,171 @@
+/*
+   displayBackend.c
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_DISPMANX
+#include "bcm_host.h"
+#endif
+
+#include "displayBackend.h"
+
+#include "EGL/eglext.h"
+
+/* pbuffer size if none is given: the official 7" Raspberry Pi display */
+#define PBUFFER_DEFAULT_WIDTH 800
+#define PBUFFER_DEFAULT_HEIGHT 480
+
+/*
+ * static functions
+ */
+#ifdef HAVE_DISPMANX
+static EGLDisplay dispmanxGetDisplay( void );
+static EGLSurface dispmanxCreateSurface( EGLDisplay display, EGLConfig config,
+					 uint32_t *width, uint32_t *height );
+#endif
+static EGLDisplay pbufferGetDisplay( void );
+static EGLSurface pbufferCreateSurface( EGLDisplay display, EGLConfig config,
+					uint32_t *width, uint32_t *height );
+
+/*
+ * Global data
+ */
+#ifdef HAVE_DISPMANX
+static const sDisplayBackend dispmanxBackend = {
+  "dispmanx", EGL_WINDOW_BIT, false, dispmanxGetDisplay, dispmanxCreateSurface
+};
+#endif
+static const sDisplayBackend pbufferBackend = {
+  "pbuffer", EGL_PBUFFER_BIT, true, pbufferGetDisplay, pbufferCreateSurface
+};
+
+const sDisplayBackend *const displayBackends[] = {
+#ifdef HAVE_DISPMANX
+  &dispmanxBackend,
+#endif
+  &pbufferBackend,
+  NULL
+};
+
+const sDisplayBackend *displayBackend_find( const char *name )
+{
+  int i;
+
+  if( name == NULL )
+    return displayBackends[0];
+
+  for( i = 0; displayBackends[i] != NULL; i++ )
+    if( strcmp( displayBackends[i]->name, name ) == 0 )
+      return displayBackends[i];
+
+  return NULL;
+}
+
+#ifdef HAVE_DISPMANX
+static EGLDisplay dispmanxGetDisplay( void )
+{
+  bcm_host_init();
+
+  return eglGetDisplay( EGL_DEFAULT_DISPLAY );
+}
+
+/*
+ * A window covering the LCD. A surface smaller than the screen is scaled up
+ * to it by the display hardware, at no cost to the GPU.
+ */
+static EGLSurface dispmanxCreateSurface( EGLDisplay display, EGLConfig config,
+					 uint32_t *width, uint32_t *height )
+{
+  static EGL_DISPMANX_WINDOW_T nativewindow;
+
+  DISPMANX_ELEMENT_HANDLE_T dispman_element;
+  DISPMANX_DISPLAY_HANDLE_T dispman_display;
+  DISPMANX_UPDATE_HANDLE_T dispman_update;
+  VC_RECT_T dst_rect;
+  VC_RECT_T src_rect;
+  uint32_t screenWidth, screenHeight;
+  int32_t success;
+
+  success = graphics_get_display_size(0 /* LCD */, &screenWidth, &screenHeight);
+  assert( success >= 0 );
+
+  printf( "Screen size: %d x %d pixels\n", screenWidth, screenHeight );
+
+  if( (*width == 0) || (*height == 0) )
+  {
+    *width = screenWidth;
+    *height = screenHeight;
+  }
+
+  dst_rect.x = 0;
+  dst_rect.y = 0;
+  dst_rect.width = screenWidth;
+  dst_rect.height = screenHeight;
+
+  src_rect.x = 0;
+  src_rect.y = 0;
+  src_rect.width = *width << 16;
+  src_rect.height = *height << 16;
+
+  dispman_display = vc_dispmanx_display_open( 0 /* LCD */);
+  dispman_update = vc_dispmanx_update_start( 0 );
+
+  dispman_element = vc_dispmanx_element_add ( dispman_update, dispman_display,
+     0/*layer*/, &dst_rect, 0/*src*/,
+     &src_rect, DISPMANX_PROTECTION_NONE, 0 /*alpha*/, 0/*clamp*/, 0/*transform*/);
+
+  nativewindow.element = dispman_element;
+  nativewindow.width = *width;
+  nativewindow.height = *height;
+  vc_dispmanx_update_submit_sync( dispman_update );
+
+  return eglCreateWindowSurface( display, config, &nativewindow, NULL );
+}
+#endif
+
+/*
+ * Mesa's surfaceless platform needs no window system or GPU device, so
+ * this works on a headless box with llvmpipe. Other EGLs get their default
+ * display, which can make pbuffers as well.
+ */
+static EGLDisplay pbufferGetDisplay( void )
+{
+  // older EGL headers, e.g. the Pi firmware's, have no platform displays
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay;
+  const char *extensions;
+
+  extensions = eglQueryString( EGL_NO_DISPLAY, EGL_EXTENSIONS );
+  getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+    eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+
+  if( (extensions != NULL) && (getPlatformDisplay != NULL) &&
+      (strstr( extensions, "EGL_MESA_platform_surfaceless" ) != NULL) )
+    return getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA,
+			       EGL_DEFAULT_DISPLAY, NULL );
+#endif
+
+  return eglGetDisplay( EGL_DEFAULT_DISPLAY );
+}
+
+static EGLSurface pbufferCreateSurface( EGLDisplay display, EGLConfig config,
+					uint32_t *width, uint32_t *height )
+{
+  EGLint attributes[] = { EGL_WIDTH, 0, EGL_HEIGHT, 0, EGL_NONE };
+
+  if( (*width == 0) || (*height == 0) )
+  {
+    *width = PBUFFER_DEFAULT_WIDTH;
+    *height = PBUFFER_DEFAULT_HEIGHT;
+  }
+
+  printf( "Offscreen size: %d x %d pixels\n", *width, *height );
+
+  attributes[1] = *width;
+  attributes[3] = *height;
+
+  return eglCreatePbufferSurface( display, config, attributes );
+}
@@ -0,0 +1,40 @@
+/*
+   displayBackend.h
+
+   Where graphics renders to: the EGL display and the surface. On a
+   Raspberry Pi with the legacy firmware driver that is a dispmanx window
+   on the LCD (built with HAVE_DISPMANX). Anywhere else, e.g. with Mesa's
+   llvmpipe on a desktop or a CI box, piglet renders offscreen to a pbuffer
+   of a given size, which runs the same graphics_setMap/_redraw code for
+   testing and benchmarks.
+*/
+
+#ifndef DISPLAY_BACKEND_H
+#define DISPLAY_BACKEND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "EGL/egl.h"
+
+typedef struct
+{
+  const char *name;
+  EGLint surfaceType;  // EGL_SURFACE_TYPE for eglChooseConfig
+  bool offscreen;      // frames are never shown
+  /* Returns the EGL display to initialize, or EGL_NO_DISPLAY */
+  EGLDisplay (*getDisplay)( void );
+  /* Creates the surface to render to. width and height are the size
+     wanted, or 0 for the screen's, and are set to the surface's size. */
+  EGLSurface (*createSurface)( EGLDisplay display, EGLConfig config,
+			       uint32_t *width, uint32_t *height );
+} sDisplayBackend, *DisplayBackend;
+
+/* The backends built in, the default first. NULL terminated. */
+extern const sDisplayBackend *const displayBackends[];
+
+/* Returns the backend called name, the default if name is NULL, or NULL if
+   there is no such backend */
+const sDisplayBackend *displayBackend_find( const char *name );
+
+#endif
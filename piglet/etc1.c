@@ -0,0 +1,334 @@
+/*
+   etc1.c
+
+   Each block is split in two halves, side by side or one above the other
+   (the flip bit). Each half has a base color and one of eight modifier
+   tables; each pixel picks one of the table's four modifiers, added to all
+   three channels of the base color. Base colors are either two 4 bit
+   colors ("individual" mode), or a 5 bit color and a 3 bit signed
+   difference to it ("differential" mode).
+
+   The encoder tries both splits and both modes, with the average color of
+   each half as its base color, and keeps the one with the least squared
+   error. That is far from the best ETC1 encoders, but good enough for
+   charts, which are mostly flat areas.
+
+   Blocks are stored as two big endian 32 bit words. In the low word, pixel
+   (x, y) is bit x * 4 + y of the low halfword (the modifier's low bit) and
+   of the high halfword (its high bit).
+*/
+
+#include <limits.h>
+#include <string.h>
+
+#include "etc1.h"
+
+static const int modifierTables[8][2] = {
+  { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 },
+  { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 }
+};
+
+/* a modifier index's sign and which of the table's two values it takes */
+static const int modifierSign[4] = { 1, 1, -1, -1 };
+static const int modifierLarge[4] = { 0, 1, 0, 1 };
+
+typedef struct
+{
+  uint32_t high, low;
+  int error;
+} sBlockCandidate, *BlockCandidate;
+
+/*
+ * static functions
+ */
+static void encodeBlock( const unsigned char pixels[16][3], unsigned char *out );
+static void tryBlock( const unsigned char pixels[16][3], bool flip,
+		      bool differential, BlockCandidate best );
+static int encodeHalf( const unsigned char pixels[16][3], bool flip, int half,
+		       const int base[3], int *table, uint32_t *low );
+static void decodeBlock( const unsigned char *block, unsigned char pixels[16][3] );
+static bool inHalf( int x, int y, bool flip, int half );
+static int clamp255( int value );
+static int expand4( int value );
+static int expand5( int value );
+static uint32_t readBE32( const unsigned char *p );
+static void writeBE32( unsigned char *p, uint32_t value );
+
+bool etc1_parsePkm( const unsigned char *data, size_t size, int *width,
+		    int *height, const unsigned char **blocks )
+{
+  int type, paddedWidth, paddedHeight;
+
+  if( (size < ETC1_PKM_HEADER_SIZE) || (memcmp( data, "PKM 10", 6 ) != 0) )
+    return false;
+
+  type = (data[6] << 8) | data[7];
+  paddedWidth = (data[8] << 8) | data[9];
+  paddedHeight = (data[10] << 8) | data[11];
+
+  // type 0 is ETC1 without mipmaps
+  if( (type != 0) ||
+      (size < ETC1_PKM_HEADER_SIZE + etc1_imageSize( paddedWidth, paddedHeight )) )
+    return false;
+
+  *width = (data[12] << 8) | data[13];
+  *height = (data[14] << 8) | data[15];
+  *blocks = data + ETC1_PKM_HEADER_SIZE;
+
+  return (*width == paddedWidth) && (*height == paddedHeight);
+}
+
+void etc1_writePkmHeader( unsigned char *header, int width, int height )
+{
+  memcpy( header, "PKM 10", 6 );
+  header[6] = 0;
+  header[7] = 0;
+  header[8] = width >> 8;
+  header[9] = width & 0xff;
+  header[10] = height >> 8;
+  header[11] = height & 0xff;
+  memcpy( header + 12, header + 8, 4 );
+}
+
+void etc1_encodeImage( const unsigned char *rgb, int width, int height,
+		       int stride, unsigned char *out )
+{
+  unsigned char pixels[16][3];
+  int blockX, blockY, x, y;
+
+  for( blockY = 0; blockY < height; blockY += 4 )
+    for( blockX = 0; blockX < width; blockX += 4 )
+    {
+      for( x = 0; x < 4; x++ )
+	for( y = 0; y < 4; y++ )
+	  memcpy( pixels[ x * 4 + y ],
+		  rgb + (blockY + y) * stride + (blockX + x) * 3, 3 );
+
+      encodeBlock( pixels, out );
+      out += 8;
+    }
+}
+
+void etc1_decodeImage( const unsigned char *blocks, int width, int height,
+		       unsigned char *rgb, int stride )
+{
+  unsigned char pixels[16][3];
+  int blockX, blockY, x, y;
+
+  for( blockY = 0; blockY < height; blockY += 4 )
+    for( blockX = 0; blockX < width; blockX += 4 )
+    {
+      decodeBlock( blocks, pixels );
+      blocks += 8;
+
+      for( x = 0; x < 4; x++ )
+	for( y = 0; y < 4; y++ )
+	  memcpy( rgb + (blockY + y) * stride + (blockX + x) * 3,
+		  pixels[ x * 4 + y ], 3 );
+    }
+}
+
+static void encodeBlock( const unsigned char pixels[16][3], unsigned char *out )
+{
+  sBlockCandidate best;
+
+  best.error = INT_MAX;
+
+  tryBlock( pixels, false, true, &best );
+  tryBlock( pixels, true, true, &best );
+  tryBlock( pixels, false, false, &best );
+  tryBlock( pixels, true, false, &best );
+
+  writeBE32( out, best.high );
+  writeBE32( out + 4, best.low );
+}
+
+/* Encodes the block with one split and mode, and keeps it if it is better */
+static void tryBlock( const unsigned char pixels[16][3], bool flip,
+		      bool differential, BlockCandidate best )
+{
+  int sums[2][3] = { { 0 } }, quantized[2][3], bases[2][3];
+  int tables[2], x, y, c, half, error;
+  uint32_t high, low = 0;
+
+  for( x = 0; x < 4; x++ )
+    for( y = 0; y < 4; y++ )
+      for( c = 0; c < 3; c++ )
+	sums[ inHalf( x, y, flip, 0 ) ? 0 : 1 ][c] += pixels[ x * 4 + y ][c];
+
+  // the rounded averages of the 8 pixels of each half
+  for( half = 0; half < 2; half++ )
+    for( c = 0; c < 3; c++ )
+    {
+      if( differential )
+      {
+	quantized[ half ][c] = (sums[ half ][c] * 31 + 8 * 255 / 2) / (8 * 255);
+	bases[ half ][c] = expand5( quantized[ half ][c] );
+      }
+      else
+      {
+	quantized[ half ][c] = (sums[ half ][c] + 8 * 17 / 2) / (8 * 17);
+	bases[ half ][c] = expand4( quantized[ half ][c] );
+      }
+    }
+
+  if( differential )
+    for( c = 0; c < 3; c++ )
+      if( (quantized[1][c] - quantized[0][c] < -4) ||
+	  (quantized[1][c] - quantized[0][c] > 3) )
+	return;
+
+  error = encodeHalf( pixels, flip, 0, bases[0], &(tables[0]), &low ) +
+    encodeHalf( pixels, flip, 1, bases[1], &(tables[1]), &low );
+  if( error >= best->error )
+    return;
+
+  if( differential )
+    high = (quantized[0][0] << 27) | (((quantized[1][0] - quantized[0][0]) & 7) << 24) |
+      (quantized[0][1] << 19) | (((quantized[1][1] - quantized[0][1]) & 7) << 16) |
+      (quantized[0][2] << 11) | (((quantized[1][2] - quantized[0][2]) & 7) << 8);
+  else
+    high = (quantized[0][0] << 28) | (quantized[1][0] << 24) |
+      (quantized[0][1] << 20) | (quantized[1][1] << 16) |
+      (quantized[0][2] << 12) | (quantized[1][2] << 8);
+
+  high |= (tables[0] << 5) | (tables[1] << 2) | (differential << 1) | flip;
+
+  best->high = high;
+  best->low = low;
+  best->error = error;
+}
+
+/*
+ * Picks the modifier table, and each pixel's modifier, that fit one half of
+ * the block best. Sets the half's pixels' bits in low and returns the error.
+ */
+static int encodeHalf( const unsigned char pixels[16][3], bool flip, int half,
+		       const int base[3], int *table, uint32_t *low )
+{
+  int t, x, y, c, m, bestError = INT_MAX;
+  uint32_t bits, bestBits = 0;
+
+  for( t = 0; t < 8; t++ )
+  {
+    int error = 0;
+
+    bits = 0;
+    for( x = 0; x < 4; x++ )
+      for( y = 0; y < 4; y++ )
+      {
+	int pixelError, bestPixelError = INT_MAX, bestModifier = 0;
+
+	if( !inHalf( x, y, flip, half ) )
+	  continue;
+
+	for( m = 0; m < 4; m++ )
+	{
+	  int modifier = modifierSign[m] * modifierTables[t][ modifierLarge[m] ];
+
+	  pixelError = 0;
+	  for( c = 0; c < 3; c++ )
+	  {
+	    int d = clamp255( base[c] + modifier ) - pixels[ x * 4 + y ][c];
+	    pixelError += d * d;
+	  }
+
+	  if( pixelError < bestPixelError )
+	  {
+	    bestPixelError = pixelError;
+	    bestModifier = m;
+	  }
+	}
+
+	error += bestPixelError;
+	bits |= ((uint32_t) (bestModifier >> 1) << (16 + x * 4 + y)) |
+	  ((uint32_t) (bestModifier & 1) << (x * 4 + y));
+      }
+
+    if( error < bestError )
+    {
+      bestError = error;
+      bestBits = bits;
+      *table = t;
+    }
+  }
+
+  *low |= bestBits;
+  return bestError;
+}
+
+static void decodeBlock( const unsigned char *block, unsigned char pixels[16][3] )
+{
+  uint32_t high = readBE32( block ), low = readBE32( block + 4 );
+  bool flip = high & 1, differential = (high >> 1) & 1;
+  int bases[2][3], tables[2], x, y, c, half, m;
+
+  if( differential )
+    for( c = 0; c < 3; c++ )
+    {
+      int color = (high >> (27 - c * 8)) & 31;
+      int delta = (high >> (24 - c * 8)) & 7;
+
+      if( delta >= 4 )
+	delta -= 8;
+
+      bases[0][c] = expand5( color );
+      bases[1][c] = expand5( (color + delta) & 31 );
+    }
+  else
+    for( c = 0; c < 3; c++ )
+    {
+      bases[0][c] = expand4( (high >> (28 - c * 8)) & 15 );
+      bases[1][c] = expand4( (high >> (24 - c * 8)) & 15 );
+    }
+
+  tables[0] = (high >> 5) & 7;
+  tables[1] = (high >> 2) & 7;
+
+  for( x = 0; x < 4; x++ )
+    for( y = 0; y < 4; y++ )
+    {
+      int i = x * 4 + y, modifier;
+
+      half = inHalf( x, y, flip, 0 ) ? 0 : 1;
+      m = (((low >> (16 + i)) & 1) << 1) | ((low >> i) & 1);
+      modifier = modifierSign[m] * modifierTables[ tables[ half ] ][ modifierLarge[m] ];
+
+      for( c = 0; c < 3; c++ )
+	pixels[i][c] = clamp255( bases[ half ][c] + modifier );
+    }
+}
+
+/* Without flip, the halves are 2x4 side by side; with flip, 4x2 stacked */
+static bool inHalf( int x, int y, bool flip, int half )
+{
+  return ((flip ? y : x) < 2) == (half == 0);
+}
+
+static int clamp255( int value )
+{
+  return (value < 0) ? 0 : ((value > 255) ? 255 : value);
+}
+
+static int expand4( int value )
+{
+  return (value << 4) | value;
+}
+
+static int expand5( int value )
+{
+  return (value << 3) | (value >> 2);
+}
+
+static uint32_t readBE32( const unsigned char *p )
+{
+  return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void writeBE32( unsigned char *p, uint32_t value )
+{
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
@@ -0,0 +1,41 @@
+/*
+   etc1.h
+
+   Encoding and decoding of ETC1 compressed textures (OES_compressed_ETC1_
+   RGB8_texture), and the PKM files they are stored in. ETC1 stores each 4x4
+   pixel block in 8 bytes, a sixth of the size of 24 bit RGB. ETC2 decoders
+   read ETC1 data as well.
+
+   Widths and heights are multiples of 4. RGB images are 3 bytes per pixel,
+   rows stride bytes apart.
+*/
+
+#ifndef ETC1_H
+#define ETC1_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ETC1_PKM_HEADER_SIZE 16
+
+/* GL_ETC1_RGB8_OES, from GLES2/gl2ext.h */
+#define ETC1_GL_FORMAT 0x8D64
+
+static inline size_t etc1_imageSize( int width, int height )
+{
+  return (size_t) (width / 4) * (height / 4) * 8;
+}
+
+/* If data is a PKM file, returns true and the image's size and blocks */
+bool etc1_parsePkm( const unsigned char *data, size_t size, int *width,
+		    int *height, const unsigned char **blocks );
+void etc1_writePkmHeader( unsigned char *header, int width, int height );
+
+/* out must hold etc1_imageSize bytes */
+void etc1_encodeImage( const unsigned char *rgb, int width, int height,
+		       int stride, unsigned char *out );
+void etc1_decodeImage( const unsigned char *blocks, int width, int height,
+		       unsigned char *rgb, int stride );
+
+#endif
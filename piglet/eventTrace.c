@@ -0,0 +1,193 @@
+/*
+   eventTrace.c
+
+   A thread's ring buffer is written by that thread only, which publishes
+   each event by advancing the buffer's head with a release store. The
+   buffers are pushed on a list with compare and swap when a thread records
+   its first event, and never freed, as piglet's threads live as long as it
+   does.
+
+   eventTrace_write copies a buffer while its thread may still be writing,
+   and then drops the events the thread may have overwritten meanwhile, so
+   it never waits for the thread, nor the thread for it.
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "eventTrace.h"
+
+typedef struct
+{
+  const char *name;
+  uint64_t start;     // ns
+  uint32_t duration;  // ns, at most 4 s
+  uint32_t x, y;
+  int16_t z;
+} sTraceEvent;
+
+typedef struct sTraceBuffer
+{
+  struct sTraceBuffer *next;
+  int threadID;
+  char threadName[ 32 ];
+  uint64_t head;  // events ever recorded; atomic
+  sTraceEvent events[ EVENT_TRACE_EVENTS ];
+} sTraceBuffer, *TraceBuffer;
+
+/*
+ * static functions
+ */
+static TraceBuffer newBuffer( void );
+
+/*
+ * Global data
+ */
+bool eventTrace_enabled = false;
+
+static TraceBuffer buffers;  // atomic
+static int threadCount;      // atomic
+static __thread TraceBuffer threadBuffer;
+static __thread char threadName[ 32 ];
+
+void eventTrace_enable( bool enable )
+{
+  __atomic_store_n( &eventTrace_enabled, enable, __ATOMIC_RELAXED );
+}
+
+void eventTrace_setThreadName( const char *name )
+{
+  snprintf( threadName, sizeof( threadName ), "%s", name );
+  if( threadBuffer != NULL )
+    strcpy( threadBuffer->threadName, threadName );
+}
+
+uint64_t eventTrace_now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec * (uint64_t) 1000000000 + ts.tv_nsec;
+}
+
+void eventTrace_record( const char *name, uint64_t start, int z, uint32_t x,
+			uint32_t y )
+{
+  TraceBuffer buffer = threadBuffer;
+  sTraceEvent *event;
+  uint64_t duration = eventTrace_now() - start;
+
+  if( !__atomic_load_n( &eventTrace_enabled, __ATOMIC_RELAXED ) )
+    return;
+
+  if( buffer == NULL )
+  {
+    buffer = newBuffer();
+    if( buffer == NULL )
+      return;
+  }
+
+  event = &(buffer->events[ buffer->head % EVENT_TRACE_EVENTS ]);
+  event->name = name;
+  event->start = start;
+  event->duration = (duration > UINT32_MAX) ? UINT32_MAX : duration;
+  event->z = z;
+  event->x = x;
+  event->y = y;
+
+  __atomic_store_n( &(buffer->head), buffer->head + 1, __ATOMIC_RELEASE );
+}
+
+Error eventTrace_write( const char *filename )
+{
+  sTraceEvent *events, *event;
+  TraceBuffer buffer;
+  uint64_t head, first, i;
+  bool firstLine = true;
+  int pid = getpid();
+  FILE *file;
+
+  file = fopen( filename, "w" );
+  if( file == NULL )
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not write event trace '%s'",
+		   filename );
+
+  events = malloc( EVENT_TRACE_EVENTS * sizeof( sTraceEvent ) );
+  assert( events != NULL );
+
+  fprintf( file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+
+  for( buffer = __atomic_load_n( &buffers, __ATOMIC_ACQUIRE ); buffer != NULL;
+       buffer = buffer->next )
+  {
+    fprintf( file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+	     "\"tid\":%d,\"args\":{\"name\":\"%s\"}}", firstLine ? "" : ",",
+	     pid, buffer->threadID, buffer->threadName );
+    firstLine = false;
+
+    head = __atomic_load_n( &(buffer->head), __ATOMIC_ACQUIRE );
+    memcpy( events, buffer->events, sizeof( buffer->events ) );
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+
+    // the thread may have written over the oldest events while we copied,
+    // and may be writing the slot after its head
+    first = __atomic_load_n( &(buffer->head), __ATOMIC_RELAXED );
+    first = (first >= EVENT_TRACE_EVENTS) ? first - EVENT_TRACE_EVENTS + 1 : 0;
+
+    for( i = first; i < head; i++ )
+    {
+      event = &(events[ i % EVENT_TRACE_EVENTS ]);
+
+      fprintf( file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+	       "\"ts\":%" PRIu64 ".%03d,\"dur\":%" PRIu32 ".%03d",
+	       event->name, pid, buffer->threadID, event->start / 1000,
+	       (int) (event->start % 1000), event->duration / 1000,
+	       (int) (event->duration % 1000) );
+      if( event->z >= 0 )
+	fprintf( file, ",\"args\":{\"tile\":\"%d/%" PRIu32 "/%" PRIu32 "\"}",
+		 event->z, event->x, event->y );
+      fprintf( file, "}" );
+    }
+  }
+
+  fprintf( file, "\n]}\n" );
+  free( events );
+
+  if( fclose( file ) != 0 )
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not write event trace '%s'",
+		   filename );
+
+  return NULL;
+}
+
+static TraceBuffer newBuffer( void )
+{
+  TraceBuffer buffer;
+
+  buffer = calloc( 1, sizeof( sTraceBuffer ) );
+  if( buffer == NULL )
+    return NULL;
+
+  buffer->threadID = __atomic_add_fetch( &threadCount, 1, __ATOMIC_RELAXED );
+  if( threadName[0] != '\0' )
+    strcpy( buffer->threadName, threadName );
+  else
+    snprintf( buffer->threadName, sizeof( buffer->threadName ), "thread %d",
+	      buffer->threadID );
+
+  buffer->next = __atomic_load_n( &buffers, __ATOMIC_RELAXED );
+  while( !__atomic_compare_exchange_n( &buffers, &(buffer->next), buffer, false,
+				       __ATOMIC_RELEASE, __ATOMIC_RELAXED ) )
+    ;
+
+  threadBuffer = buffer;
+
+  return buffer;
+}
@@ -0,0 +1,59 @@
+/*
+   eventTrace.h
+
+   Timing of the steps of loading and drawing tiles, for chrome://tracing or
+   ui.perfetto.dev. Each thread records its events in a ring buffer of its
+   own, without locks, keeping the latest EVENT_TRACE_EVENTS of them;
+   eventTrace_write saves them as Chrome trace JSON, also while tracing goes
+   on.
+
+   A step is traced like this:
+
+     uint64_t traceStart = TRACE_START();
+     ...
+     TRACE_TILE( traceStart, "decode", tile->z, tile->x, tile->y );
+
+   Names must be string literals, as only the pointer is kept. Tracing is
+   off until eventTrace_enable is called; until then a traced step costs a
+   relaxed load and a branch. Build with -DNO_EVENT_TRACE to leave it out.
+*/
+
+#ifndef EVENT_TRACE_H
+#define EVENT_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <voxi/util/err.h>
+
+/* per thread; 32 bytes each */
+#define EVENT_TRACE_EVENTS 16384
+
+extern bool eventTrace_enabled;
+
+void eventTrace_enable( bool enable );
+/* Shown for the calling thread's events, up to 31 characters */
+void eventTrace_setThreadName( const char *name );
+/* CLOCK_MONOTONIC, in nanoseconds */
+uint64_t eventTrace_now( void );
+/* Records a step of the calling thread, from start until now. z is -1 for
+   steps that are not about a tile. */
+void eventTrace_record( const char *name, uint64_t start, int z, uint32_t x,
+			uint32_t y );
+Error eventTrace_write( const char *filename );
+
+#ifdef NO_EVENT_TRACE
+#define TRACE_START() ((uint64_t) 0)
+#define TRACE_TILE( start, name, z, x, y )				\
+  do { (void) (start); (void) (z); (void) (x); (void) (y); } while( 0 )
+#else
+#define TRACE_START()							\
+  (__atomic_load_n( &eventTrace_enabled, __ATOMIC_RELAXED ) ?		\
+   eventTrace_now() : (uint64_t) 0)
+#define TRACE_TILE( start, name, z, x, y )				\
+  do { if( (start) != 0 ) eventTrace_record( (name), (start), (z), (x), (y) ); } \
+  while( 0 )
+#endif
+#define TRACE_END( start, name ) TRACE_TILE( start, name, -1, 0, 0 )
+
+#endif
@@ -5,17 +5,22 @@
  *
  */
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
-
-#include "bcm_host.h"
+#include <time.h>
 
 #include "GLES2/gl2.h"
+#include "GLES2/gl2ext.h"
 // #include "GLES2/gl2.h" // for GL_UNSIGNED_INT
 #include "EGL/egl.h"
 #include "EGL/eglext.h"
 
+#include "displayBackend.h"
+#include "eventTrace.h"
 #include "tileTexture.h"
 #include "graphics.h"
 
@@ -28,30 +33,53 @@
 #define SHADER_TID_INDEX 2
 
 /*
- * A tile has:
- *   3 vertices with uv
- *   4 vector indexes 
- *   1 texture ID
+ * The tiles are drawn on a fixed grid of gridColumns x gridRows quads, just
+ * enough to cover the surface. Tile (x, y) always goes in grid slot
+ * (x % gridColumns, y % gridRows), and the vertex shader wraps the slots
+ * around the grid's first tile. So the grid mesh is uploaded once, panning
+ * only changes uniforms, and a slot's UVs are only uploaded when its tile
+ * or the tile's texture changes.
+ */
+#define GRID_MAX_COLUMNS 16
+#define GRID_MAX_ROWS 12
+#define MAX_TILES (GRID_MAX_COLUMNS * GRID_MAX_ROWS)
+/* A view across pixels spans at most this many 256 pixel tiles, as tiles
+   are only ever enlarged */
+#define GRID_SIZE( pixels ) (((pixels) + 255) / 256 + 1)
+
+/*
+ * Program cache file format (a cache of the driver's binary, not portable):
+ *
+ *   header        sProgramFileHeader
+ *   binary        length bytes, as from glGetProgramBinaryOES
  */
+#define PROGRAM_FILE_MAGIC "PIGLPROG"
+#define PROGRAM_FILE_VERSION 1
+
+typedef struct
+{
+  char magic[8];  // PROGRAM_FILE_MAGIC, not null terminated
+  uint32_t version;
+  uint32_t hash;  // of the shader sources and the driver's version
+  uint32_t format;
+  uint32_t length;
+} sProgramFileHeader;
+
+/* the static part of a vertex */
 typedef struct 
 {
-  GLfloat /* uint */ position[2]; // TODO: Change this to float
-  float  uv[2];
-} sVertexData, *VertexData;
+  GLfloat slot[2];    // column and row of the vertex's grid slot
+  GLfloat corner[2];  // which corner of the slot, 0 or 1
+} sGridVertex, *GridVertex;
 
 typedef struct
 {
-  sVertexData vertexData[4];
-  GLuint vertexBufferID;
-  // GLuint textureID; // get from tileTexture
   TileTexture tileTexture;
-} sTileData, *TileData;
-
-GLubyte tileIndices[ 4 ] = { 1, 0, 2, 3 };
+  GLuint textureID; // atlas page in this frame, from tileTexture
+  GLfloat uv[4][2]; // as uploaded
+} sSlotData, *SlotData;
 
-#define MAX_TILES (4 * 5)
-
-sTileData tiles[ MAX_TILES ];
+static sSlotData slots[ MAX_TILES ];
 
 /*
 typedef
@@ -69,10 +97,30 @@ static uint32_t screenWidth;
 static uint32_t screenHeight;
 // OpenGL co-ordinates are tile coordinates - tileCenter
 static sTileCoordinate tileCenter;
-static GLuint /* vertexBufferID, */ indexBufferID;
+static GLuint gridBufferID, uvBufferID, indexBufferID;
 // static GLuint textureIDs[ 15 ]; // worst case should be 15 textures
-static void transformVertex( const TileData tile, const float *scaleMatrix,
-			     float *transformed );
+
+/* grid slots of the visible tiles */
+static int visibleSlots[ MAX_TILES ];
+static int gridColumns, gridRows;
+/* bottom left tile of the grid, and its zoom level */
+static sTileCoordinate gridOrigin;
+static int gridZoom;
+
+/* the visible quads' indices, grouped by atlas page, as uploaded */
+static GLushort quadIndices[ MAX_TILES * 6 ];
+static int indexCount;
+
+static sGraphicsStats stats;
+/* draw what is loaded rather than wait for the visible tiles */
+static bool progressive = true;
+/* 16 bit frame buffer */
+static bool rgb565 = false;
+/* linked program binary, or NULL */
+static const char *programCacheFile;
+/* where to render, and the size asked for, 0 for the screen's */
+static const sDisplayBackend *displayBackend;
+static uint32_t requestedWidth, requestedHeight;
 
 /*
     The buffers I want:
@@ -98,12 +146,15 @@ static int /* triangleCount, */ visibleTileCount;
 GLuint programObject;
 
 // Attribute locations
-GLint  positionLoc;
+GLint  slotLoc;
+GLint  cornerLoc;
 GLint  texCoordLoc;
 
 // Uniform locations
 GLint texturesUniformLoc;
 GLint viewMatrixLoc; 
+GLint gridOriginLoc;
+GLint gridSizeLoc;
 
 // Sampler location
 GLint samplerLoc;
@@ -122,21 +173,36 @@ static EGLContext context;
  * local functions
  */
 static void init_ogl( void  );
+static EGLConfig chooseConfig565( const EGLint *attributes );
 static GLuint LoadProgram ( const char *vertShaderSrc, const char *fragShaderSrc );
 static GLuint LoadShader(GLenum type, const char *shaderSrc);
+static GLuint loadCachedProgram( uint32_t hash );
+static void saveCachedProgram( GLuint program, uint32_t hash );
+static bool hasProgramBinaries( void );
+static uint32_t programHash( const char *vertShaderSrc,
+			     const char *fragShaderSrc );
+static bool frameIsFull( void );
+static double threadCpuTime( void );
+static double now( void );
 
 /*
  * start of code 
  */
 void graphics_init()
 {
-    const char *vShaderStr = "attribute vec4 a_position;  \n"
-    "uniform mat4 u_ViewMatrix;        // A constant representing the combined model/view matrix. \n"
+    const char *vShaderStr = "attribute vec2 a_slot;  \n"
+    "attribute vec2 a_corner;     \n"
+    "uniform mat4 u_ViewMatrix;        // from grid cells to the screen \n"
+    "uniform vec2 u_gridOrigin;   // slot of the grid's bottom left tile \n"
+    "uniform vec2 u_gridSize;     \n"
     "attribute vec2 a_texCoord;   \n"
     "varying vec2 v_texCoord;     \n"
     "void main()                  \n"
     "{                            \n"
-    "   gl_Position = u_ViewMatrix * a_position; \n"
+    "   vec2 cell = a_slot - u_gridOrigin + u_gridSize; \n"
+    "   // wrap around; + 0.5 guards floor against rounding \n"
+    "   cell -= u_gridSize * floor( (cell + 0.5) / u_gridSize ); \n"
+    "   gl_Position = u_ViewMatrix * vec4( cell + a_corner, 0.0, 1.0 ); \n"
     "   v_texCoord = a_texCoord;  \n"
     "}                            \n";
 #if 0
@@ -160,8 +226,15 @@ void graphics_init()
           "  gl_FragColor = texture2D( s_texture, v_texCoord );\n"
           "  // gl_FragColor = vec4( 1.0, 0.0, 0.0, 1.0 );\n"
     "}                                                   \n";
+  sGridVertex gridVertices[ MAX_TILES * 4 ];
+  double startTime;
+  uint32_t hash;
   int i;
   
+  if( displayBackend == NULL )
+    displayBackend = displayBackend_find( NULL );
+  // the thread that owns the GL context draws and uploads
+  eventTrace_setThreadName( "render" );
   init_ogl();
 
   assert( glGetError() == GL_NO_ERROR );
@@ -169,26 +242,71 @@ void graphics_init()
    // Set background color and clear buffers
    glClearColor(0.15f, 0.25f, 0.35f, 1.0f);
 
-   // Load the shaders and get a linked program object
-   programObject = LoadProgram( vShaderStr, fShaderStr );
+   // Load the shaders and get a linked program object, from the program
+   // cache if the driver can, which saves compiling them at every start
+   startTime = now();
+   hash = programHash( vShaderStr, fShaderStr );
+   programObject = loadCachedProgram( hash );
+   stats.programCached = programObject != 0;
+   if( programObject == 0 )
+   {
+     programObject = LoadProgram( vShaderStr, fShaderStr );
+     saveCachedProgram( programObject, hash );
+   }
+   stats.programSeconds = now() - startTime;
+   assert( programObject != 0 );
    assert( glGetError() == GL_NO_ERROR );
 
    // Get the attribute locations
-   positionLoc = glGetAttribLocation ( programObject, "a_position" );
+   slotLoc = glGetAttribLocation ( programObject, "a_slot" );
+   cornerLoc = glGetAttribLocation ( programObject, "a_corner" );
    texCoordLoc = glGetAttribLocation ( programObject, "a_texCoord" );
    assert( glGetError() == GL_NO_ERROR );
 
    viewMatrixLoc = glGetUniformLocation( programObject, "u_ViewMatrix" );
+   gridOriginLoc = glGetUniformLocation( programObject, "u_gridOrigin" );
+   gridSizeLoc = glGetUniformLocation( programObject, "u_gridSize" );
    
    // Get the sampler location
    samplerLoc = glGetUniformLocation ( programObject, "s_texture" );
 
-   // glGenBuffers( 1, &vertexBufferID );
+   glUseProgram( programObject );
+   glUniform2f( gridSizeLoc, gridColumns, gridRows );
+
+   glGenBuffers( 1, &gridBufferID );
+   glGenBuffers( 1, &uvBufferID );
    glGenBuffers( 1, &indexBufferID );
    assert( glGetError() == GL_NO_ERROR );
 
+   // corners: top left, bottom left, bottom right, top right
+   for( i = 0; i < MAX_TILES * 4; i++ )
+   {
+     gridVertices[i].slot[0] = (i / 4) % gridColumns;
+     gridVertices[i].slot[1] = (i / 4) / gridColumns;
+     gridVertices[i].corner[0] = ((i % 4) >= 2) ? 1 : 0;
+     gridVertices[i].corner[1] = (((i % 4) == 0) || ((i % 4) == 3)) ? 1 : 0;
+   }
+
+   // the grid never changes
+   glBindBuffer( GL_ARRAY_BUFFER, gridBufferID );
+   glBufferData( GL_ARRAY_BUFFER, sizeof( gridVertices ), gridVertices,
+		 GL_STATIC_DRAW ); // copy data to GPU
+
+   glBindBuffer( GL_ARRAY_BUFFER, uvBufferID );
+   glBufferData( GL_ARRAY_BUFFER, MAX_TILES * sizeof( slots[0].uv ), NULL,
+		 GL_DYNAMIC_DRAW );
+
+   // set up Index buffer stuff
+   glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, indexBufferID );
+   glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof( quadIndices ), NULL,
+		 GL_DYNAMIC_DRAW );
+   assert( glGetError() == GL_NO_ERROR );
+
    for( i = 0; i < MAX_TILES; i++ )
-     tiles[i].vertexBufferID = -1;
+   {
+     slots[i].tileTexture = NULL;
+     slots[i].textureID = -1;
+   }
      
    // Enable back face culling.
    // glEnable(GL_CULL_FACE);
@@ -196,25 +314,29 @@ void graphics_init()
 
 static void init_ogl( void  )
 {
-  int32_t success;
-
-   static EGL_DISPMANX_WINDOW_T nativewindow;
-
-   DISPMANX_ELEMENT_HANDLE_T dispman_element;
-   DISPMANX_DISPLAY_HANDLE_T dispman_display;
-   DISPMANX_UPDATE_HANDLE_T dispman_update;
-   VC_RECT_T dst_rect;
-   VC_RECT_T src_rect;
    EGLBoolean result;
    
    // Change this to get without alpha to save some resources.
-   static const EGLint attribute_list[] =
+   const EGLint attribute_list[] =
    {
       EGL_RED_SIZE, 8,
       EGL_GREEN_SIZE, 8,
       EGL_BLUE_SIZE, 8,
       EGL_ALPHA_SIZE, 0, // was 8
-      EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+      EGL_SURFACE_TYPE, displayBackend->surfaceType,
+      EGL_NONE
+   };
+   // half the frame buffer memory and fill bandwidth
+   const EGLint attribute_list_565[] =
+   {
+      EGL_RED_SIZE, 5,
+      EGL_GREEN_SIZE, 6,
+      EGL_BLUE_SIZE, 5,
+      EGL_ALPHA_SIZE, 0,
+      EGL_BUFFER_SIZE, 16,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+      EGL_SURFACE_TYPE, displayBackend->surfaceType,
       EGL_NONE
    };
 
@@ -227,10 +349,8 @@ static void init_ogl( void  )
    EGLConfig config;
    EGLint num_config;
 
-   bcm_host_init();
-   
    // get an EGL display connection
-   display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+   display = displayBackend->getDisplay();
    assert( display!=EGL_NO_DISPLAY );
 
    // initialize the EGL display connection
@@ -238,8 +358,13 @@ static void init_ogl( void  )
    assert(EGL_FALSE != result);
 
    // get an appropriate EGL frame buffer configuration
-   result = eglChooseConfig( display, attribute_list, &config, 1, &num_config);
-   assert(EGL_FALSE != result);
+   if( rgb565 )
+     config = chooseConfig565( attribute_list_565 );
+   else
+   {
+     result = eglChooseConfig( display, attribute_list, &config, 1, &num_config);
+     assert( (EGL_FALSE != result) && (num_config > 0) );
+   }
 
    // get an appropriate EGL frame buffer configuration
    result = eglBindAPI(EGL_OPENGL_ES_API);
@@ -249,43 +374,60 @@ static void init_ogl( void  )
    context = eglCreateContext( display, config, EGL_NO_CONTEXT, context_attributes );
    assert( context != EGL_NO_CONTEXT );
 
-   // create an EGL window surface
-   success = graphics_get_display_size(0 /* LCD */, &screenWidth, &screenHeight);
-   assert( success >= 0 );
-
-   printf( "Screen size: %d x %d pixels\n", screenWidth, screenHeight );
-   
-   dst_rect.x = 0;
-   dst_rect.y = 0;
-   dst_rect.width = screenWidth;
-   dst_rect.height = screenHeight;
-      
-   src_rect.x = 0;
-   src_rect.y = 0;
-   src_rect.width = screenWidth << 16;
-   src_rect.height = screenHeight << 16;
-
-   dispman_display = vc_dispmanx_display_open( 0 /* LCD */);
-   dispman_update = vc_dispmanx_update_start( 0 );
-         
-   dispman_element = vc_dispmanx_element_add ( dispman_update, dispman_display,
-      0/*layer*/, &dst_rect, 0/*src*/,
-      &src_rect, DISPMANX_PROTECTION_NONE, 0 /*alpha*/, 0/*clamp*/, 0/*transform*/);
-      
-   nativewindow.element = dispman_element;
-   nativewindow.width = screenWidth;
-   nativewindow.height = screenHeight;
-   vc_dispmanx_update_submit_sync( dispman_update );
-      
-   surface = eglCreateWindowSurface(  display, config, &nativewindow, NULL );
+   // create the window or offscreen surface
+   screenWidth = requestedWidth;
+   screenHeight = requestedHeight;
+   surface = displayBackend->createSurface( display, config, &screenWidth,
+					    &screenHeight );
    assert(surface != EGL_NO_SURFACE);
 
+   // the screen's size, if none was asked for, may be too large as well
+   if( (GRID_SIZE( screenWidth ) > GRID_MAX_COLUMNS) ||
+       (GRID_SIZE( screenHeight ) > GRID_MAX_ROWS) )
+   {
+     fprintf( stderr, "%u x %u pixels is larger than the %d x %d pixels the "
+	      "tile grid can cover\n", screenWidth, screenHeight,
+	      (GRID_MAX_COLUMNS - 1) * 256, (GRID_MAX_ROWS - 1) * 256 );
+     exit( 1 );
+   }
+   gridColumns = GRID_SIZE( screenWidth );
+   gridRows = GRID_SIZE( screenHeight );
+
    // connect the context to the surface
    result = eglMakeCurrent( display, surface, surface, context);
    assert(EGL_FALSE != result);
 
 }
 
+/*
+ * eglChooseConfig sorts configs with more color bits first, so the first
+ * match for 5/6/5 may well be 8/8/8. Returns the first exact match.
+ */
+static EGLConfig chooseConfig565( const EGLint *attributes )
+{
+  EGLConfig configs[ 32 ];
+  EGLint count, red, green, blue;
+  EGLBoolean result;
+  int i;
+
+  result = eglChooseConfig( display, attributes, configs, 32, &count );
+  assert( EGL_FALSE != result );
+
+  for( i = 0; i < count; i++ )
+  {
+    eglGetConfigAttrib( display, configs[i], EGL_RED_SIZE, &red );
+    eglGetConfigAttrib( display, configs[i], EGL_GREEN_SIZE, &green );
+    eglGetConfigAttrib( display, configs[i], EGL_BLUE_SIZE, &blue );
+    if( (red == 5) && (green == 6) && (blue == 5) )
+      return configs[i];
+  }
+
+  printf( "No RGB565 frame buffer, using a deeper one\n" );
+  assert( count > 0 );
+
+  return configs[0];
+}
+
 // scale here is exponential (zoom)
 void graphics_setMap( float scale, const TileCoordinate center )
 {
@@ -295,7 +437,11 @@ void graphics_setMap( float scale, const TileCoordinate center )
   sTileCoordinate upperLeft, bottomRight, screenSizeTiles, topLeftTile, bottomRightTile;
   // int vertexCount;
   int /* vertexCountX, vertexCountY, */ x, y, i;
-  int heightTiles, widthTiles;
+  int heightTiles, widthTiles, oldTileCount;
+  sTileBounds viewBounds;
+  TileTexture oldTiles[ MAX_TILES ];
+  double startTime = threadCpuTime();
+  uint64_t traceStart = TRACE_START();
 
   // makes ure all is good on entry
   assert( glGetError() == GL_NO_ERROR );
@@ -328,6 +474,12 @@ void graphics_setMap( float scale, const TileCoordinate center )
 #endif	  
   widthTiles = bottomRightTile.x - topLeftTile.x + 1;
   heightTiles = topLeftTile.y - bottomRightTile.y + 1;
+
+  // the tiles of the previous view, to demote those that left it
+  oldTileCount = visibleTileCount;
+  for( i = 0; i < oldTileCount; i++ )
+    oldTiles[i] = slots[ visibleSlots[i] ].tileTexture;
+
   visibleTileCount = widthTiles * heightTiles;
   // trianglesCount = visibleTileCount * 2;
 
@@ -339,17 +491,18 @@ void graphics_setMap( float scale, const TileCoordinate center )
   
   // tileStep = pow( 2, 32 - scale );
 
-  glUseProgram( programObject );
-  assert( glGetError() == GL_NO_ERROR );
+  assert( (widthTiles <= gridColumns) && (heightTiles <= gridRows) );
+
+  gridZoom = zoomLevel;
+  gridOrigin.x = topLeftTile.x;
+  gridOrigin.y = bottomRightTile.y;
 
   //
   for( y = 0, i = 0; y < heightTiles; y++ )
     for( x = 0; x < widthTiles; x++, i++ )
       {
-	// char buf[256];
-	// int success;
-	// int width, height;
-	int tileX, tileY;
+	uint32_t tileX, tileY;
+	int slot;
 	TileTexture tileTex;
 	
 	tileX = topLeftTile.x + x;
@@ -359,74 +512,36 @@ void graphics_setMap( float scale, const TileCoordinate center )
 	tileTex = tileTex_get( zoomLevel, tileX, tileY );
 	tileTex_setVisible( tileTex, true );
 
-	assert( i < MAX_TILES );
-	
-	tiles[i].tileTexture = tileTex;
-	
-	// top left corner. Largest Y, smallest X
-	tiles[i].vertexData[0].position[0] =
-	  (GLfloat) ( (((int64_t) tileX) << (32-zoomLevel)) - tileCenter.x);
-	tiles[i].vertexData[0].position[1] =
-	  (GLfloat) ( (((int64_t) (tileY + 1)) << (32-zoomLevel)) - tileCenter.y);
-	// tiles[i].vertexData[0].position[2] = 0;
-
-	// bottom left corner. Smallest Y smallest X
-	tiles[i].vertexData[1].position[0] =
-	  (GLfloat) ( (((int64_t) (topLeftTile.x + x)) << (32-zoomLevel)) - tileCenter.x);
-	tiles[i].vertexData[1].position[1] =
-	  (GLfloat) ( (((int64_t) (topLeftTile.y - y)) << (32-zoomLevel)) - tileCenter.y);
-	// tiles[i].vertexData[1].position[2] = 0;
-
-	// right bottom corner. Large X, small Y
-	tiles[i].vertexData[2].position[0] =
-	  (GLfloat) ((( (int64_t) (topLeftTile.x + x + 1)) << (32-zoomLevel)) -
-		     tileCenter.x);
-	tiles[i].vertexData[2].position[1] =
-	  (GLfloat) ((( (int64_t) (topLeftTile.y - y)) << (32-zoomLevel)) -
-		     tileCenter.y);
-	// tiles[i].vertexData[2].position[2] = 0;
-
-	// right upper corner. Large X, large Y
-	tiles[i].vertexData[3].position[0] =
-	  (GLfloat) ((( (int64_t) (topLeftTile.x + x + 1)) << (32-zoomLevel)) -
-		     tileCenter.x);
-	tiles[i].vertexData[3].position[1] =
-	  (GLfloat) ((( (int64_t) (topLeftTile.y - y + 1)) << (32-zoomLevel)) -
-		     tileCenter.y);
-	// tiles[i].vertexData[3].position[2] = 0;
-
-	float u0, u1, v0, v1;
-
-	tileTex_getUV( tileTex, &u0, &v0, &u1, &v1 );
-	
-	tiles[i].vertexData[0].uv[0] = u0; // get from tileTex?
-	tiles[i].vertexData[0].uv[1] = v0;
-
-	tiles[i].vertexData[1].uv[0] = u0;
-	tiles[i].vertexData[1].uv[1] = v1;
-
-	tiles[i].vertexData[2].uv[0] = u1;
-	tiles[i].vertexData[2].uv[1] = v1;
-
-	tiles[i].vertexData[3].uv[0] = u1;
-	tiles[i].vertexData[3].uv[1] = v0;
+	slot = (tileY % gridRows) * gridColumns + tileX % gridColumns;
+	visibleSlots[i] = slot;
+	slots[ slot ].tileTexture = tileTex;
 #if 0
-	printf( "Using tile #%d: z %d %d/%d (%f,%f) - (%f,%f).\n", i,
-		zoomLevel, tileX, tileY, tiles[i].vertexData[0].position[0],
-		tiles[i].vertexData[0].position[1],
-		tiles[i].vertexData[2].position[0],
-		tiles[i].vertexData[2].position[1]);
+	printf( "Using tile #%d: z %d %d/%d in slot %d.\n", i, zoomLevel,
+		tileX, tileY, slot );
 #endif
       }
-  assert( glGetError() == GL_NO_ERROR );
-  // set up Index buffer stuff
-  // this only needs to be done once
-  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, indexBufferID );
-  glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof( tileIndices ), tileIndices,
-		GL_STATIC_DRAW ); // copy data to GPU
 
+  for( i = 0; i < oldTileCount; i++ )
+  {
+    for( x = 0; x < visibleTileCount; x++ )
+      if( slots[ visibleSlots[x] ].tileTexture == oldTiles[i] )
+	break;
+
+    if( x == visibleTileCount )
+      tileTex_setVisible( oldTiles[i], false );
+  }
+
+  // plans prefetching for the new view, and cancels loads the old one needed
+  viewBounds.minX = topLeftTile.x;
+  viewBounds.minY = bottomRightTile.y;
+  viewBounds.maxX = bottomRightTile.x;
+  viewBounds.maxY = topLeftTile.y;
+  tileTex_setView( zoomLevel, &viewBounds );
   assert( glGetError() == GL_NO_ERROR );
 
+  stats.cpuSeconds += threadCpuTime() - startTime;
+  TRACE_END( traceStart, "set map" );
+
    //   glVertexAttribPointer( positionLoc, 3, 
    //   glEnableVertexAttribArray( positionLoc );
    
@@ -451,15 +566,26 @@ void graphics_redraw( float zoom, uint32_t top, uint32_t bottom, uint32_t left,
   float scalex = 1.5 * pow( 2, zoom - 32 + 9 ) / screenWidth ; // in pixels / tile coordinate
   float scaley = 1.5 * pow( 2, zoom - 32 + 9 ) / screenHeight ; // in pixels / tile coordinate
   // zoom = 11. screenWidth = 600 -> scale = 600 / (2^28) = 
-  int i;
-  /* NOTE: must be -scale * tileCenter.x below, not scale * -tileCenter.x, or 
-     it will try to make the uint32_t tileCenter.x signed, which will not give 
-     the desired result */
-  GLfloat scaleMatrix[] = { scalex, 0, 0, 0,
-			    0, scaley, 0, 0,
+  int i, j, batchCount, count;
+  bool batched[ MAX_TILES ] = { false };
+  GLushort indices[ MAX_TILES * 6 ];
+  GLuint batchTextures[ MAX_TILES ];
+  int batchStarts[ MAX_TILES + 1 ];  // first index of each batch
+  double startTime = threadCpuTime();
+  uint64_t traceStart = TRACE_START(), swapStart;
+  // grid cells are tiles at gridZoom, offset from the grid's origin tile
+  double tileSize = pow( 2, 32 - gridZoom );
+  /* NOTE: the origin must be converted to int64_t before tileCenter.x is
+     subtracted, or it will try to make the uint32_t tileCenter.x signed, which
+     will not give the desired result */
+  GLfloat scaleMatrix[] = { scalex * tileSize, 0, 0, 0,
+			    0, scaley * tileSize, 0, 0,
 			    0, 0, 1, 0,
-			    // -scalex * tileCenter.x, -scaley * tileCenter.y, 0, 1 };
-			    0, 0, 0, 1 };
+			    scalex * ((((int64_t) gridOrigin.x) << (32 - gridZoom)) -
+				      (int64_t) tileCenter.x),
+			    scaley * ((((int64_t) gridOrigin.y) << (32 - gridZoom)) -
+				      (int64_t) tileCenter.y),
+			    0, 1 };
   // left tile = 2 359 750 565 * scale = 5274
   // shift is scale * -tileCenter.x = 5279.9 -> -6, scale * -tileCenter.y = 3 025 055 848 * scale = 6762
   // right tile = 2 364 665 765 * scale = 5285
@@ -522,83 +648,334 @@ void graphics_redraw( float zoom, uint32_t top, uint32_t bottom, uint32_t left,
   assert( glGetError() == GL_NO_ERROR );
   
   glUniformMatrix4fv( viewMatrixLoc, 1, GL_FALSE, scaleMatrix);
+  glUniform2f( gridOriginLoc, gridOrigin.x % gridColumns,
+	       gridOrigin.y % gridRows );
   assert( glGetError() == GL_NO_ERROR );
 
-  // wait for textures to be loaded
-  tileTex_waitVisibleLoaded();
+  // otherwise tiles that are not loaded yet are drawn from their ancestors,
+  // and replaced in later frames as they arrive
+  if( !progressive )
+  {
+    double waitStart = now();
+
+    tileTex_waitVisibleLoaded();
+    stats.waitSeconds += now() - waitStart;
+  }
   
-  // loop over tiles
-  // it seems inefficent to have a triangle strip for each quad, but I spent
-  // a day trying to figure how I could do a Triangle Strip with different
-  // textures in each triangle, but without success.
+  // make the tiles' textures, and upload the UVs of the slots whose tile or
+  // texture has changed
+  glBindBuffer( GL_ARRAY_BUFFER, uvBufferID );
+
   for( i = 0; i < visibleTileCount; i++ )
   {
-    TileData tile = &(tiles[i]);
-    float transformed[4][2];
-    TileTexture tileTex;
-    GLuint textureID;
-    
-    tileTex = tile->tileTexture;
-    /*
-    if( !tileTex_isLoaded( tileTex ) )
-      continue;
-    */
-    textureID = tileTex_makeTextureID( tileTex );
+    SlotData slot = &(slots[ visibleSlots[i] ]);
+    float u0, u1, v0, v1;
+    GLfloat uv[4][2];
 
-    if( textureID == -1 )
+    slot->textureID = tileTex_getTexture( slot->tileTexture, &u0, &v0,
+					  &u1, &v1 );
+    if( slot->textureID == -1 )
     {
       // printf( "Skipping tile %d because it has no textureID\n", i );
+      stats.tilesSkipped++;
       continue;
     }
 
-      // set up Vertex buffer stuff
-    if( tiles[i].vertexBufferID == -1 )
-      glGenBuffers( 1, &(tiles[i].vertexBufferID) );
-    
-    glBindBuffer( GL_ARRAY_BUFFER, tiles[ i ].vertexBufferID );
-    assert( glGetError() == GL_NO_ERROR );
-    glBufferData( GL_ARRAY_BUFFER, sizeof( tiles[i].vertexData ),
-		  tiles[i].vertexData, GL_STATIC_DRAW ); // copy data to GPU
-    assert( glGetError() == GL_NO_ERROR );
-    // generate texture id
+    // same corner order as the grid
+    uv[0][0] = u0;
+    uv[0][1] = v0;
+    uv[1][0] = u0;
+    uv[1][1] = v1;
+    uv[2][0] = u1;
+    uv[2][1] = v1;
+    uv[3][0] = u1;
+    uv[3][1] = v0;
+
+    if( memcmp( uv, slot->uv, sizeof( uv ) ) != 0 )
+    {
+      memcpy( slot->uv, uv, sizeof( uv ) );
+      glBufferSubData( GL_ARRAY_BUFFER, visibleSlots[i] * sizeof( uv ),
+		       sizeof( uv ), uv );
+      stats.bufferUploads++;
+    }
+  }
 
-    // debug
-    transformVertex( tile, scaleMatrix, (float *) &transformed );
-#if 0
-    printf( "tile %d transformed to (%f,%f), (%f,%f), (%f,%f), (%f,%f)\n",
-	    i,
-	    transformed[0][0], transformed[0][1],
-	    transformed[1][0], transformed[1][1],
-	    transformed[2][0], transformed[2][1],
-	    transformed[3][0], transformed[3][1] );
-#endif
-    glBindTexture( GL_TEXTURE_2D, textureID );
-    assert( glGetError() == GL_NO_ERROR );
+  // gather the quads page by page, so that each page takes one draw call
+  for( i = 0, count = 0, batchCount = 0; i < visibleTileCount; i++ )
+  {
+    GLuint textureID = slots[ visibleSlots[i] ].textureID;
 
-    glBindBuffer( GL_ARRAY_BUFFER, tile->vertexBufferID );
-    assert( glGetError() == GL_NO_ERROR );
-    
-    glVertexAttribPointer( positionLoc, 2, GL_FLOAT /* was uint */, GL_FALSE,
-			   sizeof(sVertexData),
-			   (void *) offsetof( sVertexData, position));
-    assert( glGetError() == GL_NO_ERROR );
-    glVertexAttribPointer( texCoordLoc, 2, GL_FLOAT, GL_FALSE,
-			   sizeof(sVertexData), (void *) offsetof( sVertexData, uv ) );
-    assert( glGetError() == GL_NO_ERROR );
+    if( batched[i] || (textureID == -1) )
+      continue;
 
-    glEnableVertexAttribArray( positionLoc );
-    glEnableVertexAttribArray( texCoordLoc );
-    
-    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, indexBufferID );
-    assert( glGetError() == GL_NO_ERROR );
+    batchTextures[ batchCount ] = textureID;
+    batchStarts[ batchCount ] = count;
+    batchCount++;
+
+    for( j = i; j < visibleTileCount; j++ )
+      if( !batched[j] && (slots[ visibleSlots[j] ].textureID == textureID) )
+      {
+	int first = visibleSlots[j] * 4;
+
+	// two triangles, (1, 0, 2) and (0, 2, 3)
+	indices[ count++ ] = first + 1;
+	indices[ count++ ] = first + 0;
+	indices[ count++ ] = first + 2;
+	indices[ count++ ] = first + 0;
+	indices[ count++ ] = first + 2;
+	indices[ count++ ] = first + 3;
+	batched[j] = true;
+      }
+  }
+  batchStarts[ batchCount ] = count;
+
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, indexBufferID );
+  if( (count != indexCount) ||
+      (memcmp( indices, quadIndices, count * sizeof( GLushort ) ) != 0) )
+  {
+    memcpy( quadIndices, indices, count * sizeof( GLushort ) );
+    indexCount = count;
+    glBufferSubData( GL_ELEMENT_ARRAY_BUFFER, 0, count * sizeof( GLushort ),
+		     quadIndices );
+    stats.bufferUploads++;
+  }
+  assert( glGetError() == GL_NO_ERROR );
+
+  glBindBuffer( GL_ARRAY_BUFFER, gridBufferID );
+  glVertexAttribPointer( slotLoc, 2, GL_FLOAT, GL_FALSE, sizeof( sGridVertex ),
+			 (void *) offsetof( sGridVertex, slot ) );
+  glVertexAttribPointer( cornerLoc, 2, GL_FLOAT, GL_FALSE, sizeof( sGridVertex ),
+			 (void *) offsetof( sGridVertex, corner ) );
+  glBindBuffer( GL_ARRAY_BUFFER, uvBufferID );
+  glVertexAttribPointer( texCoordLoc, 2, GL_FLOAT, GL_FALSE, 0, NULL );
+  assert( glGetError() == GL_NO_ERROR );
 
-    glDrawElements( GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_BYTE, NULL );
+  glEnableVertexAttribArray( slotLoc );
+  glEnableVertexAttribArray( cornerLoc );
+  glEnableVertexAttribArray( texCoordLoc );
 
+  for( i = 0; i < batchCount; i++ )
+  {
+    glBindTexture( GL_TEXTURE_2D, batchTextures[i] );
+    assert( glGetError() == GL_NO_ERROR );
+
+    glDrawElements( GL_TRIANGLES, batchStarts[ i + 1 ] - batchStarts[i],
+		    GL_UNSIGNED_SHORT,
+		    (void *) (batchStarts[i] * sizeof( GLushort )) );
     assert( glGetError() == GL_NO_ERROR );
   }
 
+  stats.frames++;
+  stats.drawCalls += batchCount;
+
+  swapStart = TRACE_START();
   eglSwapBuffers( display, surface );
-  
+  // offscreen, swapping doesn't wait for the GPU, so frame times would
+  // leave out rendering
+  if( displayBackend->offscreen )
+    glFinish();
+  TRACE_END( swapStart, "swap" );
+
+  if( (stats.firstFullFrame == 0) && frameIsFull() )
+    stats.firstFullFrame = now();
+
+  // free tiles that are no longer needed, if we are over the memory budget
+  tileTex_trimCache();
+
+  stats.cpuSeconds += threadCpuTime() - startTime;
+  TRACE_END( traceStart, "redraw" );
+}
+
+void graphics_setProgressive( bool progressiveParam )
+{
+  progressive = progressiveParam;
+  tileTex_setProgressive( progressive );
+}
+
+void graphics_setRGB565( bool rgb565Param )
+{
+  rgb565 = rgb565Param;
+}
+
+Error graphics_setDisplay( const char *backend, uint32_t width,
+			   uint32_t height )
+{
+  displayBackend = displayBackend_find( backend );
+  if( displayBackend == NULL )
+    return ErrNew( ERR_APP, 0, NULL, "No display backend '%s'", backend );
+
+  if( (GRID_SIZE( width ) > GRID_MAX_COLUMNS) ||
+      (GRID_SIZE( height ) > GRID_MAX_ROWS) )
+    return ErrNew( ERR_APP, 0, NULL, "%u x %u pixels is larger than the %d x "
+		   "%d pixels the tile grid can cover", width, height,
+		   (GRID_MAX_COLUMNS - 1) * 256, (GRID_MAX_ROWS - 1) * 256 );
+
+  requestedWidth = width;
+  requestedHeight = height;
+
+  return NULL;
+}
+
+void graphics_setProgramCache( const char *filename )
+{
+  programCacheFile = filename;
+}
+
+void graphics_getStats( GraphicsStats statsOut )
+{
+  *statsOut = stats;
+}
+
+/*
+ * Returns the program saved in the program cache, or 0 if there is none, it
+ * was made from other shaders or by another driver, or the driver can't
+ * load program binaries (GL_OES_get_program_binary).
+ */
+static GLuint loadCachedProgram( uint32_t hash )
+{
+  PFNGLPROGRAMBINARYOESPROC programBinary;
+  sProgramFileHeader header;
+  GLuint program = 0;
+  GLint linked;
+  void *binary = NULL;
+  FILE *file;
+
+  programBinary = (PFNGLPROGRAMBINARYOESPROC)
+    eglGetProcAddress( "glProgramBinaryOES" );
+  if( (programCacheFile == NULL) || !hasProgramBinaries() ||
+      (programBinary == NULL) )
+    return 0;
+
+  file = fopen( programCacheFile, "rb" );
+  if( file == NULL )
+    return 0;
+
+  if( (fread( &header, sizeof( header ), 1, file ) != 1) ||
+      (memcmp( header.magic, PROGRAM_FILE_MAGIC, sizeof( header.magic ) ) != 0) ||
+      (header.version != PROGRAM_FILE_VERSION) || (header.hash != hash) ||
+      ((binary = malloc( header.length )) == NULL) ||
+      (fread( binary, header.length, 1, file ) != 1) )
+    goto DONE;
+
+  program = glCreateProgram();
+  programBinary( program, header.format, binary, header.length );
+
+  // the driver may refuse the binary, e.g. after an update
+  glGetProgramiv( program, GL_LINK_STATUS, &linked );
+  if( !linked )
+  {
+    glDeleteProgram( program );
+    program = 0;
+  }
+
+ DONE:
+  free( binary );
+  fclose( file );
+  // a refused binary leaves an error behind
+  while( glGetError() != GL_NO_ERROR )
+    ;
+
+  return program;
+}
+
+/* Saves the program in the program cache, if the driver can */
+static void saveCachedProgram( GLuint program, uint32_t hash )
+{
+  PFNGLGETPROGRAMBINARYOESPROC getProgramBinary;
+  sProgramFileHeader header;
+  GLint length = 0, formats = 0;
+  GLenum format;
+  void *binary;
+  bool ok;
+  FILE *file;
+
+  getProgramBinary = (PFNGLGETPROGRAMBINARYOESPROC)
+    eglGetProcAddress( "glGetProgramBinaryOES" );
+  if( (programCacheFile == NULL) || (program == 0) || !hasProgramBinaries() ||
+      (getProgramBinary == NULL) )
+    return;
+
+  glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats );
+  glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH_OES, &length );
+  if( (glGetError() != GL_NO_ERROR) || (formats == 0) || (length <= 0) )
+    return;
+
+  binary = malloc( length );
+  assert( binary != NULL );
+
+  getProgramBinary( program, length, &length, &format, binary );
+  if( glGetError() != GL_NO_ERROR )
+  {
+    free( binary );
+    return;
+  }
+
+  memset( &header, 0, sizeof( header ) );
+  memcpy( header.magic, PROGRAM_FILE_MAGIC, sizeof( header.magic ) );
+  header.version = PROGRAM_FILE_VERSION;
+  header.hash = hash;
+  header.format = format;
+  header.length = length;
+
+  // only an optimization, so errors are just reported
+  file = fopen( programCacheFile, "wb" );
+  ok = (file != NULL) &&
+    (fwrite( &header, sizeof( header ), 1, file ) == 1) &&
+    (fwrite( binary, length, 1, file ) == 1);
+  if( (file != NULL) && (fclose( file ) != 0) )
+    ok = false;
+  if( !ok )
+  {
+    perror( programCacheFile );
+    remove( programCacheFile );
+  }
+
+  free( binary );
+}
+
+static bool hasProgramBinaries( void )
+{
+  const char *extensions = (const char *) glGetString( GL_EXTENSIONS );
+
+  return (extensions != NULL) &&
+    (strstr( extensions, "GL_OES_get_program_binary" ) != NULL);
+}
+
+/* FNV-1a of the shader sources and the driver's renderer and version */
+static uint32_t programHash( const char *vertShaderSrc,
+			     const char *fragShaderSrc )
+{
+  const char *strings[4];
+  const char *p;
+  uint32_t hash = 2166136261u;
+  int i;
+
+  strings[0] = vertShaderSrc;
+  strings[1] = fragShaderSrc;
+  strings[2] = (const char *) glGetString( GL_RENDERER );
+  strings[3] = (const char *) glGetString( GL_VERSION );
+
+  for( i = 0; i < 4; i++ )
+    for( p = strings[i]; (p != NULL) && (*p != '\0'); p++ )
+      hash = (hash ^ (unsigned char) *p) * 16777619u;
+
+  return hash;
+}
+
+/*
+ * Whether every visible tile was drawn in the frame just shown, and from
+ * its own texture rather than an ancestor's stand in.
+ */
+static bool frameIsFull( void )
+{
+  int i;
+
+  for( i = 0; i < visibleTileCount; i++ )
+    if( (slots[ visibleSlots[i] ].textureID == -1) ||
+	!tileTex_isFinal( slots[ visibleSlots[i] ].tileTexture ) )
+      return false;
+
+  return visibleTileCount > 0;
 }
 
 static GLuint LoadProgram ( const char *vertShaderSrc, const char *fragShaderSrc )
@@ -696,20 +1073,21 @@ static GLuint LoadShader(GLenum type, const char *shaderSrc)
   return shader;
 }
 
-// for debugging
-static void transformVertex( const TileData tile, const float *scaleMatrix,
-			     float *transformed )
+/* CPU time used by the calling thread, which excludes time spent waiting */
+static double threadCpuTime( void )
 {
-  int i;
-  for( i = 0; i < 4; i++ )
-  {
-    VertexData vd = &(tile->vertexData[i]);
-    
-    transformed[ i * 2 ] = vd->position[0] * scaleMatrix[0] +
-      vd->position[1] * scaleMatrix[ 4 ] + scaleMatrix[ 12 ];
-    transformed[ i * 2 + 1 ] =
-      vd->position[0] * scaleMatrix[ 1 ] +
-      vd->position[1] * scaleMatrix[ 5 ] +
-      scaleMatrix[ 13 ];
-  }
+  struct timespec ts;
+
+  clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
@@ -8,8 +8,11 @@
 #ifndef GRAPHICS_H
 #define GRAPHICS_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include <voxi/util/err.h>
+
 /* Tile coordinates are integers, where the highest order bit indicates the 
    coordinate at zoom level 1, the first two bits the coordinates at zoom 
    level 2 etc.
@@ -19,9 +22,41 @@ typedef struct
   uint32_t x, y;
 } sTileCoordinate, *TileCoordinate;
 
+/* Counters for measuring rendering cost */
+typedef struct
+{
+  uint64_t frames;
+  uint64_t drawCalls;
+  uint64_t bufferUploads;  // vertex and index buffer updates
+  uint64_t tilesSkipped;  // visible tiles with nothing loaded to draw yet
+  double cpuSeconds;  // render thread CPU time in graphics_setMap and _redraw
+  double waitSeconds; // blocked in tileTex_waitVisibleLoaded, if not progressive
+  double programSeconds;  // to compile the shaders, or load them cached
+  bool programCached;     // the program came from the program cache
+  /* CLOCK_MONOTONIC time the first frame with every visible tile drawn in
+     full was shown, or 0 until then */
+  double firstFullFrame;
+} sGraphicsStats, *GraphicsStats;
+
 void graphics_init();
 void graphics_setMap( float scale, const TileCoordinate center );
 void graphics_redraw( float zoom, uint32_t top, uint32_t bottom, uint32_t left,
 		      uint32_t right );
+/* If true, the default, graphics_redraw doesn't wait for tiles to load */
+void graphics_setProgressive( bool progressive );
+/* Renders with the display backend called backend (see displayBackend.h),
+   or the default if NULL, at width x height pixels, or the screen's size
+   if 0. Fails if there is no such backend, or the surface is too large for
+   the tile grid. Must be called before graphics_init. */
+Error graphics_setDisplay( const char *backend, uint32_t width,
+			   uint32_t height );
+/* Render to a 16 bit RGB565 frame buffer. Must be called before
+   graphics_init. */
+void graphics_setRGB565( bool rgb565Param );
+/* Keep the linked shader program in filename, where the driver supports
+   GL_OES_get_program_binary, to skip compiling it at the next start. Must
+   be called before graphics_init. */
+void graphics_setProgramCache( const char *filename );
+void graphics_getStats( GraphicsStats stats );
 
 #endif
@@ -0,0 +1,221 @@
+/*
+ *  loaderBench.c
+ *
+ * Measures how tile loading throughput scales with the number of loader
+ * threads. Each loader count is run in its own process, so that every run
+ * starts with an empty tile cache.
+ *
+ * usage: loaderBench [options] <tile directory> <zoom> <x> <y> [max loaders]
+ *                    [size]
+ *   -c           cold page cache: drop the tiles from the page cache before
+ *                every run, rather than warm it up with a first run
+ *   -b <tiles>   tiles requested at a time, by default a row of the block
+ *
+ * Loads a size x size block of visible tiles around tile x, y, in batches,
+ * waiting for each batch to be loaded like the render thread does when the
+ * view moves on to new tiles. Reports the tiles loaded per second, ancestors
+ * included, and the distribution of the batches' latency, from
+ * tileTex_setVisible to tileTex_waitVisibleLoaded returning. Fails if no tile
+ * was loaded. tileGen writes a synthetic tile set to run it on.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <assert.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "benchStats.h"
+#include "tileTexture.h"
+
+#define CACHE_BYTES (256 * 1024 * 1024)
+
+/*
+ * Local function prototypes
+ */
+static void usage( const char *program );
+static bool runBenchmark( const char *tilePath, int loaderCount, int z,
+			  uint32_t x, uint32_t y, int size, int batch,
+			  bool report );
+static void dropPageCache( const char *tilePath );
+static int dropFile( const char *path, const struct stat *st, int type,
+		     struct FTW *ftw );
+
+/*
+ * Global data
+ */
+static bool cold = false;
+
+/*
+ * Start of code
+ */
+int main( int argc, char **argv )
+{
+  int z, maxLoaders = 4, size = 16, batch = 0, loaderCount, option;
+  uint32_t x, y;
+  const char *tilePath;
+
+  while( (option = getopt( argc, argv, "cb:" )) != -1 )
+    switch( option )
+    {
+      case 'c':
+	cold = true;
+	break;
+
+      case 'b':
+	batch = atoi( optarg );
+	break;
+
+      default:
+	usage( argv[0] );
+    }
+
+  if( argc - optind < 4 )
+    usage( argv[0] );
+
+  tilePath = argv[ optind ];
+  z = atoi( argv[ optind + 1 ] );
+  x = strtoul( argv[ optind + 2 ], NULL, 10 );
+  y = strtoul( argv[ optind + 3 ], NULL, 10 );
+  if( argc - optind > 4 )
+    maxLoaders = atoi( argv[ optind + 4 ] );
+  if( argc - optind > 5 )
+    size = atoi( argv[ optind + 5 ] );
+  if( batch <= 0 )
+    batch = size;
+
+  if( (size < 1) || (maxLoaders < 1) )
+    usage( argv[0] );
+
+  // warm up the page cache
+  if( !cold && !runBenchmark( tilePath, 1, z, x, y, size, batch, false ) )
+    return 1;
+
+  for( loaderCount = 1; loaderCount <= maxLoaders; loaderCount++ )
+  {
+    if( cold )
+      dropPageCache( tilePath );
+    if( !runBenchmark( tilePath, loaderCount, z, x, y, size, batch, true ) )
+      return 1;
+  }
+
+  return 0;
+}
+
+static void usage( const char *program )
+{
+  fprintf( stderr, "usage: %s [-c] [-b batch] <tile directory> <zoom> <x> <y> "
+	   "[max loaders] [size]\n", program );
+  exit( 1 );
+}
+
+/* Returns false if the run failed or loaded nothing */
+static bool runBenchmark( const char *tilePath, int loaderCount, int z,
+			  uint32_t x, uint32_t y, int size, int batch,
+			  bool report )
+{
+  pid_t pid;
+  int status;
+
+  fflush( stdout );
+
+  pid = fork();
+  assert( pid >= 0 );
+
+  if( pid == 0 )
+  {
+    sTileTexStats stats;
+    double start, batchStart, elapsed, *latencies;
+    int tileCount = size * size, batchCount = (tileCount + batch - 1) / batch,
+      i;
+    Error error;
+
+    latencies = malloc( batchCount * sizeof( double ) );
+    assert( latencies != NULL );
+
+    error = tileTex_init( tilePath, CACHE_BYTES, loaderCount );
+    if( error != NULL )
+    {
+      ErrReport( error );
+      _exit( 1 );
+    }
+
+    start = benchStats_now();
+    for( i = 0; i < tileCount; i += batch )
+    {
+      int j;
+
+      batchStart = benchStats_now();
+      for( j = i; (j < i + batch) && (j < tileCount); j++ )
+	tileTex_setVisible( tileTex_get( z, x - size / 2 + j % size,
+					 y - size / 2 + j / size ), true );
+      tileTex_waitVisibleLoaded();
+      latencies[ i / batch ] = benchStats_now() - batchStart;
+    }
+    elapsed = benchStats_now() - start;
+
+    tileTex_getStats( &stats );
+    // outside the tile set, nothing is loaded and every batch returns at once
+    if( stats.loaded == 0 )
+    {
+      fprintf( stderr, "No tiles loaded around %d/%u/%u in %s\n", z, x, y,
+	       tilePath );
+      _exit( 1 );
+    }
+
+    benchStats_sort( latencies, batchCount );
+
+    if( report )
+      printf( "loaders=%d: %llu tiles loaded in %.3f s, %.1f tiles/s, "
+	      "%d-tile batches p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, "
+	      "max %.2f ms (%d visible, %llu stolen)\n",
+	      loaderCount, (unsigned long long) stats.loaded, elapsed,
+	      stats.loaded / elapsed, batch,
+	      benchStats_percentile( latencies, batchCount, 0.50 ) * 1000,
+	      benchStats_percentile( latencies, batchCount, 0.95 ) * 1000,
+	      benchStats_percentile( latencies, batchCount, 0.99 ) * 1000,
+	      latencies[ batchCount - 1 ] * 1000, tileCount,
+	      (unsigned long long) stats.stolen );
+    fflush( stdout );
+
+    // loaders may still be loading ancestors, don't wait for them
+    _exit( 0 );
+  }
+
+  waitpid( pid, &status, 0 );
+
+  return WIFEXITED( status ) && (WEXITSTATUS( status ) == 0);
+}
+
+/*
+ * Asks the kernel to drop the tile files' pages. Unlike writing to
+ * /proc/sys/vm/drop_caches, this needs no root, and leaves the rest of the
+ * page cache alone.
+ */
+static void dropPageCache( const char *tilePath )
+{
+  if( nftw( tilePath, dropFile, 64, FTW_PHYS ) != 0 )
+    perror( tilePath );
+}
+
+static int dropFile( const char *path, const struct stat *st, int type,
+		     struct FTW *ftw )
+{
+  int fd;
+
+  if( type != FTW_F )
+    return 0;
+
+  fd = open( path, O_RDONLY );
+  if( fd >= 0 )
+  {
+    posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
+    close( fd );
+  }
+
+  return 0;
+}
@@ -8,11 +8,47 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "tileTexture.h"
+#include "displayBackend.h"
+#include "eventTrace.h"
 #include "graphics.h"
+#include "statsPage.h"
+#include "viewTrace.h"
+#include "warmSet.h"
 
+// a TMS tile directory, or an archive made from one with tilePack
 #define TILE_PNG_ROOT "/home/pi/src/charts/data"
+// tile structs + compressed PNG data
+#define TILE_CACHE_BYTES (32 * 1024 * 1024)
+// LZ4 compressed decoded tiles, so tiles shown again need not be decoded
+#define TILE_LZ4_BYTES (16 * 1024 * 1024)
+// decoded tiles kept between runs, or NULL
+#define TILE_DISK_CACHE "/home/pi/.cache/piglet"
+// the last view and its tiles, loaded at start while EGL starts, or NULL
+#define WARM_SET_FILE "/home/pi/.cache/piglet/warmSet.bin"
+// the linked shaders, if the driver can save them, or NULL
+#define PROGRAM_CACHE_FILE "/home/pi/.cache/piglet/program.bin"
+// live statistics for pigletStats, see statsPage.h, or NULL
+#define STATS_PAGE STATS_PAGE_NAME
+// one core is left for rendering on a quad core Pi
+#define TILE_LOADER_THREADS 3
+// draw ancestors of tiles still loading instead of waiting for them
+#define PROGRESSIVE_RENDERING true
+// 16 bit frame buffer and tile textures: half the memory and bandwidth
+#define RGB565_RENDERING false
+// speculative loading; smaller for units short of memory, larger for
+// larger displays
+static const sPrefetchPolicy prefetchPolicy = {
+  .ringRadius = 1,
+  .levelsUp = 1,
+  .levelsDown = 1,
+  .trackSeconds = 120,
+  .maxTiles = 160,
+  .frameBudget = 8
+};
 
 typedef struct
 {
@@ -23,7 +59,15 @@ typedef struct
 /*
  * Local function prototypes 
  */
+static void usage( const char *program );
 static void lolaToTile( const LatLong latLong, TileCoordinate tileCoord );
+static void saveWarmSet( float zoomLevel, const TileCoordinate center );
+static double now( void );
+
+/*
+ * Global data
+ */
+static sWarmSet warmSet;
 
 /*
  * Start of code
@@ -34,21 +78,125 @@ int main( int argc, char **argv )
   sLatLong boatPosition = { 17.998, 59.03685 };
   sTileCoordinate tileCoordinate;
   float zoomLevel = 11.99;
+  double startTime = now();
+  bool warm = false, zoomGiven = false;
+  const char *displayName = NULL, *eventTraceFile = NULL;
+  FILE *traceFile = NULL;
+  unsigned int width = 0, height = 0;
+  int option;
+  Error error;
+
+  while( (option = getopt( argc, argv, "d:s:r:t:" )) != -1 )
+    switch( option )
+    {
+      case 'd':
+	displayName = optarg;
+	break;
+
+      case 's':
+	if( sscanf( optarg, "%ux%u", &width, &height ) != 2 )
+	  usage( argv[0] );
+	break;
+
+      case 'r':
+	// for traceBench
+	traceFile = fopen( optarg, "w" );
+	if( traceFile == NULL )
+	{
+	  perror( optarg );
+	  exit( 1 );
+	}
+	// nothing lost if piglet is killed
+	setvbuf( traceFile, NULL, _IOLBF, 0 );
+	fprintf( traceFile, "# seconds, center x, center y, zoom\n" );
+	break;
+
+      case 't':
+	// the latest events are written every 1000 frames
+	eventTraceFile = optarg;
+	eventTrace_enable( true );
+	break;
 
-  if( argc > 1 )
-    zoomLevel = atoi( argv[1] );
+      default:
+	usage( argv[0] );
+    }
+
+  if( optind < argc )
+  {
+    zoomLevel = atoi( argv[ optind ] );
+    zoomGiven = true;
+  }
+
+  error = graphics_setDisplay( displayName, width, height );
+  if( error != NULL )
+  {
+    ErrReport( error );
+    usage( argv[0] );
+  }
   // tileoordinates are: {x = 2362208165, y = 3025055848}
   // 
   lolaToTile( &boatPosition, &tileCoordinate );
 
+  // missing at the first start
+  if( WARM_SET_FILE != NULL )
+  {
+    error = warmSet_load( WARM_SET_FILE, &warmSet );
+    warm = error == NULL;
+    if( error != NULL )
+      ErrDispose( error, true );
+  }
+  if( STATS_PAGE != NULL )
+  {
+    error = statsPage_open( STATS_PAGE );
+    if( error != NULL )
+    {
+      ErrReport( error );
+      ErrDispose( error, true );
+    }
+  }
+
+  // carry on where the last session left off
+  if( warm && !zoomGiven )
+  {
+    zoomLevel = warmSet.zoom;
+    tileCoordinate.x = warmSet.centerX;
+    tileCoordinate.y = warmSet.centerY;
+  }
+
   printf( "Tile coordinates @ zoom level %d: %d, %d\n", (int) floor(zoomLevel),
 	  tileCoordinate.x >> (32- ((int) floor(zoomLevel)) ),
 	  tileCoordinate.y >> (32- ((int) floor(zoomLevel)) ));
 
-  // 1000 tile memory cache
-  tileTex_init( TILE_PNG_ROOT, 1000 );
+  tileTex_setRGB565( RGB565_RENDERING );
+  if( TILE_DISK_CACHE != NULL )
+  {
+    error = tileTex_setDiskCache( TILE_DISK_CACHE );
+
+    // piglet works without it, just slower to start
+    if( error != NULL )
+    {
+      ErrReport( error );
+      ErrDispose( error, true );
+    }
+  }
+  error = tileTex_init( TILE_PNG_ROOT, TILE_CACHE_BYTES, TILE_LOADER_THREADS );
+  if( error != NULL )
+  {
+    ErrReport( error );
+    exit( 1 );
+  }
+  // the loaders get going on the last view's tiles while EGL starts
+  if( warm )
+    tileTex_preload( warmSet.tiles, warmSet.tileCount );
   
+  graphics_setRGB565( RGB565_RENDERING );
+  graphics_setProgramCache( PROGRAM_CACHE_FILE );
   graphics_init();
+  graphics_setProgressive( PROGRESSIVE_RENDERING );
+  tileTex_setLz4Budget( TILE_LZ4_BYTES );
+  // the view doesn't follow the boat yet, so it is taken to be at rest and
+  // the track ahead is not prefetched; see tileTex_setMotion
+  tileTex_setPrefetchPolicy( &prefetchPolicy );
 
   // graphics_setMap( zoomLevel, &tileCoordinate );
 
@@ -57,11 +205,39 @@ int main( int argc, char **argv )
 #if 1  
   int zoomDir = 1;
   float zoomAmount = 0.001;
+  int frame = 0;
+  bool startReported = false;
   while(true )
   {
 #endif
+    double frameStart = now();
+
     graphics_setMap( zoomLevel, &tileCoordinate );
     graphics_redraw( zoomLevel, 0, 0, 0, 0 );
+    statsPage_publish( now() - frameStart );
+
+    if( traceFile != NULL )
+    {
+      sViewState view = { now() - startTime, tileCoordinate, zoomLevel };
+
+      viewTrace_write( traceFile, &view );
+    }
+
+    if( !startReported )
+    {
+      sGraphicsStats graphicsStats;
+
+      graphics_getStats( &graphicsStats );
+      if( graphicsStats.firstFullFrame != 0 )
+      {
+	printf( "first full frame after %.3f s (%s, shaders %s in %.1f ms)\n",
+		graphicsStats.firstFullFrame - startTime,
+		warm ? "warm" : "cold",
+		graphicsStats.programCached ? "loaded" : "compiled",
+		graphicsStats.programSeconds * 1000 );
+	startReported = true;
+      }
+    }
 #if 1
     if( zoomLevel >= 17 )
       zoomDir = -1;
@@ -71,6 +247,55 @@ int main( int argc, char **argv )
     zoomLevel *= (1.0 + zoomDir * zoomAmount);
 
     printf( "zoom level=%f\n", zoomLevel );
+
+    if( (++frame % 1000) == 0 )
+    {
+      sTileTexStats stats;
+      sGraphicsStats graphicsStats;
+
+      graphics_getStats( &graphicsStats );
+      printf( "graphics: %.2f draw calls/frame, %.2f buffer uploads/frame, "
+	      "%.2f skipped tiles/frame, %.2f ms CPU/frame\n",
+	      (double) graphicsStats.drawCalls / graphicsStats.frames,
+	      (double) graphicsStats.bufferUploads / graphicsStats.frames,
+	      (double) graphicsStats.tilesSkipped / graphicsStats.frames,
+	      graphicsStats.cpuSeconds * 1000 / graphicsStats.frames );
+
+      tileTex_getStats( &stats );
+      printf( "tile cache: %d tiles, %zu/%zu bytes, %llu hits, %llu misses, "
+	      "%llu evictions\n", stats.tileCount, stats.cacheBytes,
+	      stats.cacheBudget, (unsigned long long) stats.hits,
+	      (unsigned long long) stats.misses,
+	      (unsigned long long) stats.evictions );
+      printf( "prefetch: %llu tiles, %llu became visible (%.1f%%), %llu "
+	      "evicted unused\n", (unsigned long long) stats.prefetched,
+	      (unsigned long long) stats.prefetchHits,
+	      stats.prefetched ? 100.0 * stats.prefetchHits / stats.prefetched : 0.0,
+	      (unsigned long long) stats.prefetchWasted );
+      printf( "load queue: %d tiles, %llu cancelled\n", stats.queued,
+	      (unsigned long long) stats.cancelled );
+      printf( "decoding: %llu decodes, %llu uploads from LZ4, LZ4 tier "
+	      "%zu/%zu bytes, %llu dropped\n",
+	      (unsigned long long) stats.decodes,
+	      (unsigned long long) stats.lz4Hits, stats.lz4Bytes,
+	      stats.lz4Budget, (unsigned long long) stats.lz4Dropped );
+      printf( "disk cache: %llu hits, %llu writes\n",
+	      (unsigned long long) stats.diskHits,
+	      (unsigned long long) stats.diskWrites );
+
+      if( WARM_SET_FILE != NULL )
+	saveWarmSet( zoomLevel, &tileCoordinate );
+
+      if( eventTraceFile != NULL )
+      {
+	error = eventTrace_write( eventTraceFile );
+	if( error != NULL )
+	{
+	  ErrReport( error );
+	  ErrDispose( error, true );
+	}
+      }
+    }
     // sleep(1);
   }
 #endif
@@ -81,6 +306,20 @@ int main( int argc, char **argv )
   return 0;
 }
 
+static void usage( const char *program )
+{
+  int i;
+
+  fprintf( stderr, "usage: %s [-d display] [-s <width>x<height>] "
+	   "[-r <trace to record>] [-t <event trace>] [zoom level]\n"
+	   "  displays:", program );
+  for( i = 0; displayBackends[i] != NULL; i++ )
+    fprintf( stderr, " %s", displayBackends[i]->name );
+  fprintf( stderr, " (the first is the default)\n" );
+
+  exit( 1 );
+}
+
 /* 
    Spherical Mercator projection
 */
@@ -99,3 +338,30 @@ static void lolaToTile( const LatLong latLong, TileCoordinate tileCoord )
   
   tileCoord->y = round((mercatorRadians / M_PI + 1) * (pow32 / 2));
 }
+
+/* Saves the view and its tiles for the next start */
+static void saveWarmSet( float zoomLevel, const TileCoordinate center )
+{
+  Error error;
+
+  warmSet.zoom = zoomLevel;
+  warmSet.centerX = center->x;
+  warmSet.centerY = center->y;
+  warmSet.tileCount = tileTex_getWarmSet( warmSet.tiles, WARM_SET_MAX_TILES );
+
+  error = warmSet_save( WARM_SET_FILE, &warmSet );
+  if( error != NULL )
+  {
+    ErrReport( error );
+    ErrDispose( error, true );
+  }
+}
+
+static double now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
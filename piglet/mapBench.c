@@ -0,0 +1,242 @@
+/*
+ *  mapBench.c
+ *
+ * Compares tile lookups in the VoxiUtil HashTable, set up the way
+ * tileTexture.c used it, with the tileMap that replaced it.
+ *
+ * usage: mapBench [tiles per side] [threads]
+ *
+ * Inserts a block of tiles at every zoom level from 7 to 17 around the
+ * position used by the piglet demo, then times lookups of existing and
+ * missing tiles, single threaded and from several threads at once (the
+ * HashTable behind a mutex, as tileTexture.c would need).
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <voxi/util/hash.h>
+#include <voxi/util/threading.h>
+
+#include "tileMap.h"
+
+#define MIN_ZOOM 7
+#define MAX_ZOOM 17
+#define LOOKUP_ROUNDS 20
+
+typedef struct
+{
+  int z;
+  uint32_t x, y;
+} sBenchTile, *BenchTile;
+
+/*
+ * Local function prototypes
+ */
+static int tileHash( BenchTile t );
+static int tileCompare( BenchTile t1, BenchTile t2 );
+static void *hashThread( void *arg );
+static void *mapThread( void *arg );
+static double timeThreads( void *(*func)( void * ), int threadCount );
+static double now( void );
+
+/*
+ * static data
+ */
+static BenchTile tiles;
+static int tileCount;
+static HashTable hashTable;
+static sVoxiMutex hashMutex;
+static TileMap tileMap;
+
+/*
+ * Start of code
+ */
+int main( int argc, char **argv )
+{
+  int side = 24, threadCount = 4, z, i, j, round;
+  uint32_t centerX = 2252, centerY = 2889;  // at zoom 12
+  volatile void *sink;
+  double start, hashInsert, mapInsert, hashHit, mapHit, hashMiss, mapMiss;
+  sBenchTile missing;
+
+  if( argc > 1 )
+    side = atoi( argv[1] );
+  if( argc > 2 )
+    threadCount = atoi( argv[2] );
+
+  threading_init();
+  threading_mutex_init( &hashMutex );
+
+  tiles = malloc( (MAX_ZOOM - MIN_ZOOM + 1) * side * side * sizeof( sBenchTile ) );
+  assert( tiles != NULL );
+
+  for( z = MIN_ZOOM; z <= MAX_ZOOM; z++ )
+  {
+    uint32_t x0, y0;
+
+    if( z <= 12 )
+    {
+      x0 = centerX >> (12 - z);
+      y0 = centerY >> (12 - z);
+    }
+    else
+    {
+      x0 = centerX << (z - 12);
+      y0 = centerY << (z - 12);
+    }
+
+    for( j = 0; j < side; j++ )
+      for( i = 0; i < side; i++ )
+      {
+	tiles[ tileCount ].z = z;
+	tiles[ tileCount ].x = x0 - side / 2 + i;
+	tiles[ tileCount ].y = y0 - side / 2 + j;
+	tileCount++;
+      }
+  }
+
+  hashTable = HashCreateTable( 129, (HashFuncPtr) tileHash,
+			       (CompFuncPtr) tileCompare, NULL );
+  tileMap = tileMap_create( 4096 );
+
+  start = now();
+  for( i = 0; i < tileCount; i++ )
+    HashAdd( hashTable, &(tiles[i]) );
+  hashInsert = now() - start;
+
+  start = now();
+  for( i = 0; i < tileCount; i++ )
+    tileMap_insert( tileMap, tileKey_make( tiles[i].z, tiles[i].x, tiles[i].y ),
+		    &(tiles[i]) );
+  mapInsert = now() - start;
+
+  start = now();
+  for( round = 0; round < LOOKUP_ROUNDS; round++ )
+    for( i = 0; i < tileCount; i++ )
+      sink = HashFind( hashTable, &(tiles[i]) );
+  hashHit = now() - start;
+
+  start = now();
+  for( round = 0; round < LOOKUP_ROUNDS; round++ )
+    for( i = 0; i < tileCount; i++ )
+      sink = tileMap_find( tileMap, tileKey_make( tiles[i].z, tiles[i].x,
+						  tiles[i].y ), NULL );
+  mapHit = now() - start;
+
+  // one zoom level below the deepest one inserted
+  start = now();
+  for( round = 0; round < LOOKUP_ROUNDS; round++ )
+    for( i = 0; i < tileCount; i++ )
+    {
+      missing.z = MAX_ZOOM + 1;
+      missing.x = tiles[i].x;
+      missing.y = tiles[i].y;
+      sink = HashFind( hashTable, &missing );
+    }
+  hashMiss = now() - start;
+
+  start = now();
+  for( round = 0; round < LOOKUP_ROUNDS; round++ )
+    for( i = 0; i < tileCount; i++ )
+      sink = tileMap_find( tileMap, tileKey_make( MAX_ZOOM + 1, tiles[i].x,
+						  tiles[i].y ), NULL );
+  mapMiss = now() - start;
+  (void) sink;
+
+  printf( "%d tiles\n", tileCount );
+  printf( "%-10s %12s %12s %12s\n", "", "insert ns", "hit ns", "miss ns" );
+  printf( "%-10s %12.1f %12.1f %12.1f\n", "HashTable",
+	  hashInsert * 1e9 / tileCount,
+	  hashHit * 1e9 / (LOOKUP_ROUNDS * tileCount),
+	  hashMiss * 1e9 / (LOOKUP_ROUNDS * tileCount) );
+  printf( "%-10s %12.1f %12.1f %12.1f\n", "tileMap",
+	  mapInsert * 1e9 / tileCount,
+	  mapHit * 1e9 / (LOOKUP_ROUNDS * tileCount),
+	  mapMiss * 1e9 / (LOOKUP_ROUNDS * tileCount) );
+
+  printf( "%d threads, hits: HashTable+mutex %.1f ns, tileMap %.1f ns\n",
+	  threadCount,
+	  timeThreads( hashThread, threadCount ) * 1e9 /
+	  (LOOKUP_ROUNDS * tileCount * threadCount),
+	  timeThreads( mapThread, threadCount ) * 1e9 /
+	  (LOOKUP_ROUNDS * tileCount * threadCount) );
+
+  return 0;
+}
+
+/* the hash function tileTexture.c used */
+static int tileHash( BenchTile t )
+{
+  return t->z ^ (t->x << 1) ^ (t->y << 2);
+}
+
+static int tileCompare( BenchTile t1, BenchTile t2 )
+{
+  if( t1->z != t2->z )
+    return t2->z - t1->z;
+
+  if( t1->x != t2->x )
+    return t2->x - t1->x;
+
+  return t2->y - t1->y;
+}
+
+static void *hashThread( void *arg )
+{
+  int round, i;
+
+  for( round = 0; round < LOOKUP_ROUNDS; round++ )
+    for( i = 0; i < tileCount; i++ )
+    {
+      threading_mutex_lock( &hashMutex );
+      HashFind( hashTable, &(tiles[i]) );
+      threading_mutex_unlock( &hashMutex );
+    }
+
+  return NULL;
+}
+
+static void *mapThread( void *arg )
+{
+  int round, i;
+
+  for( round = 0; round < LOOKUP_ROUNDS; round++ )
+    for( i = 0; i < tileCount; i++ )
+      tileMap_find( tileMap, tileKey_make( tiles[i].z, tiles[i].x, tiles[i].y ),
+		    NULL );
+
+  return NULL;
+}
+
+static double timeThreads( void *(*func)( void * ), int threadCount )
+{
+  pthread_t threads[ threadCount ];
+  double start;
+  int i, err;
+
+  start = now();
+
+  for( i = 0; i < threadCount; i++ )
+  {
+    err = pthread_create( &(threads[i]), NULL, func, NULL );
+    assert( err == 0 );
+  }
+
+  for( i = 0; i < threadCount; i++ )
+    pthread_join( threads[i], NULL );
+
+  return now() - start;
+}
+
+static double now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,279 @@
+/*
+ *  pigletStats.c
+ *
+ * Shows the live statistics a running piglet publishes (see statsPage.h),
+ * without disturbing it.
+ *
+ * usage: pigletStats [-i <seconds>] [-j] [page name]
+ *   -i <seconds>  print again every so many seconds, with rates since the
+ *                 last print, until interrupted
+ *   -j            print JSON objects, one per line, e.g. for the node server
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "statsPage.h"
+
+/*
+ * Local function prototypes
+ */
+static void usage( const char *program );
+static void readPage( const sStatsPage *page, StatsPage stats );
+static void printText( const sStatsPage *stats, const sStatsPage *last,
+		       double seconds );
+static void printJSON( const sStatsPage *stats, const sStatsPage *last,
+		       double seconds );
+static void printHistogram( const char *name, const uint64_t *counts,
+			    const uint64_t *lastCounts, int bucketCount,
+			    bool json );
+static double histogramPercentile( const uint64_t *counts,
+				   const uint64_t *lastCounts, int bucketCount,
+				   double p );
+static double rate( uint64_t count, uint64_t lastCount, double seconds );
+static uint64_t nowMicros( void );
+
+/*
+ * Start of code
+ */
+int main( int argc, char **argv )
+{
+  const char *name = STATS_PAGE_NAME;
+  double interval = 0;
+  bool json = false;
+  sStatsPage stats, last = { 0 };
+  const sStatsPage *page;
+  int fd, option;
+
+  while( (option = getopt( argc, argv, "i:j" )) != -1 )
+    switch( option )
+    {
+      case 'i':
+	interval = atof( optarg );
+	break;
+
+      case 'j':
+	json = true;
+	break;
+
+      default:
+	usage( argv[0] );
+    }
+
+  if( argc - optind > 1 )
+    usage( argv[0] );
+  if( optind < argc )
+    name = argv[ optind ];
+
+  fd = shm_open( name, O_RDONLY, 0 );
+  if( fd < 0 )
+  {
+    perror( name );
+    fprintf( stderr, "Is piglet running?\n" );
+    return 1;
+  }
+
+  page = mmap( NULL, sizeof( sStatsPage ), PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( page == MAP_FAILED )
+  {
+    perror( name );
+    return 1;
+  }
+
+  do
+  {
+    readPage( page, &stats );
+    if( (stats.magic != STATS_PAGE_MAGIC) ||
+	(stats.version != STATS_PAGE_VERSION) )
+    {
+      fprintf( stderr, "%s: not a version %d stats page, or piglet has not "
+	       "drawn a frame yet\n", name, STATS_PAGE_VERSION );
+      return 1;
+    }
+
+    if( json )
+      printJSON( &stats, &last,
+		 (last.updated != 0) ? (stats.updated - last.updated) * 1e-6 : 0 );
+    else
+      printText( &stats, &last,
+		 (last.updated != 0) ? (stats.updated - last.updated) * 1e-6 : 0 );
+    fflush( stdout );
+
+    last = stats;
+    if( interval > 0 )
+      usleep( interval * 1000000 );
+  } while( interval > 0 );
+
+  return 0;
+}
+
+static void usage( const char *program )
+{
+  fprintf( stderr, "usage: %s [-i <seconds>] [-j] [page name, default %s]\n",
+	   program, STATS_PAGE_NAME );
+  exit( 1 );
+}
+
+/* A word at a time, as piglet writes it */
+static void readPage( const sStatsPage *page, StatsPage stats )
+{
+  const uint64_t *from = (const uint64_t *) page;
+  uint64_t *to = (uint64_t *) stats;
+  int i;
+
+  for( i = 0; i < sizeof( sStatsPage ) / sizeof( uint64_t ); i++ )
+    to[i] = __atomic_load_n( &(from[i]), __ATOMIC_RELAXED );
+}
+
+/* Rates and percentiles are since the last print, or since piglet started */
+static void printText( const sStatsPage *stats, const sStatsPage *last,
+		       double seconds )
+{
+  printf( "piglet %" PRIu64 ", updated %.1f s ago\n", stats->pid,
+	  (nowMicros() - stats->updated) * 1e-6 );
+  printf( "frames: %" PRIu64 ", last %.2f ms, %.2f draw calls/frame, "
+	  "%.2f skipped tiles/frame", stats->frames, stats->frameMicros * 1e-3,
+	  (stats->frames > 0) ? (double) stats->drawCalls / stats->frames : 0.0,
+	  (stats->frames > 0) ? (double) stats->tilesSkipped / stats->frames :
+	  0.0 );
+  if( seconds > 0 )
+    printf( ", %.1f frames/s", rate( stats->frames, last->frames, seconds ) );
+  printf( "\n" );
+  printHistogram( "frame ms", stats->frameTimes, last->frameTimes,
+		  STATS_FRAME_BUCKETS, false );
+  printf( "tile cache: %" PRIu64 " tiles, %" PRIu64 "/%" PRIu64 " bytes, "
+	  "%" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions\n",
+	  stats->tileCount, stats->cacheBytes, stats->cacheBudget, stats->hits,
+	  stats->misses, stats->evictions );
+  printf( "load queue: %" PRIu64 " tiles, %" PRIu64 " visible, %" PRIu64
+	  " cancelled\n", stats->queued, stats->visibleQueued,
+	  stats->cancelled );
+  printf( "loading: %" PRIu64 " loaded, %" PRIu64 " stolen, %" PRIu64
+	  " decodes, %" PRIu64 " from LZ4, %" PRIu64 " from disk",
+	  stats->loaded, stats->stolen, stats->decodes, stats->lz4Hits,
+	  stats->diskHits );
+  if( seconds > 0 )
+    printf( ", %.1f loads/s, %.1f decodes/s",
+	    rate( stats->loaded, last->loaded, seconds ),
+	    rate( stats->decodes, last->decodes, seconds ) );
+  printf( "\n" );
+  printHistogram( "load ms", stats->loadTimes, last->loadTimes,
+		  STATS_LOAD_BUCKETS, false );
+  printf( "prefetch: %" PRIu64 " tiles, %" PRIu64 " became visible, %" PRIu64
+	  " evicted unused\n", stats->prefetched, stats->prefetchHits,
+	  stats->prefetchWasted );
+  printf( "LZ4 tier: %" PRIu64 "/%" PRIu64 " bytes, %" PRIu64 " dropped; "
+	  "disk cache: %" PRIu64 " writes\n\n", stats->lz4Bytes,
+	  stats->lz4Budget, stats->lz4Dropped, stats->diskWrites );
+}
+
+static void printJSON( const sStatsPage *stats, const sStatsPage *last,
+		       double seconds )
+{
+  printf( "{\"pid\": %" PRIu64 ", \"ageSeconds\": %.3f, \"frames\": %" PRIu64
+	  ", \"frameMs\": %.3f, \"drawCalls\": %" PRIu64 ", \"tilesSkipped\": %"
+	  PRIu64 ", ", stats->pid, (nowMicros() - stats->updated) * 1e-6,
+	  stats->frames, stats->frameMicros * 1e-3, stats->drawCalls,
+	  stats->tilesSkipped );
+  printHistogram( "frameMsHistogram", stats->frameTimes, last->frameTimes,
+		  STATS_FRAME_BUCKETS, true );
+  printf( "\"tileCount\": %" PRIu64 ", \"cacheBytes\": %" PRIu64
+	  ", \"cacheBudget\": %" PRIu64 ", \"hits\": %" PRIu64 ", \"misses\": %"
+	  PRIu64 ", \"evictions\": %" PRIu64 ", ", stats->tileCount,
+	  stats->cacheBytes, stats->cacheBudget, stats->hits, stats->misses,
+	  stats->evictions );
+  printf( "\"queued\": %" PRIu64 ", \"visibleQueued\": %" PRIu64
+	  ", \"cancelled\": %" PRIu64 ", \"loaded\": %" PRIu64 ", \"stolen\": %"
+	  PRIu64 ", \"decodes\": %" PRIu64 ", \"lz4Hits\": %" PRIu64
+	  ", \"diskHits\": %" PRIu64 ", \"diskWrites\": %" PRIu64 ", ",
+	  stats->queued, stats->visibleQueued, stats->cancelled, stats->loaded,
+	  stats->stolen, stats->decodes, stats->lz4Hits, stats->diskHits,
+	  stats->diskWrites );
+  printHistogram( "loadMsHistogram", stats->loadTimes, last->loadTimes,
+		  STATS_LOAD_BUCKETS, true );
+  printf( "\"prefetched\": %" PRIu64 ", \"prefetchHits\": %" PRIu64
+	  ", \"prefetchWasted\": %" PRIu64 ", \"lz4Bytes\": %" PRIu64
+	  ", \"lz4Budget\": %" PRIu64 ", \"lz4Dropped\": %" PRIu64,
+	  stats->prefetched, stats->prefetchHits, stats->prefetchWasted,
+	  stats->lz4Bytes, stats->lz4Budget, stats->lz4Dropped );
+  if( seconds > 0 )
+    printf( ", \"framesPerSecond\": %.2f, \"loadsPerSecond\": %.2f, "
+	    "\"decodesPerSecond\": %.2f",
+	    rate( stats->frames, last->frames, seconds ),
+	    rate( stats->loaded, last->loaded, seconds ),
+	    rate( stats->decodes, last->decodes, seconds ) );
+  printf( "}\n" );
+}
+
+/*
+ * The counts since the last print per bucket, and upper bounds of the
+ * median and 99th percentile
+ */
+static void printHistogram( const char *name, const uint64_t *counts,
+			    const uint64_t *lastCounts, int bucketCount,
+			    bool json )
+{
+  int i;
+
+  if( json )
+  {
+    printf( "\"%s\": [", name );
+    for( i = 0; i < bucketCount; i++ )
+      printf( "%s%" PRIu64, (i > 0) ? ", " : "", counts[i] - lastCounts[i] );
+    printf( "], " );
+    return;
+  }
+
+  printf( "  %s: p50 < %g, p99 < %g; <1:%" PRIu64, name,
+	  histogramPercentile( counts, lastCounts, bucketCount, 0.50 ),
+	  histogramPercentile( counts, lastCounts, bucketCount, 0.99 ),
+	  counts[0] - lastCounts[0] );
+  for( i = 1; i < bucketCount - 1; i++ )
+    printf( " <%d:%" PRIu64, 1 << i, counts[i] - lastCounts[i] );
+  printf( " more:%" PRIu64 "\n", counts[ bucketCount - 1 ] -
+	  lastCounts[ bucketCount - 1 ] );
+}
+
+/* The upper bound of the bucket holding the percentile, infinity for the last */
+static double histogramPercentile( const uint64_t *counts,
+				   const uint64_t *lastCounts, int bucketCount,
+				   double p )
+{
+  uint64_t total = 0, sum = 0;
+  int i;
+
+  for( i = 0; i < bucketCount; i++ )
+    total += counts[i] - lastCounts[i];
+  if( total == 0 )
+    return 0;
+
+  for( i = 0; i < bucketCount - 1; i++ )
+  {
+    sum += counts[i] - lastCounts[i];
+    if( sum >= p * total )
+      return 1 << i;
+  }
+
+  return 1.0 / 0.0;
+}
+
+static double rate( uint64_t count, uint64_t lastCount, double seconds )
+{
+  return (count - lastCount) / seconds;
+}
+
+static uint64_t nowMicros( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec * (uint64_t) 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,102 @@
+/*
+   pixelPool.c
+
+   Released buffers are kept on a free list (linked through the buffers
+   themselves) instead of being returned to malloc. Buffers allocated beyond
+   maxBuffers, for visible tiles that must be decoded anyway, are freed when
+   released.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <voxi/util/threading.h>
+
+#include "pixelPool.h"
+
+typedef struct sFreeBuffer
+{
+  struct sFreeBuffer *next;
+} sFreeBuffer, *FreeBuffer;
+
+/*
+ * Global data
+ */
+static size_t bufferSize;
+static int maxBuffers;
+static int allocatedCount;  // buffers in use or on the free list
+static FreeBuffer freeList;
+static sVoxiMutex poolMutex;
+
+Error pixelPool_init( size_t bufferSizeParam, int maxBuffersParam )
+{
+  Error error;
+
+  assert( bufferSizeParam >= sizeof( sFreeBuffer ) );
+
+  bufferSize = bufferSizeParam;
+  maxBuffers = maxBuffersParam;
+  allocatedCount = 0;
+  freeList = NULL;
+
+  ERR_GOTO( threading_mutex_init( &poolMutex ), FAIL );
+  threading_mutex_setDebug( &poolMutex, false );
+
+  return NULL;
+
+ FAIL:
+  return error;
+}
+
+size_t pixelPool_bufferSize( void )
+{
+  return bufferSize;
+}
+
+GLubyte *pixelPool_get( bool mayGrow )
+{
+  GLubyte *buffer;
+
+  threading_mutex_lock( &poolMutex );
+
+  if( freeList != NULL )
+  {
+    buffer = (GLubyte *) freeList;
+    freeList = freeList->next;
+  }
+  else if( mayGrow || (allocatedCount < maxBuffers) )
+  {
+    buffer = malloc( bufferSize );
+    assert( buffer != NULL );
+    allocatedCount++;
+  }
+  else
+    buffer = NULL;
+
+  threading_mutex_unlock( &poolMutex );
+
+  return buffer;
+}
+
+void pixelPool_release( GLubyte *buffer )
+{
+  if( buffer == NULL )
+    return;
+
+  threading_mutex_lock( &poolMutex );
+
+  if( allocatedCount > maxBuffers )
+  {
+    free( buffer );
+    allocatedCount--;
+  }
+  else
+  {
+    FreeBuffer freeBuffer = (FreeBuffer) buffer;
+
+    freeBuffer->next = freeList;
+    freeList = freeBuffer;
+  }
+
+  threading_mutex_unlock( &poolMutex );
+}
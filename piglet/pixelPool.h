@@ -0,0 +1,25 @@
+/*
+   pixelPool.h
+
+   Pool of equally sized buffers for decoded tile images, shared between the
+   loader threads (which decode into them) and the render thread (which
+   uploads and releases them).
+*/
+
+#ifndef PIXEL_POOL_H
+#define PIXEL_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "GLES2/gl2.h"
+
+#include <voxi/util/err.h>
+
+Error pixelPool_init( size_t bufferSizeParam, int maxBuffersParam );
+size_t pixelPool_bufferSize( void );
+/* Returns NULL if maxBuffers buffers are in use, unless mayGrow is set */
+GLubyte *pixelPool_get( bool mayGrow );
+void pixelPool_release( GLubyte *buffer );
+
+#endif
@@ -0,0 +1,118 @@
+/*
+   slab.c
+
+   Free objects are linked through their own first bytes. The most recently
+   freed object is handed out first, since it is most likely still in the
+   cache. Slabs are never returned to malloc before slab_destroy; the number
+   of tiles only grows until the cache budget is reached.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "slab.h"
+
+typedef struct sFreeObject
+{
+  struct sFreeObject *next;
+} sFreeObject, *FreeObject;
+
+typedef struct sSlab
+{
+  size_t objectSize;  // padded
+  size_t align;
+  int objectsPerSlab;
+
+  FreeObject freeList;
+
+  void **slabs;
+  int slabCount, slabCapacity;
+} sSlab;
+
+/*
+ * static functions
+ */
+static void slabGrow( Slab slab );
+
+Slab slab_create( size_t objectSize, size_t align, int objectsPerSlab )
+{
+  Slab slab;
+
+  assert( (align & (align - 1)) == 0 );
+  assert( objectsPerSlab > 0 );
+
+  if( align < sizeof( void * ) )
+    align = sizeof( void * );
+  if( objectSize < sizeof( sFreeObject ) )
+    objectSize = sizeof( sFreeObject );
+
+  slab = calloc( 1, sizeof( sSlab ) );
+  assert( slab != NULL );
+
+  slab->objectSize = (objectSize + align - 1) & ~(align - 1);
+  slab->align = align;
+  slab->objectsPerSlab = objectsPerSlab;
+
+  return slab;
+}
+
+void slab_destroy( Slab slab )
+{
+  int i;
+
+  for( i = 0; i < slab->slabCount; i++ )
+    free( slab->slabs[i] );
+  free( slab->slabs );
+  free( slab );
+}
+
+void *slab_alloc( Slab slab )
+{
+  FreeObject object;
+
+  if( slab->freeList == NULL )
+    slabGrow( slab );
+
+  object = slab->freeList;
+  slab->freeList = object->next;
+
+  return object;
+}
+
+void slab_free( Slab slab, void *object )
+{
+  FreeObject freeObject = object;
+
+  if( object == NULL )
+    return;
+
+  freeObject->next = slab->freeList;
+  slab->freeList = freeObject;
+}
+
+size_t slab_bytes( Slab slab )
+{
+  return (size_t) slab->slabCount * slab->objectsPerSlab * slab->objectSize;
+}
+
+static void slabGrow( Slab slab )
+{
+  unsigned char *memory;
+  int i, err;
+
+  if( slab->slabCount == slab->slabCapacity )
+  {
+    slab->slabCapacity = (slab->slabCapacity == 0) ? 16 : slab->slabCapacity * 2;
+    slab->slabs = realloc( slab->slabs, slab->slabCapacity * sizeof( void * ) );
+    assert( slab->slabs != NULL );
+  }
+
+  err = posix_memalign( (void **) &memory, slab->align,
+			slab->objectSize * slab->objectsPerSlab );
+  assert( err == 0 );
+  slab->slabs[ slab->slabCount++ ] = memory;
+
+  // push in reverse, so objects are handed out in address order
+  for( i = slab->objectsPerSlab - 1; i >= 0; i-- )
+    slab_free( slab, memory + i * slab->objectSize );
+}
@@ -0,0 +1,26 @@
+/*
+   slab.h
+
+   Allocator for many objects of one size, e.g. tile records. Objects are
+   carved out of large, aligned slabs and recycled through a free list, so
+   allocating and freeing them for days does not fragment the heap.
+
+   A slab is not thread safe; the caller must serialize calls.
+*/
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+typedef struct sSlab *Slab;
+
+/* align must be a power of two, objects are padded to a multiple of it */
+Slab slab_create( size_t objectSize, size_t align, int objectsPerSlab );
+void slab_destroy( Slab slab );
+void *slab_alloc( Slab slab );
+void slab_free( Slab slab, void *object );
+/* Bytes taken from malloc, including objects on the free list */
+size_t slab_bytes( Slab slab );
+
+#endif
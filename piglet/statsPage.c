@@ -0,0 +1,119 @@
+/*
+   statsPage.c
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "graphics.h"
+#include "statsPage.h"
+#include "tileTexture.h"
+
+/*
+ * Global data
+ */
+static StatsPage page;
+static uint64_t frameTimes[ STATS_FRAME_BUCKETS ];
+
+Error statsPage_open( const char *name )
+{
+  int fd;
+
+  assert( TILE_TEX_LOAD_BUCKETS == STATS_LOAD_BUCKETS );
+
+  fd = shm_open( name, O_RDWR | O_CREAT, 0644 );
+  if( fd < 0 )
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not open stats page '%s'",
+		   name );
+
+  if( ftruncate( fd, sizeof( sStatsPage ) ) != 0 )
+  {
+    close( fd );
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not size stats page '%s'",
+		   name );
+  }
+
+  page = mmap( NULL, sizeof( sStatsPage ), PROT_READ | PROT_WRITE, MAP_SHARED,
+	       fd, 0 );
+  close( fd );
+  if( page == MAP_FAILED )
+  {
+    page = NULL;
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not map stats page '%s'",
+		   name );
+  }
+
+  // readers tell a page of another layout, or still being set up, by these
+  __atomic_store_n( &(page->magic), 0, __ATOMIC_RELAXED );
+  __atomic_store_n( &(page->version), STATS_PAGE_VERSION, __ATOMIC_RELAXED );
+  __atomic_store_n( &(page->pid), getpid(), __ATOMIC_RELAXED );
+
+  return NULL;
+}
+
+void statsPage_publish( double frameSeconds )
+{
+  sTileTexStats tileStats;
+  sGraphicsStats graphicsStats;
+  sStatsPage stats;
+  struct timespec ts;
+  uint64_t millis = frameSeconds * 1000, *from, *to;
+  int bucket, i;
+
+  if( page == NULL )
+    return;
+
+  // bucket i > 0 holds frames of 2^(i-1) to 2^i ms
+  for( bucket = 0; (millis > 0) && (bucket < STATS_FRAME_BUCKETS - 1);
+       bucket++ )
+    millis >>= 1;
+  frameTimes[ bucket ]++;
+
+  tileTex_getStats( &tileStats );
+  graphics_getStats( &graphicsStats );
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  stats.magic = STATS_PAGE_MAGIC;
+  stats.version = STATS_PAGE_VERSION;
+  stats.pid = getpid();
+  stats.updated = ts.tv_sec * (uint64_t) 1000000 + ts.tv_nsec / 1000;
+
+  stats.frames = graphicsStats.frames;
+  stats.drawCalls = graphicsStats.drawCalls;
+  stats.tilesSkipped = graphicsStats.tilesSkipped;
+  stats.frameMicros = frameSeconds * 1000000;
+  memcpy( stats.frameTimes, frameTimes, sizeof( frameTimes ) );
+
+  stats.tileCount = tileStats.tileCount;
+  stats.cacheBytes = tileStats.cacheBytes;
+  stats.cacheBudget = tileStats.cacheBudget;
+  stats.queued = tileStats.queued;
+  stats.visibleQueued = tileStats.visibleQueued;
+  stats.hits = tileStats.hits;
+  stats.misses = tileStats.misses;
+  stats.evictions = tileStats.evictions;
+  stats.loaded = tileStats.loaded;
+  stats.stolen = tileStats.stolen;
+  stats.cancelled = tileStats.cancelled;
+  stats.prefetched = tileStats.prefetched;
+  stats.prefetchHits = tileStats.prefetchHits;
+  stats.prefetchWasted = tileStats.prefetchWasted;
+  stats.decodes = tileStats.decodes;
+  stats.lz4Hits = tileStats.lz4Hits;
+  stats.lz4Dropped = tileStats.lz4Dropped;
+  stats.lz4Bytes = tileStats.lz4Bytes;
+  stats.lz4Budget = tileStats.lz4Budget;
+  stats.diskHits = tileStats.diskHits;
+  stats.diskWrites = tileStats.diskWrites;
+  memcpy( stats.loadTimes, tileStats.loadTimes, sizeof( stats.loadTimes ) );
+
+  from = (uint64_t *) &stats;
+  to = (uint64_t *) page;
+  for( i = 0; i < sizeof( sStatsPage ) / sizeof( uint64_t ); i++ )
+    __atomic_store_n( &(to[i]), from[i], __ATOMIC_RELAXED );
+}
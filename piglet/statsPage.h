@@ -0,0 +1,76 @@
+/*
+   statsPage.h
+
+   Live statistics of the tile cache and the renderer in a shared memory
+   page (/dev/shm/piglet-stats on Linux), so that pigletStats or the node
+   server can watch a headless piglet without attaching a debugger.
+
+   piglet updates the page once per frame with relaxed atomic stores, and
+   never waits for readers. Readers load it the same way, so each counter
+   is read whole, but counters may be from consecutive frames. Rates are
+   left to readers, from the difference between two reads.
+*/
+
+#ifndef STATS_PAGE_H
+#define STATS_PAGE_H
+
+#include <stdint.h>
+
+#include <voxi/util/err.h>
+
+#define STATS_PAGE_NAME "/piglet-stats"
+#define STATS_PAGE_MAGIC 0x53474c50  /* "PLGS" */
+#define STATS_PAGE_VERSION 1
+/* frame time histogram buckets: under 1 ms, 1-2 ms, 2-4 ms... and the rest */
+#define STATS_FRAME_BUCKETS 12
+/* as TILE_TEX_LOAD_BUCKETS */
+#define STATS_LOAD_BUCKETS 12
+
+/* 64 bit words, so the page is read and written a word at a time. magic and
+   version share the first. */
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t pid;
+  uint64_t updated;  // CLOCK_MONOTONIC microseconds
+
+  // renderer
+  uint64_t frames;
+  uint64_t drawCalls;
+  uint64_t tilesSkipped;  // summed over frames
+  uint64_t frameMicros;   // the last frame, from setMap to the end of redraw
+  uint64_t frameTimes[ STATS_FRAME_BUCKETS ];
+
+  // tile cache, see sTileTexStats
+  uint64_t tileCount;
+  uint64_t cacheBytes;
+  uint64_t cacheBudget;
+  uint64_t queued;
+  uint64_t visibleQueued;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t loaded;
+  uint64_t stolen;
+  uint64_t cancelled;
+  uint64_t prefetched;
+  uint64_t prefetchHits;
+  uint64_t prefetchWasted;
+  uint64_t decodes;
+  uint64_t lz4Hits;
+  uint64_t lz4Dropped;
+  uint64_t lz4Bytes;
+  uint64_t lz4Budget;
+  uint64_t diskHits;
+  uint64_t diskWrites;
+  uint64_t loadTimes[ STATS_LOAD_BUCKETS ];
+} sStatsPage, *StatsPage;
+
+/* Creates the page, or takes over one left by an earlier run */
+Error statsPage_open( const char *name );
+/* Publishes the counters after a frame that took frameSeconds. Render
+   thread only; does nothing if the page is not open. */
+void statsPage_publish( double frameSeconds );
+
+#endif
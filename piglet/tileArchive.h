@@ -0,0 +1,50 @@
+/*
+   tileArchive.h
+
+   Format of a packed tile archive, as written by tilePack and read by
+   tileSource. All numbers are little endian.
+
+     header       sTileArchiveHeader
+     index        indexCount sTileArchiveEntry, sorted on (z, x, y)
+     tile data    each tile starts on a TILE_ARCHIVE_ALIGN boundary, so that
+                  it can be mapped and madvised on its own
+*/
+
+#ifndef TILE_ARCHIVE_H
+#define TILE_ARCHIVE_H
+
+#include <stdint.h>
+
+#define TILE_ARCHIVE_MAGIC "PIGLTILE"
+#define TILE_ARCHIVE_VERSION 1
+#define TILE_ARCHIVE_ALIGN 4096
+
+typedef struct
+{
+  char magic[8];  // TILE_ARCHIVE_MAGIC, not null terminated
+  uint32_t version;
+  uint32_t entryCount;
+  uint64_t indexOffset;
+} sTileArchiveHeader;
+
+typedef struct
+{
+  uint32_t z, x, y;
+  uint32_t size;
+  uint64_t offset;  // from the start of the archive
+} sTileArchiveEntry, *TileArchiveEntry;
+
+/* qsort/bsearch order of the index */
+static inline int tileArchive_compare( const sTileArchiveEntry *e1,
+				       const sTileArchiveEntry *e2 )
+{
+  if( e1->z != e2->z )
+    return e1->z < e2->z ? -1 : 1;
+  if( e1->x != e2->x )
+    return e1->x < e2->x ? -1 : 1;
+  if( e1->y != e2->y )
+    return e1->y < e2->y ? -1 : 1;
+  return 0;
+}
+
+#endif
@@ -0,0 +1,294 @@
+/*
+   tileAtlas.c
+
+   Pages are square RGB (or RGB565) textures of up to ATLAS_MAX_SIZE
+   pixels, split in a grid of tile sized slots. Slot numbers are
+   page * slotsPerPage + index.
+
+   ETC1 textures can't be updated in part (OES_compressed_ETC1_RGB8_texture
+   has no glCompressedTexSubImage2D), so each compressed slot is a texture of
+   its own, and its tile a draw call of its own. Compressed slots are
+   numbered after the RGB slots.
+
+   Tiles are not padded, so with linear filtering the edge texels of a tile
+   would be blended with its neighbour in the atlas. Instead, tileAtlas_mapUV
+   maps the tile onto the centers of its edge texels, which scales it by
+   255/256.
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "etc1.h"
+#include "tileAtlas.h"
+
+#define ATLAS_MAX_SIZE 2048
+
+typedef struct
+{
+  int *owner;       // NULL if the slot is free
+  uint32_t lastUsed;  // frame in which the slot was last drawn
+} sAtlasSlot, *AtlasSlot;
+
+typedef struct
+{
+  GLuint textureID;
+  int freeCount;
+} sAtlasPage, *AtlasPage;
+
+/*
+ * static functions
+ */
+static void atlasCreate( void );
+static void pageCreate( AtlasPage page );
+static GLuint textureCreate( void );
+static int evictSlot( int *owner, int first, int last );
+static bool isCompressed( int slot );
+
+/*
+ * Global data
+ */
+static int maxPages;
+static int pageSize;      // pixels
+static int slotsPerRow;
+static int slotsPerPage;
+static int pageCount;     // created so far
+static int rgbSlotCount;  // maxPages * slotsPerPage
+static GLenum pixelType;  // of the pages
+
+static int maxCompressed;
+static int compressedFree;
+static bool hasETC1;
+
+static AtlasPage pages;
+static AtlasSlot slots;   // RGB slots, then compressed slots
+static GLuint *compressedTextures;  // 0 until the slot is first used
+static uint32_t frame;
+
+void tileAtlas_init( int maxPagesParam, int maxCompressedParam,
+		     bool rgb565Param )
+{
+  assert( (maxPagesParam > 0) && (maxCompressedParam >= 0) );
+
+  maxPages = maxPagesParam;
+  maxCompressed = maxCompressedParam;
+  pixelType = rgb565Param ? GL_UNSIGNED_SHORT_5_6_5 : GL_UNSIGNED_BYTE;
+  pageCount = 0;
+  pageSize = 0;  // GL may not be up yet, so the atlas is created on first use
+  frame = 1;
+}
+
+bool tileAtlas_hasETC1( void )
+{
+  if( pageSize == 0 )
+    atlasCreate();
+
+  return hasETC1;
+}
+
+int tileAtlas_alloc( int *owner, bool compressed )
+{
+  int page, i, slot;
+
+  if( pageSize == 0 )
+    atlasCreate();
+
+  if( compressed )
+  {
+    if( !hasETC1 )
+      return -1;
+
+    if( compressedFree == 0 )
+      return evictSlot( owner, rgbSlotCount, rgbSlotCount + maxCompressed );
+
+    for( slot = rgbSlotCount; slots[ slot ].owner != NULL; slot++ )
+      ;
+
+    compressedFree--;
+    slots[ slot ].owner = owner;
+    slots[ slot ].lastUsed = frame;
+
+    return slot;
+  }
+
+  for( page = 0; page < pageCount; page++ )
+    if( pages[ page ].freeCount > 0 )
+      break;
+
+  if( page == pageCount )
+  {
+    if( pageCount == maxPages )
+      return evictSlot( owner, 0, rgbSlotCount );
+
+    pageCreate( &(pages[ pageCount++ ]) );
+  }
+
+  for( i = 0; i < slotsPerPage; i++ )
+  {
+    slot = page * slotsPerPage + i;
+    if( slots[ slot ].owner == NULL )
+      break;
+  }
+  assert( i < slotsPerPage );
+
+  pages[ page ].freeCount--;
+  slots[ slot ].owner = owner;
+  slots[ slot ].lastUsed = frame;
+
+  return slot;
+}
+
+void tileAtlas_free( int slot )
+{
+  assert( slots[ slot ].owner != NULL );
+
+  slots[ slot ].owner = NULL;
+
+  if( isCompressed( slot ) )
+    compressedFree++;
+  else
+    pages[ slot / slotsPerPage ].freeCount++;
+}
+
+void tileAtlas_upload( int slot, int width, int height, const GLubyte *pixels )
+{
+  int index = slot % slotsPerPage;
+
+  assert( (width <= TILE_ATLAS_TILE_SIZE) && (height <= TILE_ATLAS_TILE_SIZE) );
+  assert( !isCompressed( slot ) );
+
+  glBindTexture( GL_TEXTURE_2D, pages[ slot / slotsPerPage ].textureID );
+  glTexSubImage2D( GL_TEXTURE_2D, 0, (index % slotsPerRow) * TILE_ATLAS_TILE_SIZE,
+		   (index / slotsPerRow) * TILE_ATLAS_TILE_SIZE, width, height,
+		   GL_RGB, pixelType, pixels );
+  assert( glGetError() == GL_NO_ERROR );
+}
+
+void tileAtlas_uploadETC1( int slot, const unsigned char *blocks )
+{
+  int index = slot - rgbSlotCount;
+
+  assert( isCompressed( slot ) );
+
+  if( compressedTextures[ index ] == 0 )
+    compressedTextures[ index ] = textureCreate();
+  else
+    glBindTexture( GL_TEXTURE_2D, compressedTextures[ index ] );
+
+  // replaces the whole texture, which is the only update ETC1 allows
+  glCompressedTexImage2D( GL_TEXTURE_2D, 0, ETC1_GL_FORMAT, TILE_ATLAS_TILE_SIZE,
+			  TILE_ATLAS_TILE_SIZE, 0,
+			  etc1_imageSize( TILE_ATLAS_TILE_SIZE, TILE_ATLAS_TILE_SIZE ),
+			  blocks );
+  assert( glGetError() == GL_NO_ERROR );
+}
+
+GLuint tileAtlas_use( int slot )
+{
+  slots[ slot ].lastUsed = frame;
+
+  if( isCompressed( slot ) )
+    return compressedTextures[ slot - rgbSlotCount ];
+
+  return pages[ slot / slotsPerPage ].textureID;
+}
+
+void tileAtlas_mapUV( int slot, float *u, float *v )
+{
+  int index = slot % slotsPerPage;
+
+  if( isCompressed( slot ) )
+  {
+    *u = (0.5f + *u * (TILE_ATLAS_TILE_SIZE - 1)) / TILE_ATLAS_TILE_SIZE;
+    *v = (0.5f + *v * (TILE_ATLAS_TILE_SIZE - 1)) / TILE_ATLAS_TILE_SIZE;
+    return;
+  }
+
+  *u = ((index % slotsPerRow) * TILE_ATLAS_TILE_SIZE + 0.5f +
+	*u * (TILE_ATLAS_TILE_SIZE - 1)) / pageSize;
+  *v = ((index / slotsPerRow) * TILE_ATLAS_TILE_SIZE + 0.5f +
+	*v * (TILE_ATLAS_TILE_SIZE - 1)) / pageSize;
+}
+
+void tileAtlas_endFrame( void )
+{
+  frame++;
+}
+
+static void atlasCreate( void )
+{
+  const char *extensions;
+  GLint maxSize;
+
+  glGetIntegerv( GL_MAX_TEXTURE_SIZE, &maxSize );
+  assert( glGetError() == GL_NO_ERROR );
+
+  pageSize = (maxSize < ATLAS_MAX_SIZE) ? maxSize : ATLAS_MAX_SIZE;
+  assert( pageSize >= TILE_ATLAS_TILE_SIZE );
+
+  slotsPerRow = pageSize / TILE_ATLAS_TILE_SIZE;
+  slotsPerPage = slotsPerRow * slotsPerRow;
+  rgbSlotCount = maxPages * slotsPerPage;
+
+  extensions = (const char *) glGetString( GL_EXTENSIONS );
+  hasETC1 = (extensions != NULL) &&
+    (strstr( extensions, "GL_OES_compressed_ETC1_RGB8_texture" ) != NULL);
+  compressedFree = hasETC1 ? maxCompressed : 0;
+
+  pages = calloc( maxPages, sizeof( sAtlasPage ) );
+  slots = calloc( rgbSlotCount + maxCompressed, sizeof( sAtlasSlot ) );
+  compressedTextures = calloc( maxCompressed + 1, sizeof( GLuint ) );
+  assert( (pages != NULL) && (slots != NULL) && (compressedTextures != NULL) );
+}
+
+static void pageCreate( AtlasPage page )
+{
+  page->textureID = textureCreate();
+  glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, pageSize, pageSize, 0, GL_RGB,
+		pixelType, NULL );
+  assert( glGetError() == GL_NO_ERROR );
+
+  page->freeCount = slotsPerPage;
+}
+
+/* Returns a new texture, bound, with the atlas' filtering */
+static GLuint textureCreate( void )
+{
+  GLuint textureID;
+
+  glGenTextures( 1, &textureID );
+  glBindTexture( GL_TEXTURE_2D, textureID );
+  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+  return textureID;
+}
+
+/* Takes the least recently drawn slot in first..last - 1 from its owner,
+   unless it was drawn in this frame */
+static int evictSlot( int *owner, int first, int last )
+{
+  int slot, oldest = -1;
+
+  for( slot = first; slot < last; slot++ )
+    if( (oldest == -1) || (slots[ slot ].lastUsed < slots[ oldest ].lastUsed) )
+      oldest = slot;
+
+  if( slots[ oldest ].lastUsed == frame )
+    return -1;
+
+  *(slots[ oldest ].owner) = -1;
+  slots[ oldest ].owner = owner;
+  slots[ oldest ].lastUsed = frame;
+
+  return oldest;
+}
+
+static bool isCompressed( int slot )
+{
+  return slot >= rgbSlotCount;
+}
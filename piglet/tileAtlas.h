@@ -0,0 +1,46 @@
+/*
+   tileAtlas.h
+
+   Tile textures packed into a few large atlas textures (pages), so that all
+   tiles on one page can be drawn with one draw call. A tile's place in the
+   atlas is a slot number. ETC1 compressed tiles get slots of their own.
+
+   Must only be used from the thread owning the GL context.
+*/
+
+#ifndef TILE_ATLAS_H
+#define TILE_ATLAS_H
+
+#include <stdbool.h>
+
+#include "GLES2/gl2.h"
+
+#define TILE_ATLAS_TILE_SIZE 256
+
+/* Pages are created when they are first needed. Up to maxCompressed ETC1
+   tiles are kept, if the GPU supports ETC1. Pages hold RGB, or RGB565 if
+   rgb565 is set. */
+void tileAtlas_init( int maxPagesParam, int maxCompressedParam,
+		     bool rgb565Param );
+bool tileAtlas_hasETC1( void );
+/*
+ * Returns a free slot, for an RGB or an ETC1 tile, or -1 if there is none. If
+ * all slots are taken, the one least recently drawn, but not in the current
+ * frame, is taken from its owner and *owner is set to -1. *owner must hold
+ * the slot until it is freed.
+ */
+int tileAtlas_alloc( int *owner, bool compressed );
+void tileAtlas_free( int slot );
+/* width and height are at most TILE_ATLAS_TILE_SIZE, pixels are in the
+   pages' format */
+void tileAtlas_upload( int slot, int width, int height, const GLubyte *pixels );
+/* blocks of a TILE_ATLAS_TILE_SIZE square ETC1 image */
+void tileAtlas_uploadETC1( int slot, const unsigned char *blocks );
+/* Marks the slot as drawn in the current frame, and returns its page's
+   texture */
+GLuint tileAtlas_use( int slot );
+/* Maps u, v in 0..1 over the tile to u, v in its page */
+void tileAtlas_mapUV( int slot, float *u, float *v );
+void tileAtlas_endFrame( void );
+
+#endif
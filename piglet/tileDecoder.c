@@ -0,0 +1,440 @@
+/*
+   tileDecoder.c
+
+   Every decoder reads the tile from memory (the tile mapping) and decodes
+   one row at a time into its place in the caller's buffer, so decoded
+   pixels are written exactly once. For RGB565, rows are decoded to RGB in
+   a row sized buffer on the stack and packed from there, except that
+   libjpeg-turbo packs them itself.
+
+   Interlaced PNGs can't be decoded a row at a time, so they are only
+   decoded to RGB, where the rows are decoded in place pass by pass.
+*/
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <png.h>
+#ifdef HAVE_SPNG
+#include <spng.h>
+#endif
+#ifdef HAVE_JPEG
+#include <jpeglib.h>
+#endif
+
+#include "etc1.h"
+#include "tileDecoder.h"
+
+/* widest tile that can be decoded to RGB565 */
+#define MAX_WIDTH 2048
+
+typedef struct
+{
+  const unsigned char *buffer;
+  size_t remainingBytes;
+} sMemPNG, *MemPNG;
+
+#ifdef HAVE_JPEG
+typedef struct
+{
+  struct jpeg_error_mgr manager;
+  jmp_buf jump;
+  char message[ JMSG_LENGTH_MAX ];
+} sJpegError, *JpegError;
+#endif
+
+/*
+ * static functions
+ */
+static Error checkSize( const char *decoder, int width, int height,
+			TileImage image );
+static bool pngAccepts( const unsigned char *data, size_t size );
+static Error pngDecode( const unsigned char *data, size_t size,
+			TileImage image );
+static void png_memoryReadFunc( png_structp png_ptr, png_bytep outBytes,
+				png_size_t byteCountToRead );
+#ifdef HAVE_SPNG
+static Error spngDecode( const unsigned char *data, size_t size,
+			 TileImage image );
+#endif
+#ifdef HAVE_JPEG
+static bool jpegAccepts( const unsigned char *data, size_t size );
+static Error jpegDecode( const unsigned char *data, size_t size,
+			 TileImage image );
+static void jpegErrorExit( j_common_ptr cinfo );
+#endif
+static bool etc1Accepts( const unsigned char *data, size_t size );
+static Error etc1Decode( const unsigned char *data, size_t size,
+			 TileImage image );
+
+/*
+ * Global data
+ */
+#ifdef HAVE_SPNG
+static const sTileDecoder spngDecoder = { "libspng", pngAccepts, spngDecode };
+#endif
+static const sTileDecoder pngDecoder = { "libpng", pngAccepts, pngDecode };
+#ifdef HAVE_JPEG
+static const sTileDecoder jpegDecoder = { "libjpeg", jpegAccepts, jpegDecode };
+#endif
+static const sTileDecoder etc1Decoder = { "etc1", etc1Accepts, etc1Decode };
+
+const sTileDecoder *const tileDecoders[] = {
+#ifdef HAVE_SPNG
+  &spngDecoder,
+#endif
+  &pngDecoder,
+#ifdef HAVE_JPEG
+  &jpegDecoder,
+#endif
+  &etc1Decoder,
+  NULL
+};
+
+const sTileDecoder *tileDecoder_find( const unsigned char *data, size_t size )
+{
+  int i;
+
+  for( i = 0; tileDecoders[i] != NULL; i++ )
+    if( tileDecoders[i]->accepts( data, size ) )
+      return tileDecoders[i];
+
+  return NULL;
+}
+
+Error tileDecoder_decode( const unsigned char *data, size_t size,
+			  TileImage image )
+{
+  const sTileDecoder *decoder = tileDecoder_find( data, size );
+
+  if( decoder == NULL )
+    return ErrNew( ERR_APP, 0, NULL, "unknown tile image format" );
+
+  return decoder->decode( data, size, image );
+}
+
+int tileDecoder_pixelBytes( TilePixelFormat format )
+{
+  return (format == TILE_PIXELS_RGB565) ? 2 : 3;
+}
+
+/*
+ * No branches or lookups, so the compiler can vectorize the loop (NEON on
+ * the Pi) at -O3.
+ */
+void tileDecoder_rgbTo565( const unsigned char *rgb, uint16_t *out, int count )
+{
+  int i;
+
+  for( i = 0; i < count; i++ )
+    out[i] = ((rgb[ i * 3 ] >> 3) << 11) | ((rgb[ i * 3 + 1 ] >> 2) << 5) |
+      (rgb[ i * 3 + 2 ] >> 3);
+}
+
+/* Sets the image's size, or returns an error if it doesn't fit */
+static Error checkSize( const char *decoder, int width, int height,
+			TileImage image )
+{
+  if( ((size_t) width * height * tileDecoder_pixelBytes( image->format ) >
+       image->size) ||
+      ((image->format == TILE_PIXELS_RGB565) && (width > MAX_WIDTH)) )
+    return ErrNew( ERR_APP, 0, NULL, "%s: %dx%d image does not fit in buffer",
+		   decoder, width, height );
+
+  image->width = width;
+  image->height = height;
+
+  return NULL;
+}
+
+static bool pngAccepts( const unsigned char *data, size_t size )
+{
+  return (size >= 8) && (png_sig_cmp( (png_const_bytep) data, 0, 8 ) == 0);
+}
+
+static Error pngDecode( const unsigned char *data, size_t size,
+			TileImage image )
+{
+  png_structp png_ptr;
+  png_infop info_ptr;
+  png_uint_32 width, height, y;
+  png_byte row[ MAX_WIDTH * 3 ];
+  sMemPNG memPNG;
+  Error error;
+  int passes, pass;
+
+  memPNG.buffer = data;
+  memPNG.remainingBytes = size;
+
+  png_ptr = png_create_read_struct( PNG_LIBPNG_VER_STRING, NULL, NULL, NULL );
+  if( png_ptr == NULL )
+    return ErrNew( ERR_APP, 0, NULL, "png_create_read_struct failed" );
+
+  info_ptr = png_create_info_struct( png_ptr );
+  if( info_ptr == NULL )
+  {
+    png_destroy_read_struct( &png_ptr, NULL, NULL );
+    return ErrNew( ERR_APP, 0, NULL, "png_create_info_struct failed" );
+  }
+
+  // libpng longjmps here on errors
+  if( setjmp( png_jmpbuf( png_ptr ) ) )
+  {
+    png_destroy_read_struct( &png_ptr, &info_ptr, NULL );
+    return ErrNew( ERR_APP, 0, NULL, "libpng: corrupt PNG" );
+  }
+
+  png_set_read_fn( png_ptr, &memPNG, png_memoryReadFunc );
+  png_read_info( png_ptr, info_ptr );
+
+  // whatever the PNG holds, decode 8 bit RGB
+  png_set_expand( png_ptr );
+  png_set_strip_16( png_ptr );
+  png_set_strip_alpha( png_ptr );
+  png_set_gray_to_rgb( png_ptr );
+  passes = png_set_interlace_handling( png_ptr );
+  png_read_update_info( png_ptr, info_ptr );
+
+  width = png_get_image_width( png_ptr, info_ptr );
+  height = png_get_image_height( png_ptr, info_ptr );
+  error = checkSize( "libpng", width, height, image );
+  if( (error == NULL) && (passes > 1) && (image->format != TILE_PIXELS_RGB) )
+    error = ErrNew( ERR_APP, 0, NULL,
+		    "libpng: interlaced PNGs are only decoded to RGB" );
+  if( error != NULL )
+  {
+    png_destroy_read_struct( &png_ptr, &info_ptr, NULL );
+    return error;
+  }
+
+  if( image->format == TILE_PIXELS_RGB )
+    for( pass = 0; pass < passes; pass++ )
+      for( y = 0; y < height; y++ )
+	png_read_row( png_ptr, image->pixels + (size_t) y * width * 3, NULL );
+  else
+    for( y = 0; y < height; y++ )
+    {
+      png_read_row( png_ptr, row, NULL );
+      tileDecoder_rgbTo565( row, (uint16_t *) image->pixels + (size_t) y * width,
+			    width );
+    }
+
+  png_read_end( png_ptr, NULL );
+  png_destroy_read_struct( &png_ptr, &info_ptr, NULL );
+
+  return NULL;
+}
+
+static void png_memoryReadFunc( png_structp png_ptr, png_bytep outBytes,
+				png_size_t byteCountToRead )
+{
+  MemPNG memPNG = (MemPNG) png_get_io_ptr(png_ptr);
+
+  if( byteCountToRead > memPNG->remainingBytes )
+    png_error( png_ptr, "truncated PNG" );
+
+  // libpng only reads through this callback, so the bytes are copied from
+  // the tile mapping straight into libpng's buffer
+  memcpy( outBytes, memPNG->buffer, byteCountToRead );
+
+  memPNG->remainingBytes -= byteCountToRead;
+  memPNG->buffer += byteCountToRead;
+}
+
+#ifdef HAVE_SPNG
+static Error spngDecode( const unsigned char *data, size_t size,
+			 TileImage image )
+{
+  spng_ctx *ctx;
+  struct spng_ihdr ihdr;
+  struct spng_row_info rowInfo;
+  unsigned char row[ MAX_WIDTH * 3 ];
+  size_t imageSize;
+  Error error;
+  int err;
+
+  ctx = spng_ctx_new( 0 );
+  if( ctx == NULL )
+    return ErrNew( ERR_APP, 0, NULL, "spng_ctx_new failed" );
+
+  err = spng_set_png_buffer( ctx, data, size );
+  if( err == 0 )
+    err = spng_get_ihdr( ctx, &ihdr );
+  if( err == 0 )
+    err = spng_decoded_image_size( ctx, SPNG_FMT_RGB8, &imageSize );
+  if( err != 0 )
+  {
+    spng_ctx_free( ctx );
+    return ErrNew( ERR_APP, 0, NULL, "libspng: %s", spng_strerror( err ) );
+  }
+
+  error = checkSize( "libspng", ihdr.width, ihdr.height, image );
+  if( (error == NULL) && (ihdr.interlace_method != 0) &&
+      (image->format != TILE_PIXELS_RGB) )
+    error = ErrNew( ERR_APP, 0, NULL,
+		    "libspng: interlaced PNGs are only decoded to RGB" );
+  if( error != NULL )
+  {
+    spng_ctx_free( ctx );
+    return error;
+  }
+
+  if( image->format == TILE_PIXELS_RGB )
+    err = spng_decode_image( ctx, image->pixels, imageSize, SPNG_FMT_RGB8, 0 );
+  else
+  {
+    err = spng_decode_image( ctx, NULL, 0, SPNG_FMT_RGB8,
+			     SPNG_DECODE_PROGRESSIVE );
+    while( err == 0 )
+    {
+      err = spng_get_row_info( ctx, &rowInfo );
+      if( err != 0 )
+	break;
+
+      err = spng_decode_row( ctx, row, ihdr.width * 3 );
+      if( (err == 0) || (err == SPNG_EOI) )
+	tileDecoder_rgbTo565( row, (uint16_t *) image->pixels +
+			      (size_t) rowInfo.row_num * ihdr.width,
+			      ihdr.width );
+    }
+    if( err == SPNG_EOI )
+      err = 0;
+  }
+
+  spng_ctx_free( ctx );
+
+  if( err != 0 )
+    return ErrNew( ERR_APP, 0, NULL, "libspng: %s", spng_strerror( err ) );
+
+  return NULL;
+}
+#endif
+
+#ifdef HAVE_JPEG
+static bool jpegAccepts( const unsigned char *data, size_t size )
+{
+  return (size >= 3) && (data[0] == 0xff) && (data[1] == 0xd8) &&
+    (data[2] == 0xff);
+}
+
+static Error jpegDecode( const unsigned char *data, size_t size,
+			 TileImage image )
+{
+  struct jpeg_decompress_struct cinfo;
+  sJpegError jpegError;
+  JSAMPROW rowPointer;
+  unsigned char row[ MAX_WIDTH * 3 ];
+  bool pack565;
+  Error error;
+
+  cinfo.err = jpeg_std_error( &(jpegError.manager) );
+  jpegError.manager.error_exit = jpegErrorExit;
+
+  // libjpeg longjmps here on errors
+  if( setjmp( jpegError.jump ) )
+  {
+    jpeg_destroy_decompress( &cinfo );
+    return ErrNew( ERR_APP, 0, NULL, "libjpeg: %s", jpegError.message );
+  }
+
+  jpeg_create_decompress( &cinfo );
+  jpeg_mem_src( &cinfo, (unsigned char *) data, size );
+  jpeg_read_header( &cinfo, TRUE );
+
+  cinfo.out_color_space = JCS_RGB;
+  pack565 = (image->format == TILE_PIXELS_RGB565);
+#ifdef LIBJPEG_TURBO_VERSION_NUMBER
+  // libjpeg-turbo packs RGB565 itself, with SIMD color conversion
+  if( pack565 )
+  {
+    cinfo.out_color_space = JCS_RGB565;
+    cinfo.dither_mode = JDITHER_NONE;
+    pack565 = false;
+  }
+#endif
+  jpeg_start_decompress( &cinfo );
+
+  error = checkSize( "libjpeg", cinfo.output_width, cinfo.output_height,
+		     image );
+  if( error != NULL )
+  {
+    jpeg_destroy_decompress( &cinfo );
+    return error;
+  }
+
+  while( cinfo.output_scanline < cinfo.output_height )
+  {
+    size_t y = cinfo.output_scanline;
+
+    if( pack565 )
+    {
+      rowPointer = row;
+      jpeg_read_scanlines( &cinfo, &rowPointer, 1 );
+      tileDecoder_rgbTo565( row, (uint16_t *) image->pixels + y * image->width,
+			    image->width );
+    }
+    else
+    {
+      rowPointer = image->pixels + y * image->width *
+	tileDecoder_pixelBytes( image->format );
+      jpeg_read_scanlines( &cinfo, &rowPointer, 1 );
+    }
+  }
+
+  jpeg_finish_decompress( &cinfo );
+  jpeg_destroy_decompress( &cinfo );
+
+  return NULL;
+}
+
+/* Instead of exiting, returns to jpegDecode with the message */
+static void jpegErrorExit( j_common_ptr cinfo )
+{
+  JpegError jpegError = (JpegError) cinfo->err;
+
+  cinfo->err->format_message( cinfo, jpegError->message );
+  longjmp( jpegError->jump, 1 );
+}
+#endif
+
+static bool etc1Accepts( const unsigned char *data, size_t size )
+{
+  const unsigned char *blocks;
+  int width, height;
+
+  return etc1_parsePkm( data, size, &width, &height, &blocks );
+}
+
+static Error etc1Decode( const unsigned char *data, size_t size,
+			 TileImage image )
+{
+  const unsigned char *blocks;
+  unsigned char band[ 4 * MAX_WIDTH * 3 ];
+  int width, height, y;
+  Error error;
+
+  if( !etc1_parsePkm( data, size, &width, &height, &blocks ) )
+    return ErrNew( ERR_APP, 0, NULL, "etc1: not a PKM file" );
+
+  error = checkSize( "etc1", width, height, image );
+  if( error != NULL )
+    return error;
+
+  if( image->format == TILE_PIXELS_RGB )
+  {
+    etc1_decodeImage( blocks, width, height, image->pixels, width * 3 );
+    return NULL;
+  }
+
+  // a row of blocks at a time
+  for( y = 0; y < height; y += 4 )
+  {
+    etc1_decodeImage( blocks + etc1_imageSize( width, y ), width, 4, band,
+		      width * 3 );
+    tileDecoder_rgbTo565( band, (uint16_t *) image->pixels + (size_t) y * width,
+			  4 * width );
+  }
+
+  return NULL;
+}
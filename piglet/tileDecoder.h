@@ -0,0 +1,53 @@
+/*
+   tileDecoder.h
+
+   Decoders for encoded tile images. A tile's decoder is picked by its first
+   bytes. Decoders write rows straight into the caller's buffer, as 24 bit
+   RGB or 16 bit RGB565, top row first, without padding.
+
+   Decoders, in order of preference: libspng for PNG (if built with
+   HAVE_SPNG), libpng, libjpeg-turbo for JPEG (if built with HAVE_JPEG), and
+   ETC1 PKM files, decoded in software.
+
+   Decoders may be used by several threads at once.
+*/
+
+#ifndef TILE_DECODER_H
+#define TILE_DECODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <voxi/util/err.h>
+
+typedef enum { TILE_PIXELS_RGB, TILE_PIXELS_RGB565 } TilePixelFormat;
+
+typedef struct
+{
+  unsigned char *pixels;   // set by the caller
+  size_t size;             // bytes at pixels
+  TilePixelFormat format;
+  int width, height;       // set by the decoder
+} sTileImage, *TileImage;
+
+typedef struct
+{
+  const char *name;
+  /* true if data looks like an image this decoder reads */
+  bool (*accepts)( const unsigned char *data, size_t size );
+  Error (*decode)( const unsigned char *data, size_t size, TileImage image );
+} sTileDecoder, *TileDecoder;
+
+/* The decoders built in, in order of preference, ending with NULL */
+extern const sTileDecoder *const tileDecoders[];
+
+/* Returns the preferred decoder for the data, or NULL */
+const sTileDecoder *tileDecoder_find( const unsigned char *data, size_t size );
+Error tileDecoder_decode( const unsigned char *data, size_t size,
+			  TileImage image );
+int tileDecoder_pixelBytes( TilePixelFormat format );
+/* Packs count RGB pixels into GL_UNSIGNED_SHORT_5_6_5 */
+void tileDecoder_rgbTo565( const unsigned char *rgb, uint16_t *out, int count );
+
+#endif
@@ -0,0 +1,204 @@
+/*
+   tileDiskCache.c
+
+   Each tile is a file, <path>/<z>/<x>/<y>.lz4: a header, then the LZ4
+   compressed pixels, as kept by tileTexture's LZ4 tier. Files are written
+   under a temporary name and renamed, so readers never see a partial
+   entry, and are in the machine's byte order, as the cache is never moved
+   to another machine.
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tileDiskCache.h"
+
+#define CACHE_FILE_MAGIC "PIGLTLZ4"
+#define CACHE_FILE_VERSION 1
+
+typedef struct
+{
+  char magic[8];  // CACHE_FILE_MAGIC, not null terminated
+  uint16_t version;
+  uint8_t format;  // TilePixelFormat
+  uint8_t reserved;
+  uint16_t width, height;
+  uint32_t lz4Size;
+  int64_t sourceMtime;
+  uint64_t sourceSize;
+} sCacheFileHeader;
+
+/*
+ * static functions
+ */
+static void entryName( char *name, size_t size, int z, uint32_t x, uint32_t y );
+static bool makeDirectory( const char *path );
+static void reportWriteError( const char *filename );
+
+/*
+ * Global data
+ */
+static char *cachePath;  // NULL if the cache is not open
+static bool writeErrorReported;
+
+Error tileDiskCache_open( const char *path )
+{
+  if( !makeDirectory( path ) )
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not create tile cache '%s'",
+		   path );
+
+  cachePath = strdup( path );
+  assert( cachePath != NULL );
+
+  return NULL;
+}
+
+bool tileDiskCache_isOpen( void )
+{
+  return cachePath != NULL;
+}
+
+bool tileDiskCache_map( int z, uint32_t x, uint32_t y, const sTileBlob *source,
+			TilePixelFormat format, TileBlob lz4, int *width,
+			int *height )
+{
+  const sCacheFileHeader *header;
+  char filename[ 1024 ];
+  struct stat st;
+  void *map;
+  int fd;
+
+  entryName( filename, sizeof( filename ), z, x, y );
+
+  fd = open( filename, O_RDONLY );
+  if( fd == -1 )
+    return false;
+
+  if( (fstat( fd, &st ) != 0) || (st.st_size < sizeof( sCacheFileHeader )) )
+  {
+    close( fd );
+    return false;
+  }
+
+  map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  // the mapping keeps the file referenced
+  close( fd );
+  if( map == MAP_FAILED )
+    return false;
+
+  // read once, front to back
+  madvise( map, st.st_size, MADV_SEQUENTIAL );
+  madvise( map, st.st_size, MADV_WILLNEED );
+
+  header = map;
+  if( (memcmp( header->magic, CACHE_FILE_MAGIC, sizeof( header->magic ) ) != 0) ||
+      (header->version != CACHE_FILE_VERSION) || (header->format != format) ||
+      (header->sourceMtime != source->mtime) ||
+      (header->sourceSize != source->size) ||
+      (sizeof( sCacheFileHeader ) + header->lz4Size > st.st_size) )
+  {
+    munmap( map, st.st_size );
+    return false;
+  }
+
+  *width = header->width;
+  *height = header->height;
+
+  lz4->data = (const unsigned char *) map + sizeof( sCacheFileHeader );
+  lz4->size = header->lz4Size;
+  lz4->mtime = st.st_mtime;
+  lz4->mapBase = map;
+  lz4->mapLength = st.st_size;
+
+  return true;
+}
+
+bool tileDiskCache_write( int z, uint32_t x, uint32_t y, const sTileBlob *source,
+			  TilePixelFormat format, int width, int height,
+			  const char *lz4, int lz4Size )
+{
+  sCacheFileHeader header;
+  char filename[ 1024 ], tempName[ 1040 ], *slash;
+  bool ok;
+  int fd;
+
+  assert( cachePath != NULL );
+
+  entryName( filename, sizeof( filename ), z, x, y );
+  snprintf( tempName, sizeof( tempName ), "%s.XXXXXX", filename );
+
+  fd = mkstemp( tempName );
+  if( (fd == -1) && (errno == ENOENT) )
+  {
+    // make the zoom and x directories, then try again
+    slash = strrchr( filename, '/' );
+    *slash = '\0';
+    *strrchr( filename, '/' ) = '\0';
+    makeDirectory( filename );
+    filename[ strlen( filename ) ] = '/';
+    makeDirectory( filename );
+    *slash = '/';
+
+    snprintf( tempName, sizeof( tempName ), "%s.XXXXXX", filename );
+    fd = mkstemp( tempName );
+  }
+  if( fd == -1 )
+  {
+    reportWriteError( tempName );
+    return false;
+  }
+
+  memset( &header, 0, sizeof( header ) );
+  memcpy( header.magic, CACHE_FILE_MAGIC, sizeof( header.magic ) );
+  header.version = CACHE_FILE_VERSION;
+  header.format = format;
+  header.width = width;
+  header.height = height;
+  header.lz4Size = lz4Size;
+  header.sourceMtime = source->mtime;
+  header.sourceSize = source->size;
+
+  // mkstemp makes the file private
+  fchmod( fd, 0644 );
+  ok = (write( fd, &header, sizeof( header ) ) == sizeof( header )) &&
+    (write( fd, lz4, lz4Size ) == lz4Size);
+  if( close( fd ) != 0 )
+    ok = false;
+
+  if( !ok || (rename( tempName, filename ) != 0) )
+  {
+    reportWriteError( filename );
+    unlink( tempName );
+    return false;
+  }
+
+  return true;
+}
+
+static void entryName( char *name, size_t size, int z, uint32_t x, uint32_t y )
+{
+  snprintf( name, size, "%s/%d/%u/%u.lz4", cachePath, z, x, y );
+}
+
+static bool makeDirectory( const char *path )
+{
+  return (mkdir( path, 0755 ) == 0) || (errno == EEXIST);
+}
+
+static void reportWriteError( const char *filename )
+{
+  // racy, but at worst reported once per loader
+  if( writeErrorReported )
+    return;
+
+  writeErrorReported = true;
+  fprintf( stderr, "Could not write tile cache file '%s': %s\n", filename,
+	   strerror( errno ) );
+}
@@ -0,0 +1,42 @@
+/*
+   tileDiskCache.h
+
+   Decoded tiles saved on disk between runs, LZ4 compressed, so that a tile
+   shown before is read back with one sequential read and unpacked instead
+   of being decoded. Entries are keyed by the modification time and size of
+   the file the tile was decoded from, and by pixel format, so changed
+   charts or another pixel format are simply misses.
+
+   The cache is filled by loader threads as they decode tiles. Safe to use
+   from several threads at once.
+*/
+
+#ifndef TILE_DISK_CACHE_H
+#define TILE_DISK_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <voxi/util/err.h>
+
+#include "tileDecoder.h"
+#include "tileSource.h"
+
+/* Creates the cache directory if needed */
+Error tileDiskCache_open( const char *path );
+bool tileDiskCache_isOpen( void );
+/*
+ * If the cache has the tile, decoded from source in this format, maps its
+ * LZ4 compressed pixels into lz4 and returns true. Release the mapping with
+ * tileSource_release.
+ */
+bool tileDiskCache_map( int z, uint32_t x, uint32_t y, const sTileBlob *source,
+			TilePixelFormat format, TileBlob lz4, int *width,
+			int *height );
+/* Returns whether the tile was saved. Errors are reported once, as the
+   cache is only an optimization. */
+bool tileDiskCache_write( int z, uint32_t x, uint32_t y, const sTileBlob *source,
+			  TilePixelFormat format, int width, int height,
+			  const char *lz4, int lz4Size );
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ *  tileEtc.c
+ *
+ * Transcodes a TMS PNG tile directory tree (<dir>/<zz>/<x>/<y>.png) into a
+ * tree of ETC1 compressed PKM files (<out>/<zz>/<x>/<y>.pkm), which piglet
+ * uploads to the GPU without decoding. Tiles that can't be transcoded
+ * (sizes that aren't multiples of 4) are copied as PNG, and are decoded as
+ * before. The output tree can be packed with tilePack.
+ *
+ * usage: tileEtc <tile directory> <output directory>
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <png.h>
+
+#include "etc1.h"
+
+/*
+ * Local function prototypes
+ */
+static bool parseNumber( const char *name, const char *suffix,
+			 uint32_t *number );
+static bool makeDirectory( const char *path );
+static bool transcodeTile( const char *pngName, const char *outName,
+			   size_t *outSize );
+static bool copyTile( const char *pngName, const char *outName,
+		      size_t *outSize );
+static double now( void );
+
+/*
+ * Start of code
+ */
+int main( int argc, char **argv )
+{
+  DIR *zDir, *xDir, *yDir;
+  struct dirent *zEnt, *xEnt, *yEnt;
+  char path[ 1024 ], pngName[ 1024 ], outName[ 1024 ];
+  int transcoded = 0, copied = 0, failed = 0;
+  unsigned long long pngBytes = 0, outBytes = 0;
+  double start = now();
+
+  if( argc != 3 )
+  {
+    fprintf( stderr, "usage: %s <tile directory> <output directory>\n",
+	     argv[0] );
+    return 1;
+  }
+
+  zDir = opendir( argv[1] );
+  if( zDir == NULL )
+  {
+    perror( argv[1] );
+    return 1;
+  }
+
+  if( !makeDirectory( argv[2] ) )
+    return 1;
+
+  while( (zEnt = readdir( zDir )) != NULL )
+  {
+    uint32_t z;
+
+    if( !parseNumber( zEnt->d_name, "", &z ) )
+      continue;
+
+    snprintf( path, sizeof( path ), "%s/%s", argv[1], zEnt->d_name );
+    xDir = opendir( path );
+    if( xDir == NULL )
+      continue;
+
+    snprintf( path, sizeof( path ), "%s/%s", argv[2], zEnt->d_name );
+    if( !makeDirectory( path ) )
+      return 1;
+
+    while( (xEnt = readdir( xDir )) != NULL )
+    {
+      uint32_t x;
+
+      if( !parseNumber( xEnt->d_name, "", &x ) )
+	continue;
+
+      snprintf( path, sizeof( path ), "%s/%s/%s", argv[1], zEnt->d_name,
+		xEnt->d_name );
+      yDir = opendir( path );
+      if( yDir == NULL )
+	continue;
+
+      snprintf( path, sizeof( path ), "%s/%s/%s", argv[2], zEnt->d_name,
+		xEnt->d_name );
+      if( !makeDirectory( path ) )
+	return 1;
+
+      while( (yEnt = readdir( yDir )) != NULL )
+      {
+	uint32_t y;
+	struct stat st;
+	size_t size;
+
+	if( !parseNumber( yEnt->d_name, ".png", &y ) )
+	  continue;
+
+	snprintf( pngName, sizeof( pngName ), "%s/%s/%s/%s", argv[1],
+		  zEnt->d_name, xEnt->d_name, yEnt->d_name );
+	if( (stat( pngName, &st ) != 0) || !S_ISREG( st.st_mode ) )
+	  continue;
+
+	snprintf( outName, sizeof( outName ), "%s/%s/%s/%u.pkm", argv[2],
+		  zEnt->d_name, xEnt->d_name, y );
+	if( transcodeTile( pngName, outName, &size ) )
+	  transcoded++;
+	else
+	{
+	  snprintf( outName, sizeof( outName ), "%s/%s/%s/%s", argv[2],
+		    zEnt->d_name, xEnt->d_name, yEnt->d_name );
+	  if( !copyTile( pngName, outName, &size ) )
+	  {
+	    failed++;
+	    continue;
+	  }
+	  copied++;
+	}
+
+	pngBytes += st.st_size;
+	outBytes += size;
+      }
+      closedir( yDir );
+    }
+    closedir( xDir );
+  }
+  closedir( zDir );
+
+  printf( "Transcoded %d tiles, copied %d as PNG, %d failed, in %.1f s\n",
+	  transcoded, copied, failed, now() - start );
+  printf( "%llu bytes of PNG, %llu bytes written\n", pngBytes, outBytes );
+
+  return (failed == 0) ? 0 : 1;
+}
+
+/* Parses names like "17" or "12345.png" */
+static bool parseNumber( const char *name, const char *suffix,
+			 uint32_t *number )
+{
+  const char *p;
+
+  if( !isdigit( (unsigned char) name[0] ) )
+    return false;
+
+  for( p = name; isdigit( (unsigned char) *p ); p++ )
+    ;
+
+  if( strcmp( p, suffix ) != 0 )
+    return false;
+
+  *number = strtoul( name, NULL, 10 );
+  return true;
+}
+
+static bool makeDirectory( const char *path )
+{
+  if( (mkdir( path, 0755 ) != 0) && (errno != EEXIST) )
+  {
+    perror( path );
+    return false;
+  }
+
+  return true;
+}
+
+/* Returns false, having written nothing, if the tile can't be ETC1 */
+static bool transcodeTile( const char *pngName, const char *outName,
+			   size_t *outSize )
+{
+  png_image image;
+  unsigned char *rgb, *pkm;
+  FILE *out;
+  bool ok;
+
+  memset( &image, 0, sizeof( image ) );
+  image.version = PNG_IMAGE_VERSION;
+
+  if( !png_image_begin_read_from_file( &image, pngName ) )
+  {
+    fprintf( stderr, "%s: %s\n", pngName, image.message );
+    return false;
+  }
+
+  if( ((image.width % 4) != 0) || ((image.height % 4) != 0) )
+  {
+    png_image_free( &image );
+    return false;
+  }
+
+  image.format = PNG_FORMAT_RGB;
+  *outSize = ETC1_PKM_HEADER_SIZE + etc1_imageSize( image.width, image.height );
+
+  rgb = malloc( PNG_IMAGE_SIZE( image ) );
+  pkm = malloc( *outSize );
+  if( (rgb == NULL) || (pkm == NULL) )
+  {
+    fprintf( stderr, "%s: out of memory\n", pngName );
+    exit( 1 );
+  }
+
+  ok = png_image_finish_read( &image, NULL, rgb, 0, NULL );
+  if( !ok )
+    fprintf( stderr, "%s: %s\n", pngName, image.message );
+  else
+  {
+    etc1_writePkmHeader( pkm, image.width, image.height );
+    etc1_encodeImage( rgb, image.width, image.height, image.width * 3,
+		      pkm + ETC1_PKM_HEADER_SIZE );
+
+    out = fopen( outName, "wb" );
+    ok = (out != NULL) && (fwrite( pkm, *outSize, 1, out ) == 1);
+    if( (out != NULL) && (fclose( out ) != 0) )
+      ok = false;
+    if( !ok )
+    {
+      perror( outName );
+      exit( 1 );
+    }
+  }
+
+  free( rgb );
+  free( pkm );
+
+  return ok;
+}
+
+static bool copyTile( const char *pngName, const char *outName,
+		      size_t *outSize )
+{
+  char buffer[ 65536 ];
+  FILE *in, *out;
+  size_t count;
+
+  in = fopen( pngName, "rb" );
+  if( in == NULL )
+  {
+    perror( pngName );
+    return false;
+  }
+
+  out = fopen( outName, "wb" );
+  if( out == NULL )
+  {
+    perror( outName );
+    exit( 1 );
+  }
+
+  *outSize = 0;
+  while( (count = fread( buffer, 1, sizeof( buffer ), in )) > 0 )
+  {
+    if( fwrite( buffer, 1, count, out ) != count )
+    {
+      perror( outName );
+      exit( 1 );
+    }
+    *outSize += count;
+  }
+
+  fclose( in );
+  if( fclose( out ) != 0 )
+  {
+    perror( outName );
+    exit( 1 );
+  }
+
+  return true;
+}
+
+static double now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
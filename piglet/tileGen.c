@@ -0,0 +1,252 @@
+/*
+ *  tileGen.c
+ *
+ * Writes a synthetic TMS pyramid of PNG tiles (<out>/<zz>/<x>/<y>.png), to
+ * reproduce loader performance without the licensed chart tiles.
+ *
+ * usage: tileGen [options] <output directory>
+ *   -z <min>-<max>  zoom levels, 9-14 by default
+ *   -x <x> -y <y>   the area's bottom left tile at the lowest zoom level,
+ *                   by default the area piglet shows at start
+ *   -w <tiles>      the area's width and height at the lowest zoom level
+ *   -m <tiles>      write at most this many tiles
+ *   -H <percent>    coverage holes: tiles left out, at random
+ *   -c <percent>    pixels of random noise, from 0 (flat colors and lines,
+ *                   which compress like charts) to 100 (incompressible)
+ *   -s <seed>       for the holes and the noise
+ *
+ * Each level covers the same area as the lowest one. Tiles depend only on
+ * their coordinates and the seed, so the same options write the same tree.
+ * A hole leaves out a single tile; its descendants may still exist, as
+ * detailed charts cover parts of an area only.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <png.h>
+
+#define TILE_SIZE 256
+/* chart-like grid lines, every so many pixels */
+#define GRID_STEP 32
+
+/*
+ * Local function prototypes
+ */
+static void usage( const char *program );
+static bool makeDirectory( const char *path );
+static uint32_t tileRandom( int z, uint32_t x, uint32_t y );
+static uint32_t nextRandom( uint32_t *state );
+static void drawTile( unsigned char *rgb, int z, uint32_t x, uint32_t y );
+static double now( void );
+
+/*
+ * Global data
+ */
+static uint32_t seed = 1;
+static int holePercent = 0;
+static int noisePercent = 5;
+
+/*
+ * Start of code
+ */
+int main( int argc, char **argv )
+{
+  int minZ = 9, maxZ = 14, width = 2, maxTiles = -1, option, z, written = 0,
+    holes = 0;
+  uint32_t x0 = 281, y0 = 360, x, y, levelWidth;
+  unsigned long long bytes = 0;
+  unsigned char rgb[ TILE_SIZE * TILE_SIZE * 3 ];
+  char path[ 1024 ];
+  png_image image;
+  struct stat st;
+  double start = now();
+
+  while( (option = getopt( argc, argv, "z:x:y:w:m:H:c:s:" )) != -1 )
+    switch( option )
+    {
+      case 'z':
+	if( sscanf( optarg, "%d-%d", &minZ, &maxZ ) != 2 )
+	  usage( argv[0] );
+	break;
+
+      case 'x':
+	x0 = strtoul( optarg, NULL, 10 );
+	break;
+
+      case 'y':
+	y0 = strtoul( optarg, NULL, 10 );
+	break;
+
+      case 'w':
+	width = atoi( optarg );
+	break;
+
+      case 'm':
+	maxTiles = atoi( optarg );
+	break;
+
+      case 'H':
+	holePercent = atoi( optarg );
+	break;
+
+      case 'c':
+	noisePercent = atoi( optarg );
+	break;
+
+      case 's':
+	seed = strtoul( optarg, NULL, 10 );
+	break;
+
+      default:
+	usage( argv[0] );
+    }
+
+  if( (argc - optind != 1) || (minZ < 0) || (maxZ < minZ) || (maxZ > 29) ||
+      (width < 1) )
+    usage( argv[0] );
+
+  if( !makeDirectory( argv[ optind ] ) )
+    return 1;
+
+  for( z = minZ; (z <= maxZ) && (written != maxTiles); z++ )
+  {
+    levelWidth = (uint32_t) width << (z - minZ);
+
+    snprintf( path, sizeof( path ), "%s/%02d", argv[ optind ], z );
+    if( !makeDirectory( path ) )
+      return 1;
+
+    for( x = x0 << (z - minZ); x < (x0 << (z - minZ)) + levelWidth; x++ )
+    {
+      snprintf( path, sizeof( path ), "%s/%02d/%u", argv[ optind ], z, x );
+      if( !makeDirectory( path ) )
+	return 1;
+
+      for( y = y0 << (z - minZ); y < (y0 << (z - minZ)) + levelWidth; y++ )
+      {
+	if( written == maxTiles )
+	  break;
+
+	if( (int) (tileRandom( z, x, y ) % 100) < holePercent )
+	{
+	  holes++;
+	  continue;
+	}
+
+	drawTile( rgb, z, x, y );
+
+	memset( &image, 0, sizeof( image ) );
+	image.version = PNG_IMAGE_VERSION;
+	image.width = TILE_SIZE;
+	image.height = TILE_SIZE;
+	image.format = PNG_FORMAT_RGB;
+
+	snprintf( path, sizeof( path ), "%s/%02d/%u/%u.png", argv[ optind ], z,
+		  x, y );
+	if( !png_image_write_to_file( &image, path, 0, rgb, 0, NULL ) )
+	{
+	  fprintf( stderr, "%s: %s\n", path, image.message );
+	  return 1;
+	}
+
+	if( stat( path, &st ) == 0 )
+	  bytes += st.st_size;
+	written++;
+      }
+    }
+  }
+
+  printf( "Wrote %d tiles (%d holes), zoom %d-%d, %llu bytes, %.0f bytes/tile, "
+	  "in %.1f s\n", written, holes, minZ, maxZ, bytes,
+	  written ? (double) bytes / written : 0.0, now() - start );
+
+  return 0;
+}
+
+static void usage( const char *program )
+{
+  fprintf( stderr, "usage: %s [-z <min>-<max>] [-x <x>] [-y <y>] [-w <tiles>] "
+	   "[-m <max tiles>] [-H <hole %%>] [-c <noise %%>] [-s <seed>] "
+	   "<output directory>\n", program );
+  exit( 1 );
+}
+
+static bool makeDirectory( const char *path )
+{
+  if( (mkdir( path, 0755 ) != 0) && (errno != EEXIST) )
+  {
+    perror( path );
+    return false;
+  }
+
+  return true;
+}
+
+/* A random number that depends only on the tile and the seed */
+static uint32_t tileRandom( int z, uint32_t x, uint32_t y )
+{
+  uint32_t state = seed ^ (z * 0x9e3779b9u) ^ (x * 0x85ebca6bu) ^
+    (y * 0xc2b2ae35u);
+
+  if( state == 0 )
+    state = 1;
+
+  nextRandom( &state );
+  return nextRandom( &state );
+}
+
+/* xorshift32 */
+static uint32_t nextRandom( uint32_t *state )
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+
+  return *state;
+}
+
+/* A flat color per tile, grid lines, and noisePercent noisy pixels */
+static void drawTile( unsigned char *rgb, int z, uint32_t x, uint32_t y )
+{
+  uint32_t state = tileRandom( z, x, y ) | 1, color = state;
+  unsigned char *pixel;
+  int i, j;
+
+  for( j = 0; j < TILE_SIZE; j++ )
+    for( i = 0; i < TILE_SIZE; i++ )
+    {
+      pixel = rgb + (j * TILE_SIZE + i) * 3;
+
+      if( (int) (nextRandom( &state ) % 100) < noisePercent )
+      {
+	pixel[0] = nextRandom( &state );
+	pixel[1] = nextRandom( &state );
+	pixel[2] = nextRandom( &state );
+      }
+      else if( ((i % GRID_STEP) == 0) || ((j % GRID_STEP) == 0) )
+	pixel[0] = pixel[1] = pixel[2] = 0;
+      else
+      {
+	pixel[0] = 128 + (color & 0x7f);
+	pixel[1] = 128 + ((color >> 8) & 0x7f);
+	pixel[2] = 128 + ((color >> 16) & 0x7f);
+      }
+    }
+}
+
+static double now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,404 @@
+/*
+   tileIndex.c
+
+   Each zoom level is stored either as a bitmap over the bounding box of its
+   tiles, or, if the tiles are so scattered that the bitmap would be larger,
+   as a sorted array of (x << 32 | y) keys.
+
+   Index file format (native byte order, it is a cache and not portable):
+
+     header        sIndexFileHeader
+     levels        levelCount times sIndexFileLevel followed by the bitmap
+                   bytes or the keys
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tileIndex.h"
+
+#define INDEX_FILE_MAGIC "PIGLTIDX"
+#define INDEX_FILE_VERSION 1
+
+typedef struct
+{
+  uint32_t count;       // 0 if the level has no tiles
+  sTileBounds bounds;
+  uint32_t width;       // of the bounds
+  uint8_t *bits;        // bit (y - minY) * width + (x - minX), or NULL
+  uint64_t *keys;       // sorted, if bits is NULL
+} sIndexLevel, *IndexLevel;
+
+typedef struct
+{
+  int z;
+  uint32_t x, y;
+} sIndexTile;
+
+typedef struct
+{
+  char magic[8];  // INDEX_FILE_MAGIC, not null terminated
+  uint32_t version;
+  uint32_t levelCount;
+  uint64_t stamp;
+} sIndexFileHeader;
+
+typedef struct
+{
+  uint32_t z, count;
+  sTileBounds bounds;
+  uint32_t isBitmap;
+  uint32_t pad;
+} sIndexFileLevel;
+
+/*
+ * static functions
+ */
+static void levelFree( IndexLevel level );
+static void levelAllocate( IndexLevel level, bool isBitmap );
+static uint64_t levelBitmapBytes( const sIndexLevel *level );
+static void levelSet( IndexLevel level, uint32_t x, uint32_t y );
+static int compareKeys( const void *k1, const void *k2 );
+
+/*
+ * Global data
+ */
+static sIndexLevel levels[ TILE_INDEX_ZOOMS ];
+static int tileCount;
+
+// tiles added since tileIndex_clear
+static sIndexTile *added;
+static int addedCount, addedCapacity;
+
+void tileIndex_clear( void )
+{
+  int z;
+
+  for( z = 0; z < TILE_INDEX_ZOOMS; z++ )
+    levelFree( &(levels[z]) );
+  tileCount = 0;
+  addedCount = 0;
+}
+
+void tileIndex_add( int z, uint32_t x, uint32_t y )
+{
+  if( (z < 0) || (z >= TILE_INDEX_ZOOMS) )
+    return;
+
+  if( addedCount == addedCapacity )
+  {
+    addedCapacity = (addedCapacity == 0) ? 4096 : addedCapacity * 2;
+    added = realloc( added, addedCapacity * sizeof( sIndexTile ) );
+    assert( added != NULL );
+  }
+
+  added[ addedCount ].z = z;
+  added[ addedCount ].x = x;
+  added[ addedCount ].y = y;
+  addedCount++;
+}
+
+void tileIndex_finish( void )
+{
+  IndexLevel level;
+  int i, z;
+
+  // bounds first, they decide the representation
+  for( i = 0; i < addedCount; i++ )
+  {
+    level = &(levels[ added[i].z ]);
+
+    if( level->count == 0 )
+    {
+      level->bounds.minX = level->bounds.maxX = added[i].x;
+      level->bounds.minY = level->bounds.maxY = added[i].y;
+    }
+    else
+    {
+      if( added[i].x < level->bounds.minX ) level->bounds.minX = added[i].x;
+      if( added[i].x > level->bounds.maxX ) level->bounds.maxX = added[i].x;
+      if( added[i].y < level->bounds.minY ) level->bounds.minY = added[i].y;
+      if( added[i].y > level->bounds.maxY ) level->bounds.maxY = added[i].y;
+    }
+    level->count++;
+  }
+
+  for( z = 0; z < TILE_INDEX_ZOOMS; z++ )
+  {
+    level = &(levels[z]);
+    if( level->count == 0 )
+      continue;
+
+    level->width = level->bounds.maxX - level->bounds.minX + 1;
+    levelAllocate( level, levelBitmapBytes( level ) <=
+		   (uint64_t) level->count * sizeof( uint64_t ) );
+    // counted again as the keys are filled in
+    level->count = 0;
+  }
+
+  for( i = 0; i < addedCount; i++ )
+    levelSet( &(levels[ added[i].z ]), added[i].x, added[i].y );
+
+  tileCount = 0;
+  for( z = 0; z < TILE_INDEX_ZOOMS; z++ )
+  {
+    level = &(levels[z]);
+
+    if( level->keys != NULL )
+    {
+      uint32_t from, to;
+
+      // drop duplicates
+      qsort( level->keys, level->count, sizeof( uint64_t ), compareKeys );
+      for( from = 0, to = 0; from < level->count; from++ )
+	if( (to == 0) || (level->keys[ from ] != level->keys[ to - 1 ]) )
+	  level->keys[ to++ ] = level->keys[ from ];
+      level->count = to;
+    }
+
+    tileCount += level->count;
+  }
+
+  free( added );
+  added = NULL;
+  addedCount = addedCapacity = 0;
+}
+
+Error tileIndex_load( const char *filename, uint64_t stamp )
+{
+  sIndexFileHeader header;
+  sIndexFileLevel fileLevel;
+  IndexLevel level;
+  size_t size;
+  uint32_t i;
+  FILE *file;
+
+  tileIndex_clear();
+
+  file = fopen( filename, "rb" );
+  if( file == NULL )
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not open tile index '%s'",
+		   filename );
+
+  if( (fread( &header, sizeof( header ), 1, file ) != 1) ||
+      (memcmp( header.magic, INDEX_FILE_MAGIC, sizeof( header.magic ) ) != 0) ||
+      (header.version != INDEX_FILE_VERSION) )
+    goto DAMAGED;
+
+  if( header.stamp != stamp )
+  {
+    fclose( file );
+    return ErrNew( ERR_APP, 0, NULL, "Tile index '%s' is out of date",
+		   filename );
+  }
+
+  for( i = 0; i < header.levelCount; i++ )
+  {
+    if( (fread( &fileLevel, sizeof( fileLevel ), 1, file ) != 1) ||
+	(fileLevel.z >= TILE_INDEX_ZOOMS) || (fileLevel.count == 0) ||
+	(fileLevel.bounds.maxX < fileLevel.bounds.minX) ||
+	(fileLevel.bounds.maxY < fileLevel.bounds.minY) )
+      goto DAMAGED;
+
+    level = &(levels[ fileLevel.z ]);
+    if( level->count != 0 )
+      goto DAMAGED;
+
+    level->count = fileLevel.count;
+    level->bounds = fileLevel.bounds;
+    level->width = level->bounds.maxX - level->bounds.minX + 1;
+    // bitmaps are only used where they are smaller than the keys
+    if( fileLevel.isBitmap &&
+	(levelBitmapBytes( level ) > (uint64_t) level->count * sizeof( uint64_t )) )
+      goto DAMAGED;
+    levelAllocate( level, fileLevel.isBitmap );
+
+    if( level->bits != NULL )
+      size = levelBitmapBytes( level );
+    else
+      size = (size_t) level->count * sizeof( uint64_t );
+
+    if( fread( (level->bits != NULL) ? (void *) level->bits :
+	       (void *) level->keys, 1, size, file ) != size )
+      goto DAMAGED;
+
+    tileCount += level->count;
+  }
+
+  fclose( file );
+  return NULL;
+
+ DAMAGED:
+  fclose( file );
+  tileIndex_clear();
+  return ErrNew( ERR_APP, 0, NULL, "Tile index '%s' is damaged", filename );
+}
+
+Error tileIndex_save( const char *filename, uint64_t stamp )
+{
+  sIndexFileHeader header;
+  sIndexFileLevel fileLevel;
+  const sIndexLevel *level;
+  size_t size;
+  bool ok;
+  FILE *file;
+  int z;
+
+  file = fopen( filename, "wb" );
+  if( file == NULL )
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not create tile index '%s'",
+		   filename );
+
+  memset( &header, 0, sizeof( header ) );
+  memcpy( header.magic, INDEX_FILE_MAGIC, sizeof( header.magic ) );
+  header.version = INDEX_FILE_VERSION;
+  header.stamp = stamp;
+  for( z = 0; z < TILE_INDEX_ZOOMS; z++ )
+    if( levels[z].count != 0 )
+      header.levelCount++;
+
+  ok = fwrite( &header, sizeof( header ), 1, file ) == 1;
+
+  for( z = 0; ok && (z < TILE_INDEX_ZOOMS); z++ )
+  {
+    level = &(levels[z]);
+    if( level->count == 0 )
+      continue;
+
+    memset( &fileLevel, 0, sizeof( fileLevel ) );
+    fileLevel.z = z;
+    fileLevel.count = level->count;
+    fileLevel.bounds = level->bounds;
+    fileLevel.isBitmap = level->bits != NULL;
+
+    if( level->bits != NULL )
+      size = levelBitmapBytes( level );
+    else
+      size = (size_t) level->count * sizeof( uint64_t );
+
+    ok = (fwrite( &fileLevel, sizeof( fileLevel ), 1, file ) == 1) &&
+      (fwrite( (level->bits != NULL) ? (void *) level->bits :
+	       (void *) level->keys, 1, size, file ) == size);
+  }
+
+  if( (fclose( file ) != 0) || !ok )
+  {
+    remove( filename );
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not write tile index '%s'",
+		   filename );
+  }
+
+  return NULL;
+}
+
+bool tileIndex_has( int z, uint32_t x, uint32_t y )
+{
+  const sIndexLevel *level;
+  uint64_t bit, key;
+
+  if( (z < 0) || (z >= TILE_INDEX_ZOOMS) )
+    return false;
+
+  level = &(levels[z]);
+  if( (level->count == 0) ||
+      (x < level->bounds.minX) || (x > level->bounds.maxX) ||
+      (y < level->bounds.minY) || (y > level->bounds.maxY) )
+    return false;
+
+  if( level->bits != NULL )
+  {
+    bit = (uint64_t) (y - level->bounds.minY) * level->width +
+      (x - level->bounds.minX);
+    return (level->bits[ bit >> 3 ] >> (bit & 7)) & 1;
+  }
+
+  key = ((uint64_t) x << 32) | y;
+  return bsearch( &key, level->keys, level->count, sizeof( uint64_t ),
+		  compareKeys ) != NULL;
+}
+
+int tileIndex_findAncestor( int z, uint32_t x, uint32_t y )
+{
+  int steps;
+
+  if( z >= TILE_INDEX_ZOOMS )
+    return -1;
+
+  for( steps = 0; steps <= z; steps++ )
+    if( tileIndex_has( z - steps, x >> steps, y >> steps ) )
+      return steps;
+
+  return -1;
+}
+
+bool tileIndex_getBounds( int z, TileBounds bounds )
+{
+  if( (z < 0) || (z >= TILE_INDEX_ZOOMS) || (levels[z].count == 0) )
+    return false;
+
+  *bounds = levels[z].bounds;
+  return true;
+}
+
+int tileIndex_count( void )
+{
+  return tileCount;
+}
+
+static void levelFree( IndexLevel level )
+{
+  free( level->bits );
+  free( level->keys );
+  memset( level, 0, sizeof( sIndexLevel ) );
+}
+
+/* count, bounds and width must be set */
+static void levelAllocate( IndexLevel level, bool isBitmap )
+{
+  if( isBitmap )
+  {
+    level->bits = calloc( 1, levelBitmapBytes( level ) );
+    assert( level->bits != NULL );
+  }
+  else
+  {
+    level->keys = malloc( (size_t) level->count * sizeof( uint64_t ) );
+    assert( level->keys != NULL );
+  }
+}
+
+static uint64_t levelBitmapBytes( const sIndexLevel *level )
+{
+  uint64_t height = level->bounds.maxY - level->bounds.minY + 1;
+
+  return (height * level->width + 7) / 8;
+}
+
+/* Used while building; keys are sorted by tileIndex_finish */
+static void levelSet( IndexLevel level, uint32_t x, uint32_t y )
+{
+  uint64_t bit;
+
+  if( level->bits != NULL )
+  {
+    bit = (uint64_t) (y - level->bounds.minY) * level->width +
+      (x - level->bounds.minX);
+    if( !((level->bits[ bit >> 3 ] >> (bit & 7)) & 1) )
+    {
+      level->bits[ bit >> 3 ] |= 1 << (bit & 7);
+      level->count++;
+    }
+  }
+  else
+    level->keys[ level->count++ ] = ((uint64_t) x << 32) | y;
+}
+
+static int compareKeys( const void *k1, const void *k2 )
+{
+  uint64_t key1 = *(const uint64_t *) k1, key2 = *(const uint64_t *) k2;
+
+  return (key1 < key2) ? -1 : (key1 > key2);
+}
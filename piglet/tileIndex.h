@@ -0,0 +1,44 @@
+/*
+   tileIndex.h
+
+   Which tiles the chart set has, per zoom level, so that missing tiles can
+   be resolved without asking the file system. Built by tileSource when the
+   chart set is opened, and read only after that.
+*/
+
+#ifndef TILE_INDEX_H
+#define TILE_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <voxi/util/err.h>
+
+/* zoom levels 0 to TILE_INDEX_ZOOMS - 1 */
+#define TILE_INDEX_ZOOMS 30
+
+/* inclusive tile coordinates */
+typedef struct
+{
+  uint32_t minX, minY, maxX, maxY;
+} sTileBounds, *TileBounds;
+
+/* Building: clear, add every tile, then finish */
+void tileIndex_clear( void );
+void tileIndex_add( int z, uint32_t x, uint32_t y );
+void tileIndex_finish( void );
+
+/* stamp identifies the state of the chart set the index was built from. Load
+   fails if the file is missing, damaged or has another stamp. */
+Error tileIndex_load( const char *filename, uint64_t stamp );
+Error tileIndex_save( const char *filename, uint64_t stamp );
+
+bool tileIndex_has( int z, uint32_t x, uint32_t y );
+/* Number of levels up to the nearest tile that exists, 0 for the tile
+   itself, or -1 if neither it nor any ancestor exists */
+int tileIndex_findAncestor( int z, uint32_t x, uint32_t y );
+/* Returns false if there are no tiles at zoom level z */
+bool tileIndex_getBounds( int z, TileBounds bounds );
+int tileIndex_count( void );
+
+#endif
@@ -0,0 +1,253 @@
+/*
+   tileMap.c
+
+   Each shard is an open addressing table with linear probing, kept at most
+   70% full by doubling. Removal shifts the following entries of the probe
+   run back, so no tombstones are needed. The shard is chosen from the top
+   bits of the key's hash and the slot from the low bits, so neighbouring
+   tiles are spread over both.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <voxi/util/threading.h>
+
+#include "tileMap.h"
+
+#define SHARD_BITS 4
+#define SHARD_COUNT (1 << SHARD_BITS)
+
+typedef struct
+{
+  sVoxiMutex mutex;
+  TileKey *keys;
+  void **values;   // NULL for empty slots
+  uint32_t capacity;  // power of two
+  uint32_t count;
+} __attribute__(( aligned( 64 ) )) sTileMapShard, *TileMapShard;
+
+typedef struct sTileMap
+{
+  sTileMapShard shards[ SHARD_COUNT ];
+} sTileMap;
+
+/*
+ * static functions
+ */
+static uint64_t hashKey( TileKey key );
+static TileMapShard shardOf( TileMap map, uint64_t hash );
+static void shardAlloc( TileMapShard shard, uint32_t capacity );
+static void shardGrow( TileMapShard shard );
+static bool shardFindSlot( const sTileMapShard *shard, TileKey key,
+			   uint64_t hash, uint32_t *slot );
+
+TileMap tileMap_create( int initialCapacity )
+{
+  TileMap map;
+  uint32_t shardCapacity = 16;
+  int i;
+
+  while( shardCapacity * SHARD_COUNT < initialCapacity )
+    shardCapacity *= 2;
+
+  map = malloc( sizeof( sTileMap ) );
+  assert( map != NULL );
+
+  for( i = 0; i < SHARD_COUNT; i++ )
+  {
+    threading_mutex_init( &(map->shards[i].mutex) );
+    threading_mutex_setDebug( &(map->shards[i].mutex), false );
+    shardAlloc( &(map->shards[i]), shardCapacity );
+  }
+
+  return map;
+}
+
+void tileMap_destroy( TileMap map )
+{
+  int i;
+
+  for( i = 0; i < SHARD_COUNT; i++ )
+  {
+    free( map->shards[i].keys );
+    free( map->shards[i].values );
+  }
+  free( map );
+}
+
+void *tileMap_find( TileMap map, TileKey key, TileMapVisitor visitor )
+{
+  uint64_t hash = hashKey( key );
+  TileMapShard shard = shardOf( map, hash );
+  void *value = NULL;
+  uint32_t slot;
+
+  threading_mutex_lock( &(shard->mutex) );
+
+  if( shardFindSlot( shard, key, hash, &slot ) )
+  {
+    value = shard->values[ slot ];
+    if( visitor != NULL )
+      visitor( value );
+  }
+
+  threading_mutex_unlock( &(shard->mutex) );
+
+  return value;
+}
+
+void *tileMap_insert( TileMap map, TileKey key, void *value )
+{
+  uint64_t hash = hashKey( key );
+  TileMapShard shard = shardOf( map, hash );
+  uint32_t slot;
+
+  assert( value != NULL );
+
+  threading_mutex_lock( &(shard->mutex) );
+
+  if( shardFindSlot( shard, key, hash, &slot ) )
+    value = shard->values[ slot ];
+  else
+  {
+    if( (shard->count + 1) * 10 > shard->capacity * 7 )
+    {
+      shardGrow( shard );
+      shardFindSlot( shard, key, hash, &slot );
+    }
+
+    shard->keys[ slot ] = key;
+    shard->values[ slot ] = value;
+    shard->count++;
+  }
+
+  threading_mutex_unlock( &(shard->mutex) );
+
+  return value;
+}
+
+bool tileMap_remove( TileMap map, TileKey key, TileMapPredicate predicate )
+{
+  uint64_t hash = hashKey( key );
+  TileMapShard shard = shardOf( map, hash );
+  uint32_t mask, hole, next, home;
+  bool removed = false;
+
+  threading_mutex_lock( &(shard->mutex) );
+
+  if( shardFindSlot( shard, key, hash, &hole ) &&
+      ((predicate == NULL) || predicate( shard->values[ hole ] )) )
+  {
+    mask = shard->capacity - 1;
+
+    // shift back entries that are displaced past the hole
+    for( next = (hole + 1) & mask; shard->values[ next ] != NULL;
+	 next = (next + 1) & mask )
+    {
+      home = hashKey( shard->keys[ next ] ) & mask;
+
+      // entry stays if its home slot is cyclically within (hole, next]
+      if( (hole < next) ? ((home > hole) && (home <= next)) :
+	  ((home > hole) || (home <= next)) )
+	continue;
+
+      shard->keys[ hole ] = shard->keys[ next ];
+      shard->values[ hole ] = shard->values[ next ];
+      hole = next;
+    }
+
+    shard->values[ hole ] = NULL;
+    shard->count--;
+    removed = true;
+  }
+
+  threading_mutex_unlock( &(shard->mutex) );
+
+  return removed;
+}
+
+int tileMap_count( TileMap map )
+{
+  int i, count = 0;
+
+  for( i = 0; i < SHARD_COUNT; i++ )
+  {
+    threading_mutex_lock( &(map->shards[i].mutex) );
+    count += map->shards[i].count;
+    threading_mutex_unlock( &(map->shards[i].mutex) );
+  }
+
+  return count;
+}
+
+/* the splitmix64 finalizer; neighbouring keys differ in few bits */
+static uint64_t hashKey( TileKey key )
+{
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+
+  return key;
+}
+
+static TileMapShard shardOf( TileMap map, uint64_t hash )
+{
+  return &(map->shards[ hash >> (64 - SHARD_BITS) ]);
+}
+
+static void shardAlloc( TileMapShard shard, uint32_t capacity )
+{
+  shard->keys = malloc( capacity * sizeof( TileKey ) );
+  shard->values = calloc( capacity, sizeof( void * ) );
+  assert( (shard->keys != NULL) && (shard->values != NULL) );
+
+  shard->capacity = capacity;
+  shard->count = 0;
+}
+
+/* Must be called with the shard locked */
+static void shardGrow( TileMapShard shard )
+{
+  TileKey *oldKeys = shard->keys;
+  void **oldValues = shard->values;
+  uint32_t oldCapacity = shard->capacity;
+  uint32_t i, slot;
+
+  shardAlloc( shard, oldCapacity * 2 );
+
+  for( i = 0; i < oldCapacity; i++ )
+    if( oldValues[i] != NULL )
+    {
+      shardFindSlot( shard, oldKeys[i], hashKey( oldKeys[i] ), &slot );
+      shard->keys[ slot ] = oldKeys[i];
+      shard->values[ slot ] = oldValues[i];
+      shard->count++;
+    }
+
+  free( oldKeys );
+  free( oldValues );
+}
+
+/*
+ * Returns true and the key's slot if the key is in the shard, otherwise
+ * false and the empty slot where it would be inserted.
+ */
+static bool shardFindSlot( const sTileMapShard *shard, TileKey key,
+			   uint64_t hash, uint32_t *slot )
+{
+  uint32_t mask = shard->capacity - 1;
+  uint32_t i;
+
+  for( i = hash & mask; shard->values[i] != NULL; i = (i + 1) & mask )
+    if( shard->keys[i] == key )
+    {
+      *slot = i;
+      return true;
+    }
+
+  *slot = i;
+  return false;
+}
@@ -0,0 +1,47 @@
+/*
+   tileMap.h
+
+   Concurrent hash map from tile keys to pointers. The map is split in
+   shards, each an open addressing table with its own mutex, so lookups from
+   the render thread and the loader threads rarely contend.
+*/
+
+#ifndef TILE_MAP_H
+#define TILE_MAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* z in the top 6 bits, then 29 bits each of x and y. Coordinates outside
+   0..2^29-1 (e.g. the neighbour to the left of x = 0) are masked, and can
+   only collide with other coordinates that are outside the map. */
+typedef uint64_t TileKey;
+
+#define TILE_KEY_COORD_BITS 29
+#define TILE_KEY_COORD_MASK ((((uint64_t) 1) << TILE_KEY_COORD_BITS) - 1)
+
+static inline TileKey tileKey_make( int z, uint32_t x, uint32_t y )
+{
+  return (((uint64_t) z) << (2 * TILE_KEY_COORD_BITS)) |
+    ((x & TILE_KEY_COORD_MASK) << TILE_KEY_COORD_BITS) |
+    (y & TILE_KEY_COORD_MASK);
+}
+
+typedef struct sTileMap *TileMap;
+
+/* Called with the key's shard locked */
+typedef void (*TileMapVisitor)( void *value );
+typedef bool (*TileMapPredicate)( void *value );
+
+TileMap tileMap_create( int initialCapacity );
+void tileMap_destroy( TileMap map );
+/* If visitor is not NULL, it is called on the value before the shard is
+   unlocked */
+void *tileMap_find( TileMap map, TileKey key, TileMapVisitor visitor );
+/* Returns the value already in the map if there is one, else value */
+void *tileMap_insert( TileMap map, TileKey key, void *value );
+/* Removes the key if predicate is NULL or returns true for its value */
+bool tileMap_remove( TileMap map, TileKey key, TileMapPredicate predicate );
+int tileMap_count( TileMap map );
+
+#endif
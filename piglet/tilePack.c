@@ -0,0 +1,256 @@
+/*
+ *  tilePack.c
+ *
+ * Packs a TMS tile directory tree (<dir>/<zz>/<x>/<y>.png, .jpg, or .pkm
+ * as written by tileEtc) into a single tile archive, see tileArchive.h.
+ *
+ * usage: tilePack <tile directory> <archive>
+ */
+
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tileArchive.h"
+
+typedef struct
+{
+  sTileArchiveEntry entry;
+  char *filename;
+} sPackEntry, *PackEntry;
+
+/*
+ * Local function prototypes
+ */
+static bool parseNumber( const char *name, const char *suffix,
+			 uint32_t *number );
+static void addEntry( const char *filename, uint32_t z, uint32_t x, uint32_t y,
+		      size_t size );
+static int comparePackEntries( const void *e1, const void *e2 );
+static uint64_t alignUp( uint64_t offset );
+static bool copyFile( const char *filename, FILE *out, size_t size );
+
+/*
+ * static data
+ */
+static PackEntry entries;
+static int entryCount, entryCapacity;
+
+/*
+ * Start of code
+ */
+int main( int argc, char **argv )
+{
+  DIR *zDir, *xDir, *yDir;
+  struct dirent *zEnt, *xEnt, *yEnt;
+  char path[ 1024 ];
+  sTileArchiveHeader header;
+  uint64_t offset;
+  FILE *out;
+  int i;
+
+  if( argc != 3 )
+  {
+    fprintf( stderr, "usage: %s <tile directory> <archive>\n", argv[0] );
+    return 1;
+  }
+
+  zDir = opendir( argv[1] );
+  if( zDir == NULL )
+  {
+    perror( argv[1] );
+    return 1;
+  }
+
+  while( (zEnt = readdir( zDir )) != NULL )
+  {
+    uint32_t z;
+
+    if( !parseNumber( zEnt->d_name, "", &z ) )
+      continue;
+
+    snprintf( path, sizeof( path ), "%s/%s", argv[1], zEnt->d_name );
+    xDir = opendir( path );
+    if( xDir == NULL )
+      continue;
+
+    while( (xEnt = readdir( xDir )) != NULL )
+    {
+      uint32_t x;
+
+      if( !parseNumber( xEnt->d_name, "", &x ) )
+	continue;
+
+      snprintf( path, sizeof( path ), "%s/%s/%s", argv[1], zEnt->d_name,
+		xEnt->d_name );
+      yDir = opendir( path );
+      if( yDir == NULL )
+	continue;
+
+      while( (yEnt = readdir( yDir )) != NULL )
+      {
+	uint32_t y;
+	struct stat st;
+
+	if( !parseNumber( yEnt->d_name, ".png", &y ) &&
+	    !parseNumber( yEnt->d_name, ".jpg", &y ) &&
+	    !parseNumber( yEnt->d_name, ".pkm", &y ) )
+	  continue;
+
+	snprintf( path, sizeof( path ), "%s/%s/%s/%s", argv[1], zEnt->d_name,
+		  xEnt->d_name, yEnt->d_name );
+	if( (stat( path, &st ) != 0) || !S_ISREG( st.st_mode ) ||
+	    (st.st_size == 0) )
+	  continue;
+
+	addEntry( path, z, x, y, st.st_size );
+      }
+      closedir( yDir );
+    }
+    closedir( xDir );
+  }
+  closedir( zDir );
+
+  qsort( entries, entryCount, sizeof( sPackEntry ), comparePackEntries );
+
+  // lay out the tiles after the index, in index order
+  memset( &header, 0, sizeof( header ) );
+  memcpy( header.magic, TILE_ARCHIVE_MAGIC, sizeof( header.magic ) );
+  header.version = TILE_ARCHIVE_VERSION;
+  header.entryCount = entryCount;
+  header.indexOffset = sizeof( header );
+
+  offset = alignUp( header.indexOffset +
+		    (uint64_t) entryCount * sizeof( sTileArchiveEntry ) );
+  for( i = 0; i < entryCount; i++ )
+  {
+    entries[i].entry.offset = offset;
+    offset = alignUp( offset + entries[i].entry.size );
+  }
+
+  out = fopen( argv[2], "wb" );
+  if( out == NULL )
+  {
+    perror( argv[2] );
+    return 1;
+  }
+
+  fwrite( &header, sizeof( header ), 1, out );
+  for( i = 0; i < entryCount; i++ )
+    fwrite( &(entries[i].entry), sizeof( sTileArchiveEntry ), 1, out );
+
+  for( i = 0; i < entryCount; i++ )
+  {
+    // pad up to the tile's page
+    if( fseeko( out, entries[i].entry.offset, SEEK_SET ) != 0 )
+    {
+      perror( argv[2] );
+      return 1;
+    }
+
+    if( !copyFile( entries[i].filename, out, entries[i].entry.size ) )
+      return 1;
+  }
+
+  // the last tile's page is padded too
+  if( (ftruncate( fileno( out ), offset ) != 0) || (fclose( out ) != 0) )
+  {
+    perror( argv[2] );
+    return 1;
+  }
+
+  printf( "Packed %d tiles, %llu bytes\n", entryCount,
+	  (unsigned long long) offset );
+
+  return 0;
+}
+
+/* Parses names like "17" or "12345.png" */
+static bool parseNumber( const char *name, const char *suffix,
+			 uint32_t *number )
+{
+  const char *p;
+
+  if( !isdigit( (unsigned char) name[0] ) )
+    return false;
+
+  for( p = name; isdigit( (unsigned char) *p ); p++ )
+    ;
+
+  if( strcmp( p, suffix ) != 0 )
+    return false;
+
+  *number = strtoul( name, NULL, 10 );
+  return true;
+}
+
+static void addEntry( const char *filename, uint32_t z, uint32_t x, uint32_t y,
+		      size_t size )
+{
+  PackEntry entry;
+
+  if( entryCount == entryCapacity )
+  {
+    entryCapacity = (entryCapacity == 0) ? 1024 : entryCapacity * 2;
+    entries = realloc( entries, entryCapacity * sizeof( sPackEntry ) );
+    assert( entries != NULL );
+  }
+
+  entry = &(entries[ entryCount++ ]);
+  entry->entry.z = z;
+  entry->entry.x = x;
+  entry->entry.y = y;
+  entry->entry.size = size;
+  entry->entry.offset = 0;
+  entry->filename = strdup( filename );
+  assert( entry->filename != NULL );
+}
+
+static int comparePackEntries( const void *e1, const void *e2 )
+{
+  return tileArchive_compare( &(((const sPackEntry *) e1)->entry),
+			      &(((const sPackEntry *) e2)->entry) );
+}
+
+static uint64_t alignUp( uint64_t offset )
+{
+  return (offset + TILE_ARCHIVE_ALIGN - 1) & ~((uint64_t) TILE_ARCHIVE_ALIGN - 1);
+}
+
+static bool copyFile( const char *filename, FILE *out, size_t size )
+{
+  char buffer[ 64 * 1024 ];
+  size_t count;
+  FILE *in;
+
+  in = fopen( filename, "rb" );
+  if( in == NULL )
+  {
+    perror( filename );
+    return false;
+  }
+
+  while( size > 0 )
+  {
+    count = fread( buffer, 1, (size < sizeof( buffer )) ? size : sizeof( buffer ),
+		   in );
+    if( count == 0 )
+    {
+      fprintf( stderr, "%s: short read\n", filename );
+      fclose( in );
+      return false;
+    }
+
+    fwrite( buffer, 1, count, out );
+    size -= count;
+  }
+
+  fclose( in );
+  return true;
+}
@@ -0,0 +1,177 @@
+/*
+   tilePrefetch.c
+
+   The plan lists, in order: the levels above the view, which are few and
+   are also drawn while better tiles load; the ring next to the view; the
+   tiles the view will move onto along the boat's track, soonest first; the
+   levels below the view; and the outer rings.
+*/
+
+#include <math.h>
+#include <stdbool.h>
+
+#include "tilePrefetch.h"
+
+/* slower than this, the view is considered to stand still */
+#define PREFETCH_MIN_KNOTS 0.5
+
+typedef struct
+{
+  PrefetchTile tiles;
+  int count, maxTiles;
+} sPlan, *Plan;
+
+const sPrefetchPolicy tilePrefetch_defaultPolicy = {
+  .ringRadius = 1,
+  .levelsUp = 1,
+  .levelsDown = 1,
+  .trackSeconds = 120,
+  .maxTiles = 160,
+  .frameBudget = 8
+};
+
+/*
+ * static functions
+ */
+static void planRect( Plan plan, int z, int64_t minX, int64_t minY,
+		      int64_t maxX, int64_t maxY, const sTileBounds *except );
+static void planRing( Plan plan, int z, const sTileBounds *view, int radius );
+static void planTrack( Plan plan, int z, const sTileBounds *view,
+		       float trackSeconds, float course, float speed );
+
+int tilePrefetch_plan( const sPrefetchPolicy *policy, int z,
+		       const sTileBounds *view, float course, float speed,
+		       PrefetchTile tiles, int maxTiles )
+{
+  sPlan plan;
+  int level, radius;
+
+  plan.tiles = tiles;
+  plan.count = 0;
+  plan.maxTiles = (policy->maxTiles < maxTiles) ? policy->maxTiles : maxTiles;
+
+  for( level = 1; (level <= policy->levelsUp) && (level <= z); level++ )
+    planRect( &plan, z - level, view->minX >> level, view->minY >> level,
+	      view->maxX >> level, view->maxY >> level, NULL );
+
+  if( policy->ringRadius >= 1 )
+    planRing( &plan, z, view, 1 );
+
+  if( (policy->trackSeconds > 0) && (speed >= PREFETCH_MIN_KNOTS) )
+    planTrack( &plan, z, view, policy->trackSeconds, course, speed );
+
+  for( level = 1; (level <= policy->levelsDown) &&
+	 (z + level < TILE_INDEX_ZOOMS); level++ )
+    planRect( &plan, z + level, (int64_t) view->minX << level,
+	      (int64_t) view->minY << level,
+	      (((int64_t) view->maxX + 1) << level) - 1,
+	      (((int64_t) view->maxY + 1) << level) - 1, NULL );
+
+  for( radius = 2; radius <= policy->ringRadius; radius++ )
+    planRing( &plan, z, view, radius );
+
+  return plan.count;
+}
+
+/* Adds the tiles of the rectangle that are on the map and not in except */
+static void planRect( Plan plan, int z, int64_t minX, int64_t minY,
+		      int64_t maxX, int64_t maxY, const sTileBounds *except )
+{
+  int64_t x, y, tilesPerSide = (int64_t) 1 << z;
+
+  for( y = minY; y <= maxY; y++ )
+    for( x = minX; x <= maxX; x++ )
+    {
+      if( (x < 0) || (y < 0) || (x >= tilesPerSide) || (y >= tilesPerSide) )
+	continue;
+      if( (except != NULL) && (x >= except->minX) && (x <= except->maxX) &&
+	  (y >= except->minY) && (y <= except->maxY) )
+	continue;
+      if( plan->count == plan->maxTiles )
+	return;
+
+      plan->tiles[ plan->count ].z = z;
+      plan->tiles[ plan->count ].x = x;
+      plan->tiles[ plan->count ].y = y;
+      plan->count++;
+    }
+}
+
+/* the tiles radius tiles out from the view, and no closer */
+static void planRing( Plan plan, int z, const sTileBounds *view, int radius )
+{
+  sTileBounds inner;
+
+  // one less than the ring, clamped to the map since bounds are unsigned
+  inner.minX = (view->minX >= radius - 1) ? view->minX - (radius - 1) : 0;
+  inner.minY = (view->minY >= radius - 1) ? view->minY - (radius - 1) : 0;
+  inner.maxX = view->maxX + (radius - 1);
+  inner.maxY = view->maxY + (radius - 1);
+
+  planRect( plan, z, (int64_t) view->minX - radius,
+	    (int64_t) view->minY - radius, (int64_t) view->maxX + radius,
+	    (int64_t) view->maxY + radius, &inner );
+}
+
+/*
+ * The tiles the view will scroll onto if the boat keeps its course and
+ * speed. The view is moved along the track half a tile at a time, and the
+ * tiles it covers at each step that it didn't cover at the step before are
+ * added, so the tiles that will be visible soonest come first.
+ */
+static void planTrack( Plan plan, int z, const sTileBounds *view,
+		       float trackSeconds, float course, float speed )
+{
+  double tileSize, latitude, tilesPerSecond, radians, stepSeconds, t;
+  double dx, dy;
+  sTileBounds previous, moved;
+  int64_t minX, minY, maxX, maxY, tilesPerSide = (int64_t) 1 << z;
+  bool lastStep;
+
+  // meters per tile at the latitude of the view's center. TMS y counts up
+  // from the south.
+  latitude = atan( sinh( M_PI * ((view->minY + view->maxY + 1.0) /
+				 tilesPerSide - 1.0) ) );
+  tileSize = 40075016.686 * cos( latitude ) / tilesPerSide;
+
+  // tiles per second east and north
+  tilesPerSecond = speed * 1852.0 / 3600.0 / tileSize;
+  radians = course * M_PI / 180.0;
+  dx = sin( radians ) * tilesPerSecond;
+  dy = cos( radians ) * tilesPerSecond;
+
+  previous = *view;
+
+  // the view's edges may be anywhere in the edge tiles, so the tiles next to
+  // them are needed as soon as the view moves at all
+  stepSeconds = 0.5 / tilesPerSecond;
+  for( t = 0, lastStep = false; !lastStep && (plan->count < plan->maxTiles); )
+  {
+    t += stepSeconds;
+    if( t >= trackSeconds )
+    {
+      t = trackSeconds;
+      lastStep = true;
+    }
+
+    // the visible tiles cover at least the view, so the moved view's tiles
+    // are those touched by the moved bounds
+    minX = floor( view->minX + dx * t );
+    maxX = ceil( view->maxX + 1 + dx * t ) - 1;
+    minY = floor( view->minY + dy * t );
+    maxY = ceil( view->maxY + 1 + dy * t ) - 1;
+
+    planRect( plan, z, minX, minY, maxX, maxY, &previous );
+
+    // off the map, the moved bounds no longer matter
+    if( (minX < 0) || (minY < 0) || (maxX >= tilesPerSide) ||
+	(maxY >= tilesPerSide) )
+      break;
+
+    moved.minX = minX;
+    moved.minY = minY;
+    moved.maxX = maxX;
+    moved.maxY = maxY;
+    previous = moved;
+  }
+}
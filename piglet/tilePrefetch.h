@@ -0,0 +1,44 @@
+/*
+   tilePrefetch.h
+
+   Which tiles to load before they are visible. A policy tells how far
+   around, above, below and ahead of the view to look, and how many tiles
+   may be requested; tilePrefetch_plan turns the view into a list of tiles,
+   the most likely needed first. tileTexture requests them a few per frame.
+*/
+
+#ifndef TILE_PREFETCH_H
+#define TILE_PREFETCH_H
+
+#include <stdint.h>
+
+#include "tileIndex.h"
+
+typedef struct
+{
+  int ringRadius;      // rings of tiles around the view, at its zoom level
+  int levelsUp;        // zoom levels above the view, for zooming out
+  int levelsDown;      // zoom levels below the view, for zooming in
+  float trackSeconds;  // how far ahead along the boat's track, 0 for none
+  int maxTiles;        // tiles planned per view
+  int frameBudget;     // new tiles requested per frame
+} sPrefetchPolicy, *PrefetchPolicy;
+
+typedef struct
+{
+  int z;
+  uint32_t x, y;
+} sPrefetchTile, *PrefetchTile;
+
+/* One ring, one level up and down and two minutes ahead */
+extern const sPrefetchPolicy tilePrefetch_defaultPolicy;
+
+/* Fills tiles with up to maxTiles tiles to prefetch for the view (the
+   visible tiles at zoom level z) and the boat's course (degrees true) and
+   speed (knots), and returns how many. Tiles of the view are left out;
+   the same tile may be listed more than once. */
+int tilePrefetch_plan( const sPrefetchPolicy *policy, int z,
+		       const sTileBounds *view, float course, float speed,
+		       PrefetchTile tiles, int maxTiles );
+
+#endif
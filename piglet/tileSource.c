@@ -0,0 +1,421 @@
+/*
+   tileSource.c
+
+   Tiles are read either from a TMS directory tree, <path>/<zz>/<x>/<y>.png,
+   or from a packed archive written by tilePack (see tileArchive.h). Tiles
+   may also be JPEG (.jpg), or ETC1 .pkm files made by tileEtc.
+
+   Tile data is mapped read only instead of being read into a malloced
+   buffer, which saves a copy and a syscall per read, and leaves the pages
+   in the page cache where the kernel can reclaim them.
+
+   In a directory tree, each tile file is mapped on its own. An archive is
+   mapped as a whole and tiles are found by binary search in its index. If
+   the archive does not fit in the address space (large chart sets on a 32
+   bit Pi), only the index is mapped, and each tile is mapped on its own
+   from its page aligned offset.
+
+   Which tiles exist is kept in the tile index, so requests for missing
+   tiles never reach the file system. An archive's index is built from the
+   archive's own index. A directory tree is walked once and its index saved
+   in TILE_INDEX_FILE in the tree, stamped with the modification times of
+   the zoom and x directories, which change whenever a tile is added or
+   removed.
+*/
+
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tileArchive.h"
+#include "tileIndex.h"
+#include "tileSource.h"
+
+#define TILE_INDEX_FILE "tileIndex.bin"
+
+/*
+ * static functions
+ */
+static Error openArchive( const char *path, size_t size );
+static void openDirectoryIndex( const char *path );
+static uint64_t walkDirectory( const char *path, bool addTiles );
+static bool parseNumber( const char *name, const char *suffix,
+			 uint32_t *number );
+static bool mapFromDirectory( int z, uint32_t x, uint32_t y, TileBlob blob );
+static bool mapFromArchive( int z, uint32_t x, uint32_t y, TileBlob blob );
+static bool mapRange( int fd, off_t offset, size_t size, TileBlob blob );
+static bool mapFile( const char *filename, TileBlob blob );
+
+/*
+ * Global data
+ */
+static char *tilePath;
+static bool isArchive;
+/* the file suffixes a directory tree's tiles may have. The one found last
+   is tried first. */
+#define TILE_SUFFIXES 3
+static const char *tileSuffixes[ TILE_SUFFIXES ] = { ".png", ".pkm", ".jpg" };
+static int lastSuffix;
+
+static int archiveFD;
+static const unsigned char *archiveMap;  // whole archive, or NULL
+static size_t archiveSize;
+static int64_t archiveMtime;
+static const sTileArchiveEntry *archiveIndex;
+static uint32_t archiveEntryCount;
+
+Error tileSource_open( const char *path )
+{
+  struct stat st;
+
+  if( stat( path, &st ) != 0 )
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not open tile source '%s'",
+		   path );
+
+  tilePath = strdup( path );
+  assert( tilePath != NULL );
+
+  if( S_ISDIR( st.st_mode ) )
+  {
+    isArchive = false;
+    openDirectoryIndex( path );
+    return NULL;
+  }
+
+  isArchive = true;
+  archiveMtime = st.st_mtime;
+  return openArchive( path, st.st_size );
+}
+
+bool tileSource_isArchive( void )
+{
+  return isArchive;
+}
+
+bool tileSource_map( int z, uint32_t x, uint32_t y, TileBlob blob )
+{
+  if( !tileIndex_has( z, x, y ) )
+    return false;
+
+  if( isArchive )
+    return mapFromArchive( z, x, y, blob );
+  else
+    return mapFromDirectory( z, x, y, blob );
+}
+
+void tileSource_release( TileBlob blob )
+{
+  if( blob->mapBase != NULL )
+    munmap( blob->mapBase, blob->mapLength );
+
+  blob->data = NULL;
+  blob->size = 0;
+  blob->mtime = 0;
+  blob->mapBase = NULL;
+  blob->mapLength = 0;
+}
+
+static Error openArchive( const char *path, size_t size )
+{
+  sTileArchiveHeader header;
+  size_t indexEnd;
+  uint32_t i;
+  void *map;
+  Error error;
+
+  archiveFD = open( path, O_RDONLY );
+  if( archiveFD == -1 )
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not open tile archive '%s'",
+		   path );
+
+  archiveSize = size;
+
+  if( (pread( archiveFD, &header, sizeof( header ), 0 ) != sizeof( header )) ||
+      (memcmp( header.magic, TILE_ARCHIVE_MAGIC, sizeof( header.magic ) ) != 0) )
+  {
+    error = ErrNew( ERR_APP, 0, NULL, "'%s' is not a tile archive", path );
+    goto FAIL;
+  }
+
+  if( header.version != TILE_ARCHIVE_VERSION )
+  {
+    error = ErrNew( ERR_APP, 0, NULL, "'%s' has unsupported version %d", path,
+		    header.version );
+    goto FAIL;
+  }
+
+  indexEnd = header.indexOffset +
+    (size_t) header.entryCount * sizeof( sTileArchiveEntry );
+  if( indexEnd > size )
+  {
+    error = ErrNew( ERR_APP, 0, NULL, "'%s' is truncated", path );
+    goto FAIL;
+  }
+
+  archiveEntryCount = header.entryCount;
+
+  map = mmap( NULL, size, PROT_READ, MAP_SHARED, archiveFD, 0 );
+  if( map != MAP_FAILED )
+  {
+    archiveMap = map;
+    // tiles are looked up all over the archive
+    madvise( map, size, MADV_RANDOM );
+  }
+  else
+  {
+    // doesn't fit in the address space. Map the index only.
+    map = mmap( NULL, indexEnd, PROT_READ, MAP_SHARED, archiveFD, 0 );
+    if( map == MAP_FAILED )
+    {
+      error = ErrNew( ERR_ERRNO, errno, NULL, "Could not map '%s'", path );
+      goto FAIL;
+    }
+    archiveMap = NULL;
+  }
+
+  archiveIndex = (const sTileArchiveEntry *)
+    ((const unsigned char *) map + header.indexOffset);
+
+  tileIndex_clear();
+  for( i = 0; i < archiveEntryCount; i++ )
+    tileIndex_add( archiveIndex[i].z, archiveIndex[i].x, archiveIndex[i].y );
+  tileIndex_finish();
+
+  return NULL;
+
+ FAIL:
+  close( archiveFD );
+  archiveFD = -1;
+  return error;
+}
+
+/* Loads the directory's tile index, or builds and saves it if it is stale */
+static void openDirectoryIndex( const char *path )
+{
+  char filename[ 1024 ];
+  uint64_t stamp;
+  Error error;
+
+  snprintf( filename, sizeof( filename ), "%s/%s", path, TILE_INDEX_FILE );
+
+  stamp = walkDirectory( path, false );
+  error = tileIndex_load( filename, stamp );
+  if( error == NULL )
+    return;
+  ErrDispose( error, true );
+
+  printf( "Indexing tiles in %s\n", path );
+  tileIndex_clear();
+  walkDirectory( path, true );
+  tileIndex_finish();
+
+  // the index still works if it can't be saved, e.g. on read only media
+  error = tileIndex_save( filename, stamp );
+  if( error != NULL )
+  {
+    ErrReport( error );
+    ErrDispose( error, true );
+  }
+}
+
+/*
+ * Returns a stamp of the zoom and x directories' modification times. If
+ * addTiles is set, every tile found is added to the tile index.
+ */
+static uint64_t walkDirectory( const char *path, bool addTiles )
+{
+  DIR *zDir, *xDir, *yDir;
+  struct dirent *zEnt, *xEnt, *yEnt;
+  char dirPath[ 1024 ];
+  struct stat st;
+  uint64_t stamp = 0;
+  uint32_t z, x, y;
+  int i;
+
+  zDir = opendir( path );
+  if( zDir == NULL )
+    return 0;
+
+  while( (zEnt = readdir( zDir )) != NULL )
+  {
+    if( !parseNumber( zEnt->d_name, "", &z ) )
+      continue;
+
+    snprintf( dirPath, sizeof( dirPath ), "%s/%s", path, zEnt->d_name );
+    xDir = opendir( dirPath );
+    if( xDir == NULL )
+      continue;
+
+    // summed, since readdir order is arbitrary
+    if( stat( dirPath, &st ) == 0 )
+      stamp += (uint64_t) st.st_mtime * 1000003 + st.st_ino;
+
+    while( (xEnt = readdir( xDir )) != NULL )
+    {
+      if( !parseNumber( xEnt->d_name, "", &x ) )
+	continue;
+
+      snprintf( dirPath, sizeof( dirPath ), "%s/%s/%s", path, zEnt->d_name,
+		xEnt->d_name );
+      if( stat( dirPath, &st ) == 0 )
+	stamp += (uint64_t) st.st_mtime * 1000003 + st.st_ino;
+
+      if( !addTiles )
+	continue;
+
+      yDir = opendir( dirPath );
+      if( yDir == NULL )
+	continue;
+
+      while( (yEnt = readdir( yDir )) != NULL )
+	for( i = 0; i < TILE_SUFFIXES; i++ )
+	  if( parseNumber( yEnt->d_name, tileSuffixes[i], &y ) )
+	  {
+	    tileIndex_add( z, x, y );
+	    break;
+	  }
+      closedir( yDir );
+    }
+    closedir( xDir );
+  }
+  closedir( zDir );
+
+  return stamp;
+}
+
+/* Parses names like "17" or "12345.png" */
+static bool parseNumber( const char *name, const char *suffix,
+			 uint32_t *number )
+{
+  const char *p;
+
+  if( !isdigit( (unsigned char) name[0] ) )
+    return false;
+
+  for( p = name; isdigit( (unsigned char) *p ); p++ )
+    ;
+
+  if( strcmp( p, suffix ) != 0 )
+    return false;
+
+  *number = strtoul( name, NULL, 10 );
+  return true;
+}
+
+static bool mapFromDirectory( int z, uint32_t x, uint32_t y, TileBlob blob )
+{
+  char filename[ 256 ];
+  int first, i, suffix;
+
+  // a tree normally has one kind of tile, so this rarely misses
+  first = __atomic_load_n( &lastSuffix, __ATOMIC_RELAXED );
+
+  for( i = 0; i < TILE_SUFFIXES; i++ )
+  {
+    suffix = (first + i) % TILE_SUFFIXES;
+    snprintf( filename, sizeof( filename ), "%s/%02d/%d/%d%s", tilePath, z,
+	      x, y, tileSuffixes[ suffix ] );
+
+    if( mapFile( filename, blob ) )
+    {
+      if( suffix != first )
+	__atomic_store_n( &lastSuffix, suffix, __ATOMIC_RELAXED );
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static bool mapFile( const char *filename, TileBlob blob )
+{
+  struct stat st;
+  bool mapped;
+  int fd;
+
+  fd = open( filename, O_RDONLY );
+  if( fd == -1 )
+    return false;
+
+  if( (fstat( fd, &st ) != 0) || (st.st_size == 0) )
+  {
+    close( fd );
+    return false;
+  }
+
+  mapped = mapRange( fd, 0, st.st_size, blob );
+  blob->mtime = st.st_mtime;
+  // the mapping keeps the file referenced
+  close( fd );
+
+  if( !mapped )
+    perror( filename );
+
+  return mapped;
+}
+
+static bool mapFromArchive( int z, uint32_t x, uint32_t y, TileBlob blob )
+{
+  sTileArchiveEntry key;
+  const sTileArchiveEntry *entry;
+
+  key.z = z;
+  key.x = x;
+  key.y = y;
+
+  entry = bsearch( &key, archiveIndex, archiveEntryCount,
+		   sizeof( sTileArchiveEntry ),
+		   (int (*)( const void *, const void * )) tileArchive_compare );
+  if( entry == NULL )
+    return false;
+
+  if( entry->offset + entry->size > archiveSize )
+  {
+    fprintf( stderr, "tile %d/%d/%d is outside the archive\n", z, x, y );
+    return false;
+  }
+
+  blob->mtime = archiveMtime;
+
+  if( archiveMap == NULL )
+    return mapRange( archiveFD, entry->offset, entry->size, blob );
+
+  // tiles are page aligned, so this covers the tile's own pages only
+  madvise( (void *) (archiveMap + entry->offset), entry->size, MADV_WILLNEED );
+
+  blob->data = archiveMap + entry->offset;
+  blob->size = entry->size;
+  blob->mapBase = NULL;  // part of the archive mapping
+  blob->mapLength = 0;
+
+  return true;
+}
+
+/* offset must be page aligned */
+static bool mapRange( int fd, off_t offset, size_t size, TileBlob blob )
+{
+  void *map;
+
+  map = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, offset );
+  if( map == MAP_FAILED )
+    return false;
+
+  // the whole tile is about to be decoded from start to end
+  madvise( map, size, MADV_SEQUENTIAL );
+  madvise( map, size, MADV_WILLNEED );
+
+  blob->data = map;
+  blob->size = size;
+  blob->mapBase = map;
+  blob->mapLength = size;
+
+  return true;
+}
@@ -0,0 +1,35 @@
+/*
+   tileSource.h
+
+   Access to the encoded tile images of a chart set, stored either as a TMS
+   directory tree or as a packed tile archive. Tile data is memory mapped,
+   and decoded straight from the mapping.
+*/
+
+#ifndef TILE_SOURCE_H
+#define TILE_SOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <voxi/util/err.h>
+
+typedef struct
+{
+  const unsigned char *data;  // the encoded tile image
+  size_t size;
+  int64_t mtime;  // of the file the tile is stored in
+
+  void *mapBase;     // the mapping to unmap when the tile is released
+  size_t mapLength;
+} sTileBlob, *TileBlob;
+
+/* path is a tile directory or a tile archive */
+Error tileSource_open( const char *path );
+bool tileSource_isArchive( void );
+/* Returns false if the chart set has no such tile */
+bool tileSource_map( int z, uint32_t x, uint32_t y, TileBlob blob );
+void tileSource_release( TileBlob blob );
+
+#endif
@@ -15,8 +15,87 @@
            if no texture ID, but texture, bind texture, set texture id
 
        loads tile.
+
+   Memory:
+     Tile structs and compressed tile data are kept in a least recently used
+     list. tileTex_trimCache frees tiles from the cold end of the list until
+     the cache fits in the budget. Tiles which are visible, referenced by
+     another tile (TILE_REFS_TEXTURE), waiting to be loaded or in use by the
+     loader threads (pinned) are skipped.
+
+     Tiles are found through a concurrent tileMap. Finding a tile that
+     exists only takes the map's shard lock; instead of moving the tile in
+     the LRU list, which needs loadQueueMutex, it is marked as referenced,
+     and tileTex_trimCache gives referenced tiles a second chance.
+
+     Tile structs come from a slab allocator, as do their cold parts (the
+     mapped PNG, decoded pixels, parent UVs), which are kept apart so the
+     fields walked by the queues and the LRU list fit in one cache line.
+
+   Textures:
+     Tile textures are uploaded to slots in a few atlas pages, so the render
+     thread can draw all visible tiles on a page with one draw call. When all
+     pages are full, the slot of the tile drawn least recently is reused; the
+     tile keeps its encoded data and is decoded and uploaded again if needed.
+
+     Between the two, decoded tiles are also kept LZ4 compressed, which
+     unpacks several times faster than decoding a PNG, so zooming back over
+     the same area doesn't decode the same tiles again. The LZ4 copies have
+     a budget of their own (tileTex_setLz4Budget); tileTex_trimCache drops
+     those of the least recently used tiles when it is exceeded, leaving
+     them to be decoded again.
+
+     If a disk cache is set (tileTex_setDiskCache), loaders also save the
+     LZ4 copies of the tiles they decode, and take tiles from it instead of
+     decoding them, also in later runs. See tileDiskCache.h.
+
+     In RGB565 mode (tileTex_setRGB565), tiles are decoded to 16 bits, and
+     pages are RGB565 textures, halving both the pixel pool and texture
+     memory.
+
+     Tiles may also be ETC1 compressed PKM files, made by tileEtc. They are
+     uploaded from the mapped file without decoding, to textures of their
+     own, at a sixth of the memory. If the GPU has no ETC1 support, they
+     are decoded and uploaded like PNG tiles.
+
+     tileTex_getTexture never waits for loaders. A tile that is not loaded
+     yet, or whose upload doesn't fit in this frame's upload budget, is drawn
+     from part of its nearest loaded ancestor until a later frame.
+
+   Missing tiles:
+     The tile index tells which tiles exist. A missing tile is drawn from
+     its nearest existing ancestor, found without touching the file system,
+     and a tile with no existing ancestor either (outside the chart set) is
+     never created: tileTex_get returns a shared TILE_NO_DATA tile.
+
+   Loading:
+     New tiles are handed out round robin to a pool of loader threads. Each
+     loader has a visible and an invisible deque. A loader takes work from
+     the head of its own visible deque, then steals from the tail of the
+     other loaders' visible deques, and only then does the same with the
+     invisible deques, so visible tiles are always loaded first.
+
+     Loaders also decode the tile (PNG or JPEG, see tileDecoder.h) straight
+     into a buffer from the pixel pool, so the render thread only has to
+     upload it. Invisible tiles are only decoded
+     while the pool has buffers to spare; otherwise the render thread decodes
+     them when they are first drawn.
+
+     Tiles that are not visible yet are prefetched as a prefetch policy
+     says (see tilePrefetch.h): tileTex_setView tells where the view is,
+     tileTex_setMotion the boat's course and speed. Whenever either changes,
+     the tiles to prefetch are planned again, and tileTex_trimCache requests
+     the next few of them each frame. Tiles still waiting to be loaded that
+     are neither visible nor covered by the new plan are then freed, so
+     zooming and panning don't leave loaders busy with stale tiles.
+
+     The visible tiles and the prefetch plan make up a warm set
+     (tileTex_getWarmSet), which can be saved and handed to tileTex_preload
+     at the next start, so the tiles of the last view are loading before
+     the GL context even exists.
+
    API:
-     -init( tilePath, inMemoryTextureCount ):
+     -init( tilePath, cacheBudgetBytes ):
      -deinit(); // frees data, stops thread
      -requestTileBlocking( z, x, y );
      -GLuint getTileTexture( tile );  // blocking
@@ -28,39 +107,50 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <semaphore.h>
 
-#include <png.h>
+#include <lz4.h>
 
-#include <voxi/util/hash.h>
 #include <voxi/util/threading.h>
 
+#include "etc1.h"
+#include "eventTrace.h"
+#include "pixelPool.h"
+#include "slab.h"
+#include "tileAtlas.h"
+#include "tileDecoder.h"
+#include "tileDiskCache.h"
+#include "tileIndex.h"
+#include "tileMap.h"
+#include "tilePrefetch.h"
+#include "tileSource.h"
 #include "tileTexture.h"
 
+/* decoded tiles are 256 x 256, RGB or RGB565 */
+#define TILE_PIXELS (256 * 256)
+/* number of decoded tiles that may wait for upload, not counting visible ones */
+#define DECODED_POOL_BUFFERS 64
+/* atlas pages of up to 64 tiles each */
+#define TILE_ATLAS_PAGES 2
+/* ETC1 tiles kept on the GPU, 32 KB each */
+#define TILE_ETC1_TEXTURES 256
+/* tiles decoded or uploaded by tileTex_getTexture per frame */
+#define TILE_UPLOADS_PER_FRAME 4
+#define CACHE_LINE_BYTES 64
+/* tiles per slab allocation */
+#define TILE_SLAB_COUNT 256
+/* most tiles a prefetch policy may plan for one view */
+#define PREFETCH_MAX_TILES 512
+
+typedef enum { LOAD_QUEUED, LOAD_IN_PROGRESS, LOAD_DONE } LoadState;
+
+/* Tile data that is not needed to queue, find or draw a tile */
 typedef struct
 {
-  char *buffer;
-  size_t remainingBytes;
-} sMemPNG, *MemPNG;
-
-typedef struct sTileTexture
-{
-  int z;
-
-  uint32_t x, y;
-
-  TileTexType type;
-  struct sTileTexture *above;
-  struct sTileTexture *below[4];
-
-  /* These may only be changed while queue mutex is locked */
-  struct sTileTexture *nextInQueue;  // in load queue if not loaded, else next in unload queue
-  struct sTileTexture *prevInQueue;  // in load queue if not loaded, else next in unload queue
-  
-  int visibleRefsCount; // number of visible subtextures that reference this one
-
   union
   {
     struct
@@ -71,347 +161,576 @@ typedef struct sTileTexture
 
     struct
     {
-      GLuint textureID;
-      bool inRAM;
-      sMemPNG pngData;
+      sTileBlob pngData;  // mapped, not copied
+      GLubyte *pixels;  // decoded image waiting to be uploaded, or NULL
+      char *lz4Pixels;  // decoded image, LZ4 compressed, or NULL
+      int lz4Size;
+      int width, height;
     } loadedTile;
-  } typeData;
+  };
 
-  // Statusl
-  bool visible;
-  
+  bool prefetched;  // requested by prefetching, and not visible since
+} sTileTexCold, *TileTexCold;
+
+/*
+ * The fields walked by the load queues, the LRU list and the render loop,
+ * packed into one cache line. Tiles are allocated from tileSlab, aligned to
+ * the cache line, and their cold data from coldSlab.
+ */
+typedef struct sTileTexture
+{
+  /* These may only be changed while the queue's worker mutex is locked */
+  struct sTileTexture *nextInQueue;
+  struct sTileTexture *prevInQueue;
+
+  /* These may only be changed while loadQueueMutex is locked */
+  struct sTileTexture *lruNewer;  // towards most recently used
+  struct sTileTexture *lruOlder;  // towards least recently used
+
+  TileTexCold cold;
+
+  uint32_t x, y;
+  int32_t atlasSlot;  // for TILE_HAS_TEXTURE, -1 until uploaded. GL thread only.
+
+  int32_t refsCount; // number of tiles that reference this one's texture
+  int16_t pinCount;  // > 0 while a loader thread holds a pointer to the tile
+  int8_t z;
+  int8_t queueWorker;  // index of the loader whose deque holds the tile, or -1
+  uint8_t type;        // TileTexType
+  uint8_t loadState;   // LoadState. Set atomically, LOAD_DONE with release.
+  bool visible;        // set atomically, as loaders read it without locking
+  bool referenced;  // found since trimCache last looked at the tile
 } sTileTexture;
 
+_Static_assert( sizeof( sTileTexture ) <= CACHE_LINE_BYTES,
+		"sTileTexture does not fit in a cache line" );
+
+/* A loader thread with its own deques of tiles to load */
+typedef struct
+{
+  int index;
+  pthread_t thread;
+
+  /* protects the deques. If loadQueueMutex is needed as well, it must be
+     locked first */
+  sVoxiMutex mutex;
+  TileTexture visibleHead, visibleTail;
+  TileTexture invisibleHead, invisibleTail;
+} sLoadWorker, *LoadWorker;
+
 /*
  * static functions
  */
 static void *threadFunc( void *arg );
-static int tileHash( TileTexture t );
-static int tileCompare( TileTexture t1, TileTexture t2 );
 static TileTexture tileCreate( int z, uint32_t x, uint32_t y );
-static void png_memoryReadFunc( png_structp png_ptr, png_bytep outBytes,
-				png_size_t byteCountToRead );
 static void loadTile( TileTexture tile );
-static Error loadPngFromMemory( const sMemPNG *pngData, GLubyte **image,
-				int *outWidth, int *outHeight );
+static bool decodeTile( TileTexture tile, bool mayGrow );
+static void packTile( TileTexture tile );
+static bool unpackTile( TileTexture tile, bool mayGrow );
+static bool readCachedTile( TileTexture tile );
+static void writeCachedTile( TileTexture tile );
+static void trimLz4Tier( void );
+static const unsigned char *tileETC1Blocks( const sTileTexture *tile );
 static void printLoadQueue( const sTileTexture *head );
-static void validateLoadQueues();
+static void validateLoadQueues( const sLoadWorker *worker );
+static void queuePushTail( TileTexture *head, TileTexture *tail,
+			   TileTexture tile );
+static void queueUnlink( TileTexture *head, TileTexture *tail,
+			 TileTexture tile );
+static void tileEnqueue( TileTexture tile );
+static TileTexture workerTake( LoadWorker worker, bool visible, bool fromTail );
+static TileTexture workerNextTile( LoadWorker worker );
+static bool tileClaim( TileTexture tile );
+static void tileLoaded( TileTexture tile );
 static void findRefTile( TileTexture tile );
+static void refAncestor( TileTexture tile, TileTexture upTile, int steps );
+static void tileBroken( TileTexture tile );
+static void ancestorUV( const sTileTexture *tile, int steps, double *u1,
+			double *v1, double *uvScale );
+static bool tileIsLoaded( const sTileTexture *tile );
+static bool tileIsVisible( const sTileTexture *tile );
+static GLuint tileTexture( TileTexture tile, bool mayUpload );
+static TileTexture tileLookup( int z, uint32_t x, uint32_t y, bool pin );
+static void tilePin( void *tile );
+static void tileUnpin( TileTexture tile );
+static bool tileIsUnpinned( void *tile );
+static void lruUnlink( TileTexture tile );
+static void lruPushNewest( TileTexture tile );
+static bool tileIsEvictable( const sTileTexture *tile );
+static void tileFree( TileTexture tile );
+static void prefetchPlan( void );
+static void prefetchRun( void );
+static bool prefetchWanted( const sTileTexture *tile );
+static void cancelStaleLoads( void );
 
 /*
  * Global data
  */
 
-// static TileTexture unloadQueue;
-static int inMemoryCount;
-static char *tilePath;
-
-static pthread_t thread;
-
+/* The counters tileTex_getStats reads are changed with relaxed atomics, so
+   that it needs no lock. Those below loadQueueMutex are changed under it
+   as well. */
+static size_t cacheBudget;
+static size_t cacheBytes;
+static int tileCount;
+static TilePixelFormat pixelFormat;  // of decoded tiles
+static uint64_t statHits, statMisses, statEvictions;
+static uint64_t statLoaded, statStolen;
+static uint64_t statPrefetched, statPrefetchHits, statPrefetchWasted;
+static uint64_t statCancelled;
+static size_t lz4Budget;  // 0 disables the LZ4 tier
+static size_t lz4Bytes;
+static uint64_t statDecodes, statLz4Hits, statLz4Dropped;
+static uint64_t statDiskHits, statDiskWrites;
+static uint64_t statLoadTimes[ TILE_TEX_LOAD_BUCKETS ];
+
+static LoadWorker workers;
+static int workerCount;
+
+/* protects the tile hash table, the LRU list, the tiles' load state and the
+   counters below */
 static sVoxiMutex loadQueueMutex;
-static pthread_cond_t loadQueueCondition;
-static TileTexture visibleLoadQueueHead, visibleLoadQueueTail;
-static TileTexture invisibleLoadQueueHead, invisibleLoadQueueTail;
-
-static HashTable tileHashTable;
+static pthread_cond_t workCondition;    // signalled when a tile is queued
+static pthread_cond_t loadedCondition;  // broadcast when a tile is loaded
+static int nextWorker;           // the next new tile is queued on this loader
+static int queuedCount;          // queued tiles not yet taken by a loader
+static int pendingVisibleCount;  // visible tiles not yet loaded
+static TileTexture lruNewest, lruOldest;
+
+static TileMap tileMap;
+static int uploadsLeft;  // in this frame, by tileTex_getTexture
+static bool limitUploads = true;  // see tileTex_setProgressive
+static Slab tileSlab, coldSlab;  // allocated from with loadQueueMutex locked
+
+/* the visible tiles and the boat's motion, as last set, and the tiles to
+   prefetch for them. Render thread only */
+static int viewZ = -1;
+static sTileBounds viewBounds;
+static float motionCourse, motionSpeed;  // degrees true, knots
+static sPrefetchPolicy prefetchPolicy;
+static sPrefetchTile prefetchTiles[ PREFETCH_MAX_TILES ];
+static int prefetchCount, prefetchNext;
+/* per zoom level, the bounds of the planned tiles; empty if min > max */
+static sTileBounds prefetchBounds[ TILE_INDEX_ZOOMS ];
+
+/* Stands in for every tile that has no data, not even in an ancestor. It is
+   never queued, cached or freed. */
+static sTileTexture noDataTile = {
+  .atlasSlot = -1,
+  .queueWorker = -1,
+  .type = TILE_NO_DATA,
+  .loadState = LOAD_DONE
+};
+
+void tileTex_setRGB565( bool rgb565Param )
+{
+  pixelFormat = rgb565Param ? TILE_PIXELS_RGB565 : TILE_PIXELS_RGB;
+}
 
-Error tileTex_init( const char *tilePathParam, int inMemoryCountParam )
+Error tileTex_init( const char *tilePathParam, size_t cacheBudgetParam,
+		    int loaderCountParam )
 {
-  int err;
+  int err, i;
   Error error;
   
-  tilePath = strdup( tilePathParam );
-  assert( tilePath != NULL );
+  assert( (loaderCountParam > 0) && (loaderCountParam <= INT8_MAX) );
+
 
-  visibleLoadQueueHead = NULL;
-  visibleLoadQueueTail = NULL;
-  invisibleLoadQueueHead = NULL;
-  invisibleLoadQueueTail = NULL;
+  ERR_GOTO( tileSource_open( tilePathParam ), FAIL );
+
+  lruNewest = NULL;
+  lruOldest = NULL;
+  nextWorker = 0;
+  queuedCount = 0;
+  pendingVisibleCount = 0;
   
-  inMemoryCount = inMemoryCountParam;
-  tileHashTable = HashCreateTable( 129, (HashFuncPtr) tileHash,
-				   (CompFuncPtr) tileCompare, NULL );
+  cacheBudget = cacheBudgetParam;
+  cacheBytes = 0;
+  tileCount = 0;
+  tileMap = tileMap_create( 4096 );
+  tileSlab = slab_create( sizeof( sTileTexture ), CACHE_LINE_BYTES,
+			  TILE_SLAB_COUNT );
+  coldSlab = slab_create( sizeof( sTileTexCold ), sizeof( void * ),
+			  TILE_SLAB_COUNT );
   
   ERR_GOTO( threading_init(), FAIL );
 
   ERR_GOTO( threading_mutex_init( &loadQueueMutex ), FAIL );
   threading_mutex_setDebug( &loadQueueMutex, false );
 
-  err = pthread_cond_init( &loadQueueCondition, NULL );
+  ERR_GOTO( pixelPool_init( TILE_PIXELS * tileDecoder_pixelBytes( pixelFormat ),
+			    DECODED_POOL_BUFFERS ), FAIL );
+  tileAtlas_init( TILE_ATLAS_PAGES, TILE_ETC1_TEXTURES,
+		  pixelFormat == TILE_PIXELS_RGB565 );
+  uploadsLeft = TILE_UPLOADS_PER_FRAME;
+  prefetchPolicy = tilePrefetch_defaultPolicy;
+
+  err = pthread_cond_init( &workCondition, NULL );
   assert( err == 0 );
-  
-  // create thread
-  err = pthread_create( &thread, NULL /* attrs */, threadFunc, NULL );
+  err = pthread_cond_init( &loadedCondition, NULL );
   assert( err == 0 );
 
+  workerCount = loaderCountParam;
+  workers = calloc( workerCount, sizeof( sLoadWorker ) );
+  assert( workers != NULL );
+
+  for( i = 0; i < workerCount; i++ )
+  {
+    workers[i].index = i;
+    ERR_GOTO( threading_mutex_init( &(workers[i].mutex) ), FAIL );
+    threading_mutex_setDebug( &(workers[i].mutex), false );
+  }
+
+  // create threads once all deques exist, since loaders steal from each other
+  for( i = 0; i < workerCount; i++ )
+  {
+    err = pthread_create( &(workers[i].thread), NULL /* attrs */, threadFunc,
+			  &(workers[i]) );
+    assert( err == 0 );
+  }
+
   return NULL;
 
  FAIL:
+  // tileLookup and tileTex_trimCache refuse to run without loaders
+  workerCount = 0;
   return error; // should wrap it.
 }
 
-static int tileCompare( TileTexture t1, TileTexture t2 )
+void tileTex_setVisible( TileTexture tile, bool isVisible )
 {
-  if( t1->z != t2->z )
-    return t2->z - t1->z;
-
-  if( t1->x != t2->x )
-    return t2->x - t1->x;
+  const char *oldLocker;
+  int workerIndex;
 
-  return t2->y - t1->y;
-}
+  if( tile == &noDataTile )
+    return;
 
-static int tileHash( TileTexture t )
-{
-  return t->z ^ (t->x << 1) ^ (t->y << 2);
-}
+  oldLocker = threading_mutex_lock_debug( &loadQueueMutex, "tileTex_setVisible" );
+  lruUnlink( tile );
+  lruPushNewest( tile );
 
-void tileTex_setVisible( TileTexture tile, bool isVisible )
-{
-  const char *oldLocker;
   if( tile->visible == isVisible )
+  {
+    threading_mutex_unlock_debug( &loadQueueMutex, oldLocker );
     return;
+  }
   /*
   printf( "tileTex_setVisible( %p: %d, %d, %d )\n", tile, tile->z, tile->x,
 	  tile->y );
   */
-  // remove tile from old queue //
-  // how do we know if it was in the invisible queue? It may have been visible,
-  // then turned inviisble.
-  // only if it is of type TILE_NO_DATA, do this.
-  if( tile->type == TILE_NEW )
-  {
-    // lock the Load Queue Mutex
-    oldLocker = threading_mutex_lock_debug( &loadQueueMutex, "tileTex_setVisible" );
-    validateLoadQueues();
-
-    // printf( "tileTex_setVisible( (%d, %d, %d), %s )\n", tile->z, tile->x, tile->y, isVisible ? "true": "false" );
-
-    if( tile->visible )
-    {
-      if( tile->prevInQueue == NULL )
-	visibleLoadQueueHead = tile->nextInQueue;
-      else
-	tile->prevInQueue->nextInQueue = tile->nextInQueue;
-      
-      if( tile->nextInQueue == NULL )
-	visibleLoadQueueTail = tile->prevInQueue;
-      else
-	tile->nextInQueue->prevInQueue = tile->prevInQueue;
-    }
-    else
-    {
-      if( tile->prevInQueue == NULL )
-      {
-	invisibleLoadQueueHead = tile->nextInQueue;
-	// printf( "tileTex_setVisible: invisibleLoadQUeueHead set to %p\n", tile->nextInQueue );
-      }
-      else
-	tile->prevInQueue->nextInQueue = tile->nextInQueue;
+  if( tile->loadState != LOAD_DONE )
+    __atomic_fetch_add( &pendingVisibleCount, isVisible ? 1 : -1,
+			__ATOMIC_RELAXED );
 
-      if( tile->nextInQueue == NULL )
-	invisibleLoadQueueTail = tile->prevInQueue;
-      else
-	tile->nextInQueue->prevInQueue = tile->prevInQueue;
-    }
-    tile->nextInQueue = NULL;
-    tile->prevInQueue = NULL;
-  }
-  else
+  if( isVisible && tile->cold->prefetched )
   {
-    // reinstate these, check why this triggers
-    assert( tile->nextInQueue == NULL );
-    assert( tile->prevInQueue == NULL );
+    tile->cold->prefetched = false;
+    __atomic_fetch_add( &statPrefetchHits, 1, __ATOMIC_RELAXED );
   }
-  
-  tile->visible = isVisible;
 
-  if( tile->type == TILE_NEW )
+  // if the tile is still waiting in a deque, move it to the loader's other
+  // deque. A loader may take it from the deque before we get its mutex.
+  workerIndex = tile->queueWorker;
+  if( workerIndex == -1 )
+    __atomic_store_n( &(tile->visible), isVisible, __ATOMIC_RELAXED );
+  else
   {
-    // insert into new queue
-    if( tile->visible )
+    LoadWorker worker = &(workers[ workerIndex ]);
+
+    threading_mutex_lock( &(worker->mutex) );
+
+    if( tile->queueWorker != workerIndex )
+      __atomic_store_n( &(tile->visible), isVisible, __ATOMIC_RELAXED );
+    else if( isVisible )
     {
-      if( visibleLoadQueueTail == NULL )
-	visibleLoadQueueHead = visibleLoadQueueTail = tile;
-      else
-      {
-	visibleLoadQueueTail->nextInQueue = tile;
-	tile->prevInQueue = visibleLoadQueueTail;
-	visibleLoadQueueTail = tile;
-      }
+      queueUnlink( &(worker->invisibleHead), &(worker->invisibleTail), tile );
+      __atomic_store_n( &(tile->visible), isVisible, __ATOMIC_RELAXED );
+      queuePushTail( &(worker->visibleHead), &(worker->visibleTail), tile );
     }
     else
     {
-      if( invisibleLoadQueueTail == NULL )
-      {
-	invisibleLoadQueueHead = invisibleLoadQueueTail = tile;
-      }
-      else
-      {
-	invisibleLoadQueueTail->nextInQueue = tile;
-	tile->prevInQueue = invisibleLoadQueueTail;
-	invisibleLoadQueueTail = tile;
-      }
+      queueUnlink( &(worker->visibleHead), &(worker->visibleTail), tile );
+      __atomic_store_n( &(tile->visible), isVisible, __ATOMIC_RELAXED );
+      queuePushTail( &(worker->invisibleHead), &(worker->invisibleTail), tile );
     }
-    // I don't think we need to broadcast when switching between queues
-    // pthread_cond_broadcast( &loadQueueCondition );
 #if 0
     printf( "setVisible: Visible Queue" );
-    printLoadQueue( visibleLoadQueueHead );
+    printLoadQueue( worker->visibleHead );
     printf( "setVisible: Invisible Queue" );
-    printLoadQueue( invisibleLoadQueueHead );
+    printLoadQueue( worker->invisibleHead );
 #endif
-    validateLoadQueues();
-    threading_mutex_unlock_debug( &loadQueueMutex, oldLocker );
+    validateLoadQueues( worker );
+    threading_mutex_unlock( &(worker->mutex) );
   }
-  
-  if( tile->visible )
+  threading_mutex_unlock_debug( &loadQueueMutex, oldLocker );
+}
+
+void tileTex_setView( int z, const TileBounds bounds )
+{
+  if( (z == viewZ) && (memcmp( bounds, &viewBounds, sizeof( sTileBounds ) ) == 0) )
+    return;
+
+  viewZ = z;
+  viewBounds = *bounds;
+  prefetchPlan();
+  cancelStaleLoads();
+}
+
+void tileTex_setMotion( float course, float speed )
+{
+  if( (course == motionCourse) && (speed == motionSpeed) )
+    return;
+
+  motionCourse = course;
+  motionSpeed = speed;
+  prefetchPlan();
+}
+
+Error tileTex_setDiskCache( const char *path )
+{
+  return tileDiskCache_open( path );
+}
+
+void tileTex_setProgressive( bool progressive )
+{
+  limitUploads = progressive;
+}
+
+void tileTex_setLz4Budget( size_t bytes )
+{
+  lz4Budget = bytes;
+}
+
+void tileTex_setPrefetchPolicy( const sPrefetchPolicy *policy )
+{
+  prefetchPolicy = *policy;
+  prefetchPlan();
+}
+
+int tileTex_getWarmSet( PrefetchTile tiles, int maxTiles )
+{
+  uint32_t x, y;
+  int i, count = 0;
+
+  if( viewZ < 0 )
+    return 0;
+
+  for( y = viewBounds.minY; y <= viewBounds.maxY; y++ )
+    for( x = viewBounds.minX; x <= viewBounds.maxX; x++ )
+      if( (count < maxTiles) && tileIndex_has( viewZ, x, y ) )
+      {
+	tiles[ count ].z = viewZ;
+	tiles[ count ].x = x;
+	tiles[ count ].y = y;
+	count++;
+      }
+
+  for( i = 0; (i < prefetchCount) && (count < maxTiles); i++ )
+    if( tileIndex_has( prefetchTiles[i].z, prefetchTiles[i].x,
+		       prefetchTiles[i].y ) )
+      tiles[ count++ ] = prefetchTiles[i];
+
+  return count;
+}
+
+void tileTex_preload( const sPrefetchTile *tiles, int count )
+{
+  TileTexture tile;
+  int i;
+
+  for( i = 0; i < count; i++ )
   {
-    int x, y;
-    
-    // start loading neighboring tiles at same zoom level
-    for( y = tile->y - 1; y <= (tile->y + 1); y++ )
-      for( x = tile->x - 1; x <= (tile->x + 1); x++ )
-	if( !((tile->x == x) && (tile->y == y) ) )
-	  tileTex_get( tile->z, x, y );  // will put in inivisible load queue if not loaded
-    
-    // TODO: preload
-    // load tile one level above
-    tileTex_get( tile->z - 1, tile->x / 2, tile->y / 2 );
-    
-    // load tiles one level below
-    tileTex_get( tile->z + 1, tile->x * 2,     tile->y * 2 );
-    tileTex_get( tile->z + 1, tile->x * 2,     tile->y * 2 + 1 );
-    tileTex_get( tile->z + 1, tile->x * 2 + 1, tile->y * 2 );
-    tileTex_get( tile->z + 1, tile->x * 2 + 1, tile->y * 2 + 1 );
+    if( !tileIndex_has( tiles[i].z, tiles[i].x, tiles[i].y ) ||
+	(tileMap_find( tileMap, tileKey_make( tiles[i].z, tiles[i].x,
+					      tiles[i].y ), NULL ) != NULL) )
+      continue;
+
+    // loaded like prefetched tiles, until the first view makes some visible
+    tile = tileLookup( tiles[i].z, tiles[i].x, tiles[i].y, false );
+    if( !tile->visible )
+      tile->cold->prefetched = true;
+    __atomic_fetch_add( &statPrefetched, 1, __ATOMIC_RELAXED );
   }
-
 }
 
 TileTexture tileTex_get(int z, uint32_t x, uint32_t y)
 {
+  // outside the chart set: nothing to load, and nothing to draw
+  if( tileIndex_findAncestor( z, x, y ) == -1 )
+    return &noDataTile;
+
+  return tileLookup( z, x, y, false );
+}
+
+/*
+ * Finds or creates a tile and marks it as recently used. Tiles used by a
+ * loader thread must be pinned, since tileTex_trimCache may run concurrently
+ * on the render thread. Pinning is done with the tile's map shard locked, so
+ * trimCache can't remove the tile from the map between the find and the pin.
+ */
+static TileTexture tileLookup( int z, uint32_t x, uint32_t y, bool pin )
+{
+  TileKey key = tileKey_make( z, x, y );
   TileTexture tile;
-  sTileTexture tileTemplate;
+  const char *oldLocker;
+
+  assert( workerCount > 0 );  // tileTex_init failed or was not called
 
-  tileTemplate.z = z; tileTemplate.x = x; tileTemplate.y = y;
-  
   // if the tile has been created, find it
-  tile = (TileTexture) HashFind( tileHashTable, &tileTemplate );
-		  
-  // if the tile has not been created, create it
+  tile = tileMap_find( tileMap, key, pin ? tilePin : NULL );
+  if( tile != NULL )
+  {
+    __atomic_fetch_add( &statHits, 1, __ATOMIC_RELAXED );
+    tile->referenced = true;
+    return tile;
+  }
+
+  oldLocker = threading_mutex_lock_debug( &loadQueueMutex, "tileLookup" );
+
+  // tiles are only created with loadQueueMutex locked, so check again
+  tile = tileMap_find( tileMap, key, pin ? tilePin : NULL );
   if( tile == NULL )
+  {
+    __atomic_fetch_add( &statMisses, 1, __ATOMIC_RELAXED );
     tile = tileCreate( z, x, y );
+    if( pin )
+      tilePin( tile );
+  }
+  else
+  {
+    __atomic_fetch_add( &statHits, 1, __ATOMIC_RELAXED );
+    tile->referenced = true;
+  }
   
-  // return it
+  threading_mutex_unlock_debug( &loadQueueMutex, oldLocker );
 
   return tile;
 }
 
+static void tilePin( void *tile )
+{
+  __atomic_fetch_add( &(((TileTexture) tile)->pinCount), 1, __ATOMIC_RELAXED );
+}
+
+static void tileUnpin( TileTexture tile )
+{
+  int oldCount;
+
+  oldCount = __atomic_fetch_sub( &(tile->pinCount), 1, __ATOMIC_RELEASE );
+  assert( oldCount > 0 );
+}
+
+/* Called with the tile's map shard locked */
+static bool tileIsUnpinned( void *tile )
+{
+  return __atomic_load_n( &(((TileTexture) tile)->pinCount),
+			  __ATOMIC_ACQUIRE ) == 0;
+}
+
+/* Must be called with loadQueueMutex locked */
 static TileTexture tileCreate( int z, uint32_t x, uint32_t y )
 {
   TileTexture tile;
-  const char *oldLocker;
   
-  tile = malloc( sizeof( sTileTexture ) );
-  assert( tile != NULL );
+  tile = slab_alloc( tileSlab );
+  tile->cold = slab_alloc( coldSlab );
 
   tile->x = x;
   tile->y = y;
   tile->z = z;
 
   tile->type = TILE_NEW;
-  tile->above = NULL; // when to we get this
-  tile->below[0] = NULL;
-  tile->below[1] = NULL;
-  tile->below[2] = NULL;
-  tile->below[3] = NULL;
-
+  tile->atlasSlot = -1;
   tile->nextInQueue = NULL;
+  tile->prevInQueue = NULL;
+  tile->queueWorker = -1;
+  tile->lruNewer = NULL;
+  tile->lruOlder = NULL;
   tile->visible = false;
-  tile->visibleRefsCount = 0;
-
-  HashAdd( tileHashTable, tile );
+  tile->refsCount = 0;
+  tile->pinCount = 0;
+  tile->referenced = false;
+  tile->cold->prefetched = false;
+
+  lruPushNewest( tile );
+  tileMap_insert( tileMap, tileKey_make( z, x, y ), tile );
+  __atomic_fetch_add( &tileCount, 1, __ATOMIC_RELAXED );
+  __atomic_fetch_add( &cacheBytes,
+		      sizeof( sTileTexture ) + sizeof( sTileTexCold ),
+		      __ATOMIC_RELAXED );
   
   /* put it in theload queue? Yes! */
-  oldLocker = threading_mutex_lock_debug( &loadQueueMutex, "tileCreate" );
-  validateLoadQueues();
-    
-  if( invisibleLoadQueueHead == NULL )
-  {
-    assert( invisibleLoadQueueTail == NULL );
-    invisibleLoadQueueHead = tile;
-    // printf( "tileCreate: invisibleLoadQUeueHead set to %p\n", tile->nextInQueue );
-  }
-  else
-    invisibleLoadQueueTail->nextInQueue = tile;
+  tileEnqueue( tile );
   
-  tile->prevInQueue = invisibleLoadQueueTail;
-  invisibleLoadQueueTail = tile;
+  return tile;
+}
+
+/* Must be called with loadQueueMutex locked */
+static void tileEnqueue( TileTexture tile )
+{
+  LoadWorker worker;
 
-  // printf( "TileCreate: signaling loadQueueCondition\n" );
-  pthread_cond_signal( &loadQueueCondition );
+  worker = &(workers[ nextWorker ]);
+  nextWorker = (nextWorker + 1) % workerCount;
 
-  validateLoadQueues();
-  threading_mutex_unlock_debug( &loadQueueMutex, oldLocker );
-  
-  return tile;
+  threading_mutex_lock( &(worker->mutex) );
+  if( tile->visible )
+    queuePushTail( &(worker->visibleHead), &(worker->visibleTail), tile );
+  else
+    queuePushTail( &(worker->invisibleHead), &(worker->invisibleTail), tile );
+  tile->queueWorker = worker->index;
+  validateLoadQueues( worker );
+  threading_mutex_unlock( &(worker->mutex) );
+
+  __atomic_store_n( &(tile->loadState), LOAD_QUEUED, __ATOMIC_RELAXED );
+  if( tile->visible )
+    __atomic_fetch_add( &pendingVisibleCount, 1, __ATOMIC_RELAXED );
+  __atomic_fetch_add( &queuedCount, 1, __ATOMIC_RELAXED );
+
+  // printf( "tileEnqueue: signaling workCondition\n" );
+  pthread_cond_signal( &workCondition );
 }
 
 static void *threadFunc( void *arg )
 {
+  LoadWorker worker = (LoadWorker) arg;
   TileTexture tileToLoad;
   Error error;
   const char *oldLocker;
+  char name[ 32 ];
+
+  snprintf( name, sizeof( name ), "loader %d", worker->index );
+  eventTrace_setThreadName( name );
   
   do
   {
+    uint64_t traceStart = TRACE_START();
+
     // wait for load requests or shutdown
     oldLocker = threading_mutex_lock_debug( &loadQueueMutex, "threadFunc" );
-    validateLoadQueues();
     
-    while( (visibleLoadQueueHead == NULL) && (invisibleLoadQueueHead == NULL) )
+    while( queuedCount == 0 )
     {
-      error = threading_cond_wait( &loadQueueCondition, &loadQueueMutex );
-
-      // printf( "threadFunc got signal, visible head=%p, invisible head=%p\n",
-      //        visibleLoadQueueHead, invisibleLoadQueueHead );
-      
+      error = threading_cond_wait( &workCondition, &loadQueueMutex );
       assert( error == NULL );
     }
+    TRACE_END( traceStart, "wait for work" );
+    // reserve one of the queued tiles for this loader
+    __atomic_fetch_sub( &queuedCount, 1, __ATOMIC_RELAXED );
     
-    if( visibleLoadQueueHead != NULL )
-    {
-      tileToLoad = visibleLoadQueueHead;
-      /*      
-      visibleLoadQueueHead = tileToLoad->nextInQueue;
-      if( visibleLoadQueueHead == NULL )
-      {
-	assert( visibleLoadQueueTail == tileToLoad );
-	visibleLoadQueueTail = NULL;
-      }
-      */ // Tile removed from queue in loadTile?
-    }
-    else
-    {
-      tileToLoad = invisibleLoadQueueHead;
-      /*
-      invisibleLoadQueueHead = tileToLoad->nextInQueue;
-      if( invisibleLoadQueueHead == NULL )
-      {
-	assert( invisibleLoadQueueTail == tileToLoad );
-	invisibleLoadQueueTail = NULL;
-      }
-      */
-    }
-    
-    assert( tileToLoad != NULL );
-    
-    // loadQueue = tileToLoad->nextInQueue;
-    assert( tileToLoad->prevInQueue == NULL );
-    // tileToLoad->nextInQueue = NULL;
-    
-    validateLoadQueues();
     threading_mutex_unlock_debug( &loadQueueMutex, oldLocker );
+
+    tileToLoad = workerNextTile( worker );
+
+    // tileClaim may have taken the tile we reserved
+    if( tileToLoad == NULL )
+      continue;
+
+    threading_mutex_lock( &loadQueueMutex );
+    // the render thread reads it without locking, see tileIsLoaded
+    __atomic_store_n( &(tileToLoad->loadState), LOAD_IN_PROGRESS,
+		      __ATOMIC_RELAXED );
+    threading_mutex_unlock( &loadQueueMutex );
   
     // load the tile
 
@@ -419,405 +738,739 @@ static void *threadFunc( void *arg )
   } while( true );  // TODO: abort when tileTexture is shut down
 }
 
-// called from the loading thread
-static void findRefTile( TileTexture tile )
+/*
+ * Takes the next tile for a loader: visible tiles before invisible ones, and
+ * the loader's own tiles before stealing from the others.
+ */
+static TileTexture workerNextTile( LoadWorker worker )
 {
-  int x, y, z;
-  TileTexture upTile, refTile;
-  double u1, v1, uvScale;
+  TileTexture tile;
+  int visible, i;
 
-  // printf( "findRefTile( %p: %d, %d, %d )\n", tile, tile->z, tile->x, tile->y );
-  
-  if( tile->z == 0 )
+  for( visible = 1; visible >= 0; visible-- )
   {
-    tile->type = TILE_NO_DATA;
-    return;
+    tile = workerTake( worker, visible, false );
+    if( tile != NULL )
+      return tile;
+
+    for( i = 1; i < workerCount; i++ )
+    {
+      tile = workerTake( &(workers[ (worker->index + i) % workerCount ]),
+			 visible, true );
+      if( tile != NULL )
+      {
+	threading_mutex_lock( &loadQueueMutex );
+	__atomic_fetch_add( &statStolen, 1, __ATOMIC_RELAXED );
+	threading_mutex_unlock( &loadQueueMutex );
+	return tile;
+      }
+    }
   }
-  
-  x = tile->x >> 1;
-  y = tile->y >> 1;
-  z = tile->z - 1;
+  return NULL;
+}
 
-  upTile = tileTex_get( z, x, y );
-  if( upTile->type == TILE_NEW ) // not loaded yet; load now
-    loadTile( upTile );
-    
-  switch( upTile->type )
+/* removes the tile at the head or tail of one of a loader's deques */
+static TileTexture workerTake( LoadWorker worker, bool visible, bool fromTail )
+{
+  TileTexture tile;
+  TileTexture *head, *tail;
+
+  if( visible )
   {
-    case TILE_HAS_TEXTURE:
-      // got it!
-      // printf( "***\n" );
-      tile->type = TILE_REFS_TEXTURE;
-      refTile = upTile;
-      tile->typeData.otherTile.otherTile = upTile;
+    head = &(worker->visibleHead);
+    tail = &(worker->visibleTail);
+  }
+  else
+  {
+    head = &(worker->invisibleHead);
+    tail = &(worker->invisibleTail);
+  }
 
-      u1 = (tile->x & 1) / 2.0;
-      v1 = (~(tile->y) & 1) / 2.0;
-      
-      tile->typeData.otherTile.u1 = u1;
-      tile->typeData.otherTile.u2 = u1 + 0.5;
-      tile->typeData.otherTile.v1 = v1;
-      tile->typeData.otherTile.v2 = v1 + 0.5;
-      break;
+  threading_mutex_lock( &(worker->mutex) );
 
-    case TILE_REFS_TEXTURE:
-      tile->type = TILE_REFS_TEXTURE;
-      refTile = upTile->typeData.otherTile.otherTile;
-      tile->typeData.otherTile.otherTile = refTile;
+  tile = fromTail ? *tail : *head;
+  if( tile != NULL )
+  {
+    queueUnlink( head, tail, tile );
+    tile->queueWorker = -1;
+  }
 
-      // mask = (1 << (steps - 1)) - 1;
-      // mask = ~((uint32_t) 0) >> (32-steps);
+  validateLoadQueues( worker );
+  threading_mutex_unlock( &(worker->mutex) );
 
-      // one step up, scale is 0.5
-      // new u = upTile->u + (tile->x & 1) * uvScale * 0.5;
-      uvScale = 1.0 / (1 << (tile->z - refTile->z));
+  return tile;
+}
 
-      u1 = upTile->typeData.otherTile.u1 + (tile->x & 1) * uvScale * 0.5;
-      v1 = upTile->typeData.otherTile.v1 + (tile->y & 1) * uvScale * 0.5;
+/*
+ * Makes sure a tile is loaded. If it is still in a deque, it is taken out and
+ * true is returned: the caller must load it. If another thread is loading
+ * it, waits for that thread to finish and returns false.
+ */
+static bool tileClaim( TileTexture tile )
+{
+  bool claimed = false;
+  uint64_t traceStart = TRACE_START();
+  Error error;
 
-      tile->typeData.otherTile.u1 = u1;
-      tile->typeData.otherTile.u2 = u1 + uvScale;
-      tile->typeData.otherTile.v1 = v1;
-      tile->typeData.otherTile.v2 = v1 + uvScale;
-      break;
+  threading_mutex_lock( &loadQueueMutex );
 
-    case TILE_NO_DATA:
-      // no data for the parent
-      tile->type = TILE_NO_DATA;
-      break;
+  while( !claimed && (tile->loadState != LOAD_DONE) )
+  {
+    int workerIndex = tile->queueWorker;
 
-    case TILE_NEW:
-      assert( false );
-  } // endo of switch
-#if 0
-  if( tile->type == TILE_NO_DATA )
-    printf( "findRefTile got no data\n" );
-  else
-    printf( "findRefTile of (%p: %d, %d, %d) is (%p: %d, %d, %d; u(%f, %f), v(%f %f)\n",
-	    tile, tile->z, tile->x, tile->y, refTile, refTile->z, refTile->x, refTile->y,
-	    tile->typeData.otherTile.u1, tile->typeData.otherTile.u2,
-	    tile->typeData.otherTile.v1, tile->typeData.otherTile.v2 );
-#endif
-}
-     
-static void loadTile( TileTexture tile )
-{
-  char filename[ 256 ];
-  FILE *file;
-  long size;
-  size_t itemCount;
+    if( (tile->loadState == LOAD_QUEUED) && (workerIndex != -1) )
+    {
+      LoadWorker worker = &(workers[ workerIndex ]);
 
-  sprintf( filename, "%s/%02d/%d/%d.png", tilePath, tile->z, tile->x, tile->y );
-#if 0
-  printf( "loading tile %p: %d, %d, %d: '%s'\n", tile, tile->z, tile->x, tile->y,
-	  filename );
-  printf( "VisibieLoadQueue: " );
-  printLoadQueue( visibleLoadQueueHead);
-  printf( "InvisibieLoadQueue: " );
-  printLoadQueue( invisibleLoadQueueHead);
-#endif
-  // get the size of the file
-  file = fopen( filename, "r" );
-  if( file == NULL )
-  {
-    printf( "failed to load '%s'\n", filename );
-    // tile->type = TILE_REFS_TEXTURE;
+      threading_mutex_lock( &(worker->mutex) );
+      if( tile->queueWorker == workerIndex )
+      {
+	if( tile->visible )
+	  queueUnlink( &(worker->visibleHead), &(worker->visibleTail), tile );
+	else
+	  queueUnlink( &(worker->invisibleHead), &(worker->invisibleTail),
+		       tile );
+	tile->queueWorker = -1;
+	claimed = true;
+      }
+      validateLoadQueues( worker );
+      threading_mutex_unlock( &(worker->mutex) );
+    }
 
-    // Look for the tile higher up in the zoom hierarchy (recursively)
-    // reference that tile, and calculate u,v
-    findRefTile( tile );
-    
-    // must remove it from the load queue for now
-    
-    // TODO
-    goto DONE;
-    // return;
-    // assert( false ); // NIY
+    if( claimed )
+      // queuedCount is left as it is. The loader that reserved this tile will
+      // find one tile less than it expected, and go back to waiting.
+      __atomic_store_n( &(tile->loadState), LOAD_IN_PROGRESS,
+			__ATOMIC_RELAXED );
+    else
+    {
+      error = threading_cond_wait( &loadedCondition, &loadQueueMutex );
+      assert( error == NULL );
+    }
   }
 
-  fseek( file, 0, SEEK_END); // seek to end of file
-  size = ftell( file ); // get current file pointer
-  fseek( file, 0, SEEK_SET); // seek back to beginning of file
-  
-  // proceed with allocating memory and reading the file
-  tile->typeData.loadedTile.pngData.buffer = malloc( size );
-  assert( tile->typeData.loadedTile.pngData.buffer != NULL );
-  tile->typeData.loadedTile.pngData.remainingBytes = size;
+  threading_mutex_unlock( &loadQueueMutex );
 
-  itemCount = fread( tile->typeData.loadedTile.pngData.buffer, size, 1, file );
-  assert( itemCount == 1 );
+  if( !claimed )
+    TRACE_TILE( traceStart, "wait for loader", tile->z, tile->x, tile->y );
 
-  fclose( file );
+  return claimed;
+}
 
-  tile->typeData.loadedTile.textureID = -1;
-  tile->typeData.loadedTile.inRAM = true;
-  tile->type = TILE_HAS_TEXTURE;
+// called from the loading thread
+static void findRefTile( TileTexture tile )
+{
+  int steps;
+  TileTexture upTile;
+  uint64_t traceStart = TRACE_START();
 
- DONE:
-  // remove from load queue
-  threading_mutex_lock( &loadQueueMutex );
-  validateLoadQueues();
+  // printf( "findRefTile( %p: %d, %d, %d )\n", tile, tile->z, tile->x, tile->y );
 
-  if( tile->visible )
+  // go straight to the nearest ancestor that exists, without creating or
+  // loading the missing ones in between
+  for( steps = 1; steps <= tile->z; steps++ )
+    if( tileIndex_has( tile->z - steps, tile->x >> steps, tile->y >> steps ) )
+      break;
+
+  if( steps > tile->z )
   {
-    visibleLoadQueueHead = tile->nextInQueue;
-    
-    if( visibleLoadQueueHead == NULL )
-      visibleLoadQueueTail = NULL;
-    else
-      visibleLoadQueueHead->prevInQueue = NULL;
+    tile->type = TILE_NO_DATA;
+    TRACE_TILE( traceStart, "find ref tile", tile->z, tile->x, tile->y );
+    return;
   }
-  else
+
+  upTile = tileLookup( tile->z - steps, tile->x >> steps, tile->y >> steps,
+		       true );
+  if( tileClaim( upTile ) ) // not loaded yet; load now
+    loadTile( upTile );
+
+  refAncestor( tile, upTile, steps );
+
+  tileUnpin( upTile );
+  TRACE_TILE( traceStart, "find ref tile", tile->z, tile->x, tile->y );
+}
+
+/*
+ * Makes the tile refer to its part of the loaded ancestor steps levels up,
+ * or marks it as having no data, like the ancestor.
+ */
+static void refAncestor( TileTexture tile, TileTexture upTile, int steps )
+{
+  TileTexture refTile = NULL;  // set unless TILE_NO_DATA
+  double u1, v1, uvScale, upScale;
+
+  ancestorUV( tile, steps, &u1, &v1, &uvScale );
+
+  switch( upTile->type )
   {
-    assert( invisibleLoadQueueHead != NULL ); // this triggers
+    case TILE_HAS_TEXTURE:
+      // got it!
+      refTile = upTile;
+      break;
 
-    if( tile->prevInQueue == NULL )
-      invisibleLoadQueueHead = tile->nextInQueue;
-    else
-      tile->prevInQueue->nextInQueue = tile->nextInQueue;
+    case TILE_REFS_TEXTURE:
+      // the ancestor's data could not be read after all, and it is drawn
+      // from a part of its own ancestor
+      refTile = upTile->cold->otherTile.otherTile;
+      upScale = upTile->cold->otherTile.u2 - upTile->cold->otherTile.u1;
+
+      u1 = upTile->cold->otherTile.u1 + u1 * upScale;
+      v1 = upTile->cold->otherTile.v1 + v1 * upScale;
+      uvScale *= upScale;
+      break;
 
-    if( tile->nextInQueue == NULL )
-      invisibleLoadQueueTail = tile->prevInQueue;
-    else
-      tile->nextInQueue->prevInQueue = tile->prevInQueue;
+    case TILE_NO_DATA:
+      // no data for the parent
+      tile->type = TILE_NO_DATA;
+      break;
 
-    // printf( "loadTile: invisibleLoadQueueHead set to %p\n", invisibleLoadQueueHead );
+    case TILE_NEW:
+      assert( false );
+  } // endo of switch
+
+  if( tile->type != TILE_NO_DATA )
+  {
+    tile->cold->otherTile.otherTile = refTile;
+    tile->cold->otherTile.u1 = u1;
+    tile->cold->otherTile.u2 = u1 + uvScale;
+    tile->cold->otherTile.v1 = v1;
+    tile->cold->otherTile.v2 = v1 + uvScale;
+  }
+
+  threading_mutex_lock( &loadQueueMutex );
+  if( tile->type != TILE_NO_DATA )
+  {
+    // the referenced tile must stay in the cache as long as this one does
+    tile->type = TILE_REFS_TEXTURE;
+    refTile->refsCount++;
+  }
+  threading_mutex_unlock( &loadQueueMutex );
 #if 0
-    if( invisibleLoadQueueHead == NULL )
-      invisibleLoadQueueTail = NULL;
-    else
-      invisibleLoadQueueHead->prevInQueue = NULL;
+  if( tile->type == TILE_NO_DATA )
+    printf( "findRefTile got no data\n" );
+  else
+    printf( "findRefTile of (%p: %d, %d, %d) is (%p: %d, %d, %d; u(%f, %f), v(%f %f)\n",
+	    tile, tile->z, tile->x, tile->y, refTile, refTile->z, refTile->x, refTile->y,
+	    tile->cold->otherTile.u1, tile->cold->otherTile.u2,
+	    tile->cold->otherTile.v1, tile->cold->otherTile.v2 );
 #endif
-    assert( ((invisibleLoadQueueHead == NULL) && (invisibleLoadQueueTail == NULL) ) ||
-	    ((invisibleLoadQueueHead != NULL) && (invisibleLoadQueueTail != NULL) ) );
+}
+
+/*
+ * Gives up on a loaded tile whose image can't be decoded, so that it is not
+ * decoded again every frame. Like a missing tile, it is drawn from its
+ * ancestor, if one is loaded; otherwise it is not drawn at all. GL thread
+ * only, before the tile has an atlas slot.
+ */
+static void tileBroken( TileTexture tile )
+{
+  TileTexture upTile = NULL;
+  int steps;
+
+  assert( (tile->type == TILE_HAS_TEXTURE) && (tile->atlasSlot == -1) );
+  assert( tile->cold->loadedTile.pixels == NULL );
+
+  __atomic_fetch_sub( &cacheBytes, tile->cold->loadedTile.pngData.size,
+		      __ATOMIC_RELAXED );
+  tileSource_release( &(tile->cold->loadedTile.pngData) );
+  if( tile->cold->loadedTile.lz4Pixels != NULL )
+  {
+    __atomic_fetch_sub( &lz4Bytes, tile->cold->loadedTile.lz4Size,
+			__ATOMIC_RELAXED );
+    free( tile->cold->loadedTile.lz4Pixels );
   }
-  tile->nextInQueue = NULL;
-  tile->prevInQueue = NULL;
-  
-  // someone may be waiting for the queue to be empty
-  pthread_cond_broadcast( &loadQueueCondition );
+
+  // tiles are only freed on this thread, so the ancestor found stays valid
+  for( steps = 1; steps <= tile->z; steps++ )
+  {
+    upTile = tileMap_find( tileMap, tileKey_make( tile->z - steps,
+						  tile->x >> steps,
+						  tile->y >> steps ), NULL );
+    if( (upTile != NULL) && tileIsLoaded( upTile ) )
+      break;
+    upTile = NULL;
+  }
+
+  if( upTile != NULL )
+    refAncestor( tile, upTile, steps );
+  else
+    tile->type = TILE_NO_DATA;
+}
+
+/*
+ * The part of the ancestor steps levels up that the tile covers, as the
+ * top left u, v and the size. TMS y counts up from the south, texture rows
+ * count down from the north.
+ */
+static void ancestorUV( const sTileTexture *tile, int steps, double *u1,
+			double *v1, double *uvScale )
+{
+  uint32_t mask = (1 << steps) - 1;
+
+  *uvScale = 1.0 / (1 << steps);
+  *u1 = (tile->x & mask) * *uvScale;
+  *v1 = (mask - (tile->y & mask)) * *uvScale;
+}
+
+static void loadTile( TileTexture tile )
+{
+  bool found;
+  uint64_t traceStart = TRACE_START(), mapStart = traceStart,
+    loadStart = eventTrace_now(), millis;
+  int bucket, z;
+  uint32_t x, y;
+
 #if 0
-  printf( "LoadTile exit: VisibieLoadQueue: " );
-  printLoadQueue( visibleLoadQueueHead );
-  printf( "invisibieLoadQueue: " );
-  printLoadQueue( invisibleLoadQueueHead );
+  printf( "loading tile %p: %d, %d, %d\n", tile, tile->z, tile->x, tile->y );
 #endif
-  validateLoadQueues();
+  found = tileSource_map( tile->z, tile->x, tile->y,
+			  &(tile->cold->loadedTile.pngData) );
+  TRACE_TILE( mapStart, "map file", tile->z, tile->x, tile->y );
+  if( !found )
+  {
+    // missing tiles are not even looked for, so this one is unreadable
+    if( tileIndex_has( tile->z, tile->x, tile->y ) )
+      printf( "failed to load %d/%d/%d\n", tile->z, tile->x, tile->y );
+    // tile->type = TILE_REFS_TEXTURE;
+
+    // Look for the tile higher up in the zoom hierarchy (recursively)
+    // reference that tile, and calculate u,v
+    findRefTile( tile );
+    
+    goto DONE;
+  }
+
+  tile->cold->loadedTile.pixels = NULL;
+  tile->cold->loadedTile.lz4Pixels = NULL;
+
+  // visible tiles are needed right away, so they may grow the pool. ETC1
+  // tiles are uploaded as they are, or decoded when drawn if the GPU can't.
+  if( (tileETC1Blocks( tile ) == NULL) && !readCachedTile( tile ) )
+  {
+    if( !decodeTile( tile, tileIsVisible( tile ) ) )
+    {
+      // drawn from its ancestor, like a missing tile
+      tileSource_release( &(tile->cold->loadedTile.pngData) );
+      findRefTile( tile );
+      found = false;
+    }
+    // not for the tiles the render thread decodes: compressing and writing
+    // would stall the frame. Those are decoded again at the next start.
+    else if( tile->cold->loadedTile.pixels != NULL )
+    {
+      packTile( tile );
+      writeCachedTile( tile );
+    }
+  }
+
+ DONE:
+  threading_mutex_lock( &loadQueueMutex );
+
+  if( found )
+  {
+    tile->type = TILE_HAS_TEXTURE;
+    __atomic_fetch_add( &cacheBytes, tile->cold->loadedTile.pngData.size,
+			__ATOMIC_RELAXED );
+  }
+
+  tileLoaded( tile );
+  // once unlocked, the render thread may free the tile
+  z = tile->z;
+  x = tile->x;
+  y = tile->y;
   threading_mutex_unlock( &loadQueueMutex );
+
+  // nested loads of ancestors count in their descendant's time as well
+  millis = (eventTrace_now() - loadStart) / 1000000;
+  for( bucket = 0; (millis > 0) && (bucket < TILE_TEX_LOAD_BUCKETS - 1);
+       bucket++ )
+    millis >>= 1;
+  __atomic_fetch_add( &(statLoadTimes[ bucket ]), 1, __ATOMIC_RELAXED );
+
+  TRACE_TILE( traceStart, "load", z, x, y );
 }
 
-/* Returns texture ID */
-GLuint tileTex_makeTextureID( TileTexture tile )
+/* Must be called with loadQueueMutex locked */
+static void tileLoaded( TileTexture tile )
 {
-  GLubyte *imageBuffer;
+  assert( tile->loadState == LOAD_IN_PROGRESS );
+  assert( tile->queueWorker == -1 );
+
+  // the render thread checks this without locking, see tileIsLoaded
+  __atomic_store_n( &(tile->loadState), LOAD_DONE, __ATOMIC_RELEASE );
+  __atomic_fetch_add( &statLoaded, 1, __ATOMIC_RELAXED );
+
+  if( tile->visible )
+    __atomic_fetch_sub( &pendingVisibleCount, 1, __ATOMIC_RELAXED );
+
+  // someone may be waiting for the visible tiles, or for this tile
+  pthread_cond_broadcast( &loadedCondition );
+}
+
+/*
+ * Decodes the tile's image into a buffer from the pixel pool. If the pool
+ * has no buffer to spare, the tile is left undecoded. Returns false if the
+ * image is bad, after reporting it.
+ */
+static bool decodeTile( TileTexture tile, bool mayGrow )
+{
+  sTileImage image;
+  uint64_t traceStart = TRACE_START();
   Error error;
-  int width, height; // texture width, height
-  
-  switch( tile->type )
+
+  image.pixels = pixelPool_get( mayGrow );
+  if( image.pixels == NULL )
+    return true;
+
+  image.size = pixelPool_bufferSize();
+  image.format = pixelFormat;
+
+  error = tileDecoder_decode( tile->cold->loadedTile.pngData.data,
+			      tile->cold->loadedTile.pngData.size, &image );
+  // atlas slots are tile sized
+  if( (error == NULL) &&
+      ((image.width != TILE_ATLAS_TILE_SIZE) ||
+       (image.height != TILE_ATLAS_TILE_SIZE)) )
+    error = ErrNew( ERR_APP, 0, NULL, "tile %d/%d/%d is %dx%d, not %dx%d",
+		    tile->z, tile->x, tile->y, image.width, image.height,
+		    TILE_ATLAS_TILE_SIZE, TILE_ATLAS_TILE_SIZE );
+
+  if( error != NULL )
   {
-    case TILE_NO_DATA:
-      // printf( "tile has no data, don't make texture ID.\n" );
-      return -1;
+    ErrReport( error );
+    ErrDispose( error, true );
+    pixelPool_release( image.pixels );
+    return false;
+  }
 
-    case TILE_REFS_TEXTURE:
-      // return tileTex_makeTextureID( tile->typeData.otherTile.otherTile );
-      return -1;
-      
-    case TILE_HAS_TEXTURE:
-      if( tile->typeData.loadedTile.textureID != -1 )
-	return tile->typeData.loadedTile.textureID;
+  tile->cold->loadedTile.width = image.width;
+  tile->cold->loadedTile.height = image.height;
+  tile->cold->loadedTile.pixels = image.pixels;
+  __atomic_fetch_add( &statDecodes, 1, __ATOMIC_RELAXED );
+  TRACE_TILE( traceStart, "decode", tile->z, tile->x, tile->y );
 
-      // generate texture ID
-      glGenTextures( 1, &(tile->typeData.loadedTile.textureID) );
-      assert( glGetError() == GL_NO_ERROR );
+  return true;
+}
 
-      glBindTexture(GL_TEXTURE_2D, tile->typeData.loadedTile.textureID ); // texture_map[ i ]);
-      assert( glGetError() == GL_NO_ERROR );
+/*
+ * Keeps an LZ4 compressed copy of the tile's decoded pixels, so that it can
+ * be uploaded again without decoding it, if its atlas slot is taken.
+ */
+static void packTile( TileTexture tile )
+{
+  int size, bound;
+  char *packed, *shrunk;
+  uint64_t traceStart;
 
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, /* GL_NEAREST */ GL_LINEAR );
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, /* GL_NEAREST */ GL_LINEAR );
-      assert( glGetError() == GL_NO_ERROR );
+  // the disk cache is written from the LZ4 copy, even without the tier
+  if( ((lz4Budget == 0) && !tileDiskCache_isOpen()) ||
+      (tile->cold->loadedTile.lz4Pixels != NULL) )
+    return;
 
-      // decompress PNG. Would be interesting to profile how long this call takes.
-      error = loadPngFromMemory( &(tile->typeData.loadedTile.pngData),
-				 &imageBuffer, &width, &height );
-      assert( error == NULL );
-      
-      glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-			GL_UNSIGNED_BYTE, imageBuffer );
-      assert( glGetError() == GL_NO_ERROR );
+  traceStart = TRACE_START();
+  size = tile->cold->loadedTile.width * tile->cold->loadedTile.height *
+    tileDecoder_pixelBytes( pixelFormat );
+  bound = LZ4_compressBound( size );
+  packed = malloc( bound );
+  if( packed == NULL )
+    return;
 
-      free( imageBuffer );
+  bound = LZ4_compress_default( (const char *) tile->cold->loadedTile.pixels,
+				packed, size, bound );
+  if( bound <= 0 )
+  {
+    free( packed );
+    return;
+  }
 
-      return tile->typeData.loadedTile.textureID;
-      break;
+  // give back the worst case slack
+  shrunk = realloc( packed, bound );
+  tile->cold->loadedTile.lz4Pixels = (shrunk != NULL) ? shrunk : packed;
+  tile->cold->loadedTile.lz4Size = bound;
+  __atomic_fetch_add( &lz4Bytes, bound, __ATOMIC_RELAXED );
+  TRACE_TILE( traceStart, "LZ4 pack", tile->z, tile->x, tile->y );
+}
 
-  default:
-    assert( false );
+/* Decompresses the tile's LZ4 copy into a pixel pool buffer */
+static bool unpackTile( TileTexture tile, bool mayGrow )
+{
+  GLubyte *pixels;
+  int size;
+  uint64_t traceStart = TRACE_START();
+
+  size = tile->cold->loadedTile.width * tile->cold->loadedTile.height *
+    tileDecoder_pixelBytes( pixelFormat );
+  pixels = pixelPool_get( mayGrow );
+  if( pixels == NULL )
+    return false;
+
+  if( LZ4_decompress_safe( tile->cold->loadedTile.lz4Pixels, (char *) pixels,
+			   tile->cold->loadedTile.lz4Size,
+			   pixelPool_bufferSize() ) != size )
+  {
+    printf( "corrupt LZ4 tile %d/%d/%d\n", tile->z, tile->x, tile->y );
+    pixelPool_release( pixels );
+    return false;
   }
+
+  tile->cold->loadedTile.pixels = pixels;
+  __atomic_fetch_add( &statLz4Hits, 1, __ATOMIC_RELAXED );
+  TRACE_TILE( traceStart, "LZ4 unpack", tile->z, tile->x, tile->y );
+
+  return true;
 }
 
-static Error loadPngFromMemory( const sMemPNG *pngData, GLubyte **outData,
-				int *outWidth, int *outHeight )
-{
-  png_structp png_ptr;
-  png_infop info_ptr;
-  sMemPNG memPNG;
-
-  assert( pngData != NULL );
-  memPNG = *pngData;
-
-  /* Create and initialize the png_struct
-   * with the desired error handler
-   * functions.  If you want to use the
-   * default stderr and longjump method,
-   * you can supply NULL for the last
-   * three parameters.  We also supply the
-   * the compiler header file version, so
-   * that we know if the application
-   * was compiled with a compatible version
-   * of the library.  REQUIRED
-   */
-  png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING,
-				   NULL, NULL, NULL);
-
-  if (png_ptr == NULL)
-    return ErrNew( ERR_APP, 0, NULL, "png_create_read_struct failed" );
-
-  /* Allocate/initialize the memory
-   * for image information.  REQUIRED. */
-  info_ptr = png_create_info_struct(png_ptr);
-  if (info_ptr == NULL)
-    return ErrNew( ERR_APP, 0, NULL, "png_create_info_struct failed" );
-
-  /* Set error handling if you are
-   * using the setjmp/longjmp method
-   * (this is the normal method of
-   * doing things with libpng).
-   * REQUIRED unless you  set up
-   * your own error handlers in
-   * the png_create_read_struct()
-   * earlier.
-   */
-  if (setjmp(png_jmpbuf(png_ptr))) {
-    /* Free all of the memory associated
-     * with the png_ptr and info_ptr */
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-
-    /* If we get here, we had a
-     * problem reading the file */
-    return ErrNew( ERR_APP, 0, NULL, "png_jmbuf problem" );
-  }
-
-  /* Set up the output control if
-   * you are using standard C streams */
-  // png_init_io(png_ptr, (png_FILE_p) &memPNG );
-  png_set_read_fn( png_ptr, (png_rw_ptr) &memPNG,
-		   (png_rw_ptr) png_memoryReadFunc );
-
-  /* If we have already
-   * read some of the signature */
-  // png_set_sig_bytes(png_ptr, sig_read);
+/*
+ * Takes the tile's LZ4 copy from the disk cache, if it has the tile, and
+ * unpacks it if the pool has a buffer to spare, as decodeTile would.
+ */
+static bool readCachedTile( TileTexture tile )
+{
+  sTileBlob cached;
+  int width, height;
+  char *lz4;
+  uint64_t traceStart = TRACE_START();
+
+  if( !tileDiskCache_isOpen() ||
+      !tileDiskCache_map( tile->z, tile->x, tile->y,
+			  &(tile->cold->loadedTile.pngData), pixelFormat,
+			  &cached, &width, &height ) )
+    return false;
+
+  if( (width != TILE_ATLAS_TILE_SIZE) || (height != TILE_ATLAS_TILE_SIZE) ||
+      ((lz4 = malloc( cached.size )) == NULL) )
+  {
+    tileSource_release( &cached );
+    return false;
+  }
 
-  /*
-   * If you have enough memory to read
-   * in the entire image at once, and
-   * you need to specify only
-   * transforms that can be controlled
-   * with one of the PNG_TRANSFORM_*
-   * bits (this presently excludes
-   * dithering, filling, setting
-   * background, and doing gamma
-   * adjustment), then you can read the
-   * entire image (including pixels)
-   * into the info structure with this
-   * call
-   *
-   * PNG_TRANSFORM_STRIP_16 |
-   * PNG_TRANSFORM_PACKING  forces 8 bit
-   * PNG_TRANSFORM_EXPAND forces to
-   *  expand a palette into RGB
-   */
-  png_read_png(png_ptr, info_ptr, PNG_TRANSFORM_STRIP_16 |
-	       PNG_TRANSFORM_PACKING | PNG_TRANSFORM_EXPAND, NULL);
-
-  png_uint_32 width, height;
-  int bit_depth;
-  int color_type, interlace_type;
-
-  png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type,
-	       &interlace_type, NULL, NULL);
-  if( outWidth != NULL )
-    *outWidth = width;
-  if( outHeight != NULL )
-    *outHeight = height;
-
-  unsigned int row_bytes = png_get_rowbytes(png_ptr, info_ptr);
-  *outData = (unsigned char*) malloc(row_bytes * height);
-
-  png_bytepp row_pointers = png_get_rows(png_ptr, info_ptr);
+  memcpy( lz4, cached.data, cached.size );
+  tile->cold->loadedTile.lz4Pixels = lz4;
+  tile->cold->loadedTile.lz4Size = cached.size;
+  tile->cold->loadedTile.width = width;
+  tile->cold->loadedTile.height = height;
+  __atomic_fetch_add( &lz4Bytes, cached.size, __ATOMIC_RELAXED );
+  tileSource_release( &cached );
+  __atomic_fetch_add( &statDiskHits, 1, __ATOMIC_RELAXED );
+  TRACE_TILE( traceStart, "disk cache read", tile->z, tile->x, tile->y );
 
-  int i;
-  for (i = 0; i < height; i++) {
-    // note that png is ordered top to
-    // bottom, but OpenGL expect it bottom to top
-    // so the order or swapped
-    // memcpy(*outData+(row_bytes * (height-1-i)), row_pointers[i], row_bytes);
-    memcpy(*outData+(row_bytes * i), row_pointers[i], row_bytes);
+  unpackTile( tile, tileIsVisible( tile ) );
+
+  return true;
+}
+
+/* Saves the tile's LZ4 copy, made by packTile, in the disk cache */
+static void writeCachedTile( TileTexture tile )
+{
+  uint64_t traceStart = TRACE_START();
+
+  if( !tileDiskCache_isOpen() || (tile->cold->loadedTile.lz4Pixels == NULL) )
+    return;
+
+  if( tileDiskCache_write( tile->z, tile->x, tile->y,
+			   &(tile->cold->loadedTile.pngData), pixelFormat,
+			   tile->cold->loadedTile.width,
+			   tile->cold->loadedTile.height,
+			   tile->cold->loadedTile.lz4Pixels,
+			   tile->cold->loadedTile.lz4Size ) )
+    __atomic_fetch_add( &statDiskWrites, 1, __ATOMIC_RELAXED );
+  TRACE_TILE( traceStart, "disk cache write", tile->z, tile->x, tile->y );
+}
+
+/* The tile's ETC1 blocks, if it was read from a tile sized PKM file */
+static const unsigned char *tileETC1Blocks( const sTileTexture *tile )
+{
+  const unsigned char *blocks;
+  int width, height;
+
+  if( !etc1_parsePkm( tile->cold->loadedTile.pngData.data,
+		      tile->cold->loadedTile.pngData.size, &width, &height,
+		      &blocks ) ||
+      (width != TILE_ATLAS_TILE_SIZE) || (height != TILE_ATLAS_TILE_SIZE) )
+    return NULL;
+
+  return blocks;
+}
+
+/*
+ * Returns the ID of the atlas page holding the tile's texture, or the texture
+ * of the tile it refers to, uploading it if needed. -1 if there is nothing
+ * to draw.
+ */
+GLuint tileTex_makeTextureID( TileTexture tile )
+{
+  return tileTexture( tile, true );
+}
+
+/*
+ * Returns what to draw for the tile right now, without waiting for loaders:
+ * its own texture, the texture it refers to, or else part of the texture of
+ * its nearest ancestor that is already loaded. u, v are in the texture's
+ * atlas page. When progressive, uploads are limited to
+ * TILE_UPLOADS_PER_FRAME per frame, so tiles beyond that are drawn from an
+ * ancestor until a later frame.
+ */
+GLuint tileTex_getTexture( TileTexture tile, float *u0, float *v0, float *u1,
+			   float *v1 )
+{
+  TileTexture upTile;
+  GLuint textureID;
+  double upU1, upV1, uvScale;
+  float upU0, upV0, upU2, upV2;
+  int steps;
+  bool mayUpload = !limitUploads || (uploadsLeft > 0);
+
+  if( tileIsLoaded( tile ) )
+  {
+    textureID = tileTexture( tile, mayUpload );
+    if( textureID != -1 )
+    {
+      tileTex_getUV( tile, u0, v0, u1, v1 );
+      return textureID;
+    }
+
+    if( tile->type == TILE_NO_DATA )
+      return -1;
   }
 
-  /* Clean up after the read,
-   * and free any memory allocated */
-  png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+  // tiles are only freed on this thread, so the ancestors found stay valid
+  for( steps = 1; steps <= tile->z; steps++ )
+  {
+    upTile = tileMap_find( tileMap, tileKey_make( tile->z - steps,
+						  tile->x >> steps,
+						  tile->y >> steps ), NULL );
+    if( (upTile == NULL) || !tileIsLoaded( upTile ) )
+      continue;
+
+    textureID = tileTexture( upTile, mayUpload );
+    if( textureID == -1 )
+      continue;
+
+    // the tile's part of the ancestor's part of the texture
+    tileTex_getUV( upTile, &upU0, &upV0, &upU2, &upV2 );
+    ancestorUV( tile, steps, &upU1, &upV1, &uvScale );
+
+    *u0 = upU0 + upU1 * (upU2 - upU0);
+    *u1 = upU0 + (upU1 + uvScale) * (upU2 - upU0);
+    *v0 = upV0 + upV1 * (upV2 - upV0);
+    *v1 = upV0 + (upV1 + uvScale) * (upV2 - upV0);
+
+    return textureID;
+  }
 
-  /* That's it */
-  return NULL;  // no error
+  return -1;
 }
 
-static void png_memoryReadFunc( png_structp png_ptr, png_bytep outBytes,
-				png_size_t byteCountToRead )
+bool tileTex_isFinal( TileTexture tile )
 {
-  MemPNG memPNG = (MemPNG) png_get_io_ptr(png_ptr);
-  size_t actualReadCount;
-  
-  if( memPNG == NULL)
-    return;   // add custom error handling here
+  if( tile == &noDataTile )
+    return true;
+  if( !tileIsLoaded( tile ) )
+    return false;
 
-  if( byteCountToRead > memPNG->remainingBytes )
-    actualReadCount = memPNG->remainingBytes;
-  else
-    actualReadCount = byteCountToRead;
-  
-  // TODO: check that we don't read past our memory buffer
-  // would be nice if we could do this without copy
-  memcpy( outBytes, memPNG->buffer, actualReadCount );
+  // missing tiles are final when drawn from their ancestor
+  return (tile->type != TILE_HAS_TEXTURE) || (tile->atlasSlot != -1);
+}
 
-  memPNG->remainingBytes -= actualReadCount;
-  memPNG->buffer += actualReadCount;
-  
-#if 0
-  if((png_size_t)bytesRead != byteCount)
-    return;   // add custom error handling here
-#endif
+/*
+ * The render thread's part of loading a tile. If mayUpload is false, only
+ * a texture already in the atlas is returned.
+ */
+static GLuint tileTexture( TileTexture tile, bool mayUpload )
+{
+  uint64_t uploadStart;
+
+  switch( tile->type )
+  {
+    case TILE_NEW:
+    case TILE_NO_DATA:
+      // printf( "tile has no data, don't make texture ID.\n" );
+      return -1;
+
+    case TILE_REFS_TEXTURE:
+      return tileTexture( tile->cold->otherTile.otherTile, mayUpload );
+      
+    case TILE_HAS_TEXTURE:
+      if( tile->atlasSlot != -1 )
+	return tileAtlas_use( tile->atlasSlot );
+
+      if( !mayUpload )
+	return -1;
+
+      // ETC1 tiles go to the GPU straight from the mapped file
+      if( (tile->cold->loadedTile.pixels == NULL) && tileAtlas_hasETC1() &&
+	  (tileETC1Blocks( tile ) != NULL) )
+      {
+	tile->atlasSlot = tileAtlas_alloc( &(tile->atlasSlot), true );
+	if( tile->atlasSlot == -1 )
+	  return -1;
+
+	uploadStart = TRACE_START();
+	tileAtlas_uploadETC1( tile->atlasSlot, tileETC1Blocks( tile ) );
+	TRACE_TILE( uploadStart, "upload ETC1", tile->z, tile->x, tile->y );
+	uploadsLeft--;
+	return tileAtlas_use( tile->atlasSlot );
+      }
+
+      // normally decoded by the loader, unless the pool was exhausted or the
+      // tile's atlas slot was taken by another tile. Then the LZ4 copy is
+      // much quicker to unpack than decoding again.
+      if( (tile->cold->loadedTile.pixels == NULL) &&
+	  ((tile->cold->loadedTile.lz4Pixels == NULL) ||
+	   !unpackTile( tile, true )) )
+      {
+	// a bad image uses up an upload too, and is not decoded again
+	if( !decodeTile( tile, true ) )
+	{
+	  uploadsLeft--;
+	  tileBroken( tile );
+	  return -1;
+	}
+	if( tile->cold->loadedTile.pixels == NULL )
+	  return -1;
+      }
+
+      tile->atlasSlot = tileAtlas_alloc( &(tile->atlasSlot), false );
+      if( tile->atlasSlot == -1 )
+	return -1;  // every slot is drawn in this frame; keep the pixels
+
+      uploadStart = TRACE_START();
+      tileAtlas_upload( tile->atlasSlot, tile->cold->loadedTile.width,
+			tile->cold->loadedTile.height,
+			tile->cold->loadedTile.pixels );
+      TRACE_TILE( uploadStart, "upload", tile->z, tile->x, tile->y );
+      uploadsLeft--;
+
+      pixelPool_release( tile->cold->loadedTile.pixels );
+      tile->cold->loadedTile.pixels = NULL;
+
+      return tileAtlas_use( tile->atlasSlot );
+
+  default:
+    assert( false );
+  }
 }
 
 void tileTex_waitVisibleLoaded()
 {
+  uint64_t traceStart = TRACE_START();
+
   threading_mutex_lock( &loadQueueMutex );
-  validateLoadQueues();
 
   // printf( "waitVisibleLoaded entry: " );
   // printVisibleLoadQueue();
   
-  while( visibleLoadQueueHead != NULL )
+  while( pendingVisibleCount > 0 )
   {
     Error error;
     
-    error = threading_cond_wait( &loadQueueCondition, &loadQueueMutex );
+    error = threading_cond_wait( &loadedCondition, &loadQueueMutex );
     assert( error == NULL );
   }
 
   threading_mutex_unlock( &loadQueueMutex );
+
+  TRACE_END( traceStart, "wait visible" );
 }
 
 static void printLoadQueue( const sTileTexture *head )
@@ -832,51 +1485,460 @@ static void printLoadQueue( const sTileTexture *head )
   printf( "\n" );
 }
 
-static void validateLoadQueues()
+/* Must be called with the worker's mutex locked */
+static void validateLoadQueues( const sLoadWorker *worker )
 {
-  assert( ((visibleLoadQueueHead == NULL) && (visibleLoadQueueTail == NULL) ) ||
-	  ((visibleLoadQueueHead != NULL) && (visibleLoadQueueTail != NULL) ));
-  // triggers on long run to top.
-  assert( ((invisibleLoadQueueHead == NULL) && (invisibleLoadQueueTail == NULL) ) ||
-  	  ((invisibleLoadQueueHead != NULL) && (invisibleLoadQueueTail != NULL) ));
+  assert( ((worker->visibleHead == NULL) && (worker->visibleTail == NULL) ) ||
+	  ((worker->visibleHead != NULL) && (worker->visibleTail != NULL) ));
+  assert( ((worker->invisibleHead == NULL) && (worker->invisibleTail == NULL) ) ||
+  	  ((worker->invisibleHead != NULL) && (worker->invisibleTail != NULL) ));
 
-  if( visibleLoadQueueHead != NULL )
+  if( worker->visibleHead != NULL )
   {
-    assert( visibleLoadQueueHead->prevInQueue == NULL );
-    assert( visibleLoadQueueTail->nextInQueue == NULL );
-    assert( visibleLoadQueueHead->visible );
-    assert( visibleLoadQueueTail->visible );
+    assert( worker->visibleHead->prevInQueue == NULL );
+    assert( worker->visibleTail->nextInQueue == NULL );
+    assert( worker->visibleHead->visible );
+    assert( worker->visibleTail->visible );
   }
 
-  if( invisibleLoadQueueHead != NULL )
+  if( worker->invisibleHead != NULL )
   {
-    assert( invisibleLoadQueueHead->prevInQueue == NULL );
-    assert( invisibleLoadQueueTail->nextInQueue == NULL );
-    assert( !invisibleLoadQueueHead->visible );
-    assert( !invisibleLoadQueueTail->visible ); // this triggers on zooming demo, check why TODO
+    assert( worker->invisibleHead->prevInQueue == NULL );
+    assert( worker->invisibleTail->nextInQueue == NULL );
+    assert( !worker->invisibleHead->visible );
+    assert( !worker->invisibleTail->visible );
   }
+}
 
+/* Must be called with the mutex of the worker owning the queue locked */
+static void queuePushTail( TileTexture *head, TileTexture *tail,
+			   TileTexture tile )
+{
+  tile->nextInQueue = NULL;
+  tile->prevInQueue = *tail;
+
+  if( *tail == NULL )
+    *head = tile;
+  else
+    (*tail)->nextInQueue = tile;
+  *tail = tile;
 }
 
+/* Must be called with the mutex of the worker owning the queue locked */
+static void queueUnlink( TileTexture *head, TileTexture *tail,
+			 TileTexture tile )
+{
+  if( tile->prevInQueue == NULL )
+    *head = tile->nextInQueue;
+  else
+    tile->prevInQueue->nextInQueue = tile->nextInQueue;
+
+  if( tile->nextInQueue == NULL )
+    *tail = tile->prevInQueue;
+  else
+    tile->nextInQueue->prevInQueue = tile->prevInQueue;
+
+  tile->nextInQueue = NULL;
+  tile->prevInQueue = NULL;
+}
+
+/*
+ * Returns the tile's texture coordinates in its atlas page. Only valid after
+ * tileTex_makeTextureID has returned a texture for the tile in this frame.
+ */
 void tileTex_getUV( TileTexture tile, float *u0, float *v0, float *u1, float *v1 )
 {
+  int slot;
+
   switch( tile->type )
   {
     case TILE_HAS_TEXTURE:
+      slot = tile->atlasSlot;
+      *u0 = *v0 = 0.0f;
+      *u1 = *v1 = 1.0f;
+      break;
+
+    case TILE_REFS_TEXTURE:
+      slot = tile->cold->otherTile.otherTile->atlasSlot;
+      *u0 = tile->cold->otherTile.u1;
+      *u1 = tile->cold->otherTile.u2;
+      *v0 = tile->cold->otherTile.v1;
+      *v1 = tile->cold->otherTile.v2;
+      break;
+
     case TILE_NO_DATA:
     case TILE_NEW:
       *u0 = *v0 = 0.0f;
       *u1 = *v1 = 1.0f;
+      return;
+
+    default:
+      assert( FALSE );
+      return;
+  }
+
+  assert( slot != -1 );
+  tileAtlas_mapUV( slot, u0, v0 );
+  tileAtlas_mapUV( slot, u1, v1 );
+}
+
+/*
+ * Replaces the tiles waiting to be prefetched with those for the current
+ * view and motion. Tiles planned for an earlier view and not requested yet
+ * are dropped, and so are those outside the chart set's coverage.
+ */
+static void prefetchPlan( void )
+{
+  sTileBounds coverage[ TILE_INDEX_ZOOMS ];
+  bool covered[ TILE_INDEX_ZOOMS ];
+  TileBounds bounds;
+  PrefetchTile planned;
+  int i, count;
+
+  prefetchNext = 0;
+  prefetchCount = 0;
+
+  for( i = 0; i < TILE_INDEX_ZOOMS; i++ )
+  {
+    prefetchBounds[i].minX = prefetchBounds[i].minY = UINT32_MAX;
+    prefetchBounds[i].maxX = prefetchBounds[i].maxY = 0;
+  }
+
+  if( viewZ < 0 )
+    return;
+
+  count = tilePrefetch_plan( &prefetchPolicy, viewZ, &viewBounds,
+			     motionCourse, motionSpeed, prefetchTiles,
+			     PREFETCH_MAX_TILES );
+
+  for( i = 0; i < TILE_INDEX_ZOOMS; i++ )
+    covered[i] = tileIndex_getBounds( i, &(coverage[i]) );
+
+  // near the edge of the charts, much of the plan may be off them
+  for( i = 0; i < count; i++ )
+  {
+    planned = &(prefetchTiles[i]);
+
+    if( !covered[ planned->z ] ||
+	(planned->x < coverage[ planned->z ].minX) ||
+	(planned->x > coverage[ planned->z ].maxX) ||
+	(planned->y < coverage[ planned->z ].minY) ||
+	(planned->y > coverage[ planned->z ].maxY) )
+      continue;
+
+    bounds = &(prefetchBounds[ planned->z ]);
+
+    if( planned->x < bounds->minX )
+      bounds->minX = planned->x;
+    if( planned->x > bounds->maxX )
+      bounds->maxX = planned->x;
+    if( planned->y < bounds->minY )
+      bounds->minY = planned->y;
+    if( planned->y > bounds->maxY )
+      bounds->maxY = planned->y;
+
+    prefetchTiles[ prefetchCount++ ] = *planned;
+  }
+}
+
+/*
+ * Requests planned tiles, in order, until the policy's frame budget is used
+ * up. Only creating a tile counts; planned tiles that are cached already,
+ * or missing from the chart set, are passed over.
+ */
+static void prefetchRun( void )
+{
+  PrefetchTile planned;
+  TileTexture tile;
+  int budget = prefetchPolicy.frameBudget;
+
+  while( (budget > 0) && (prefetchNext < prefetchCount) )
+  {
+    planned = &(prefetchTiles[ prefetchNext++ ]);
+
+    if( !tileIndex_has( planned->z, planned->x, planned->y ) ||
+	(tileMap_find( tileMap, tileKey_make( planned->z, planned->x,
+					      planned->y ), NULL ) != NULL) )
+      continue;
+
+    tile = tileLookup( planned->z, planned->x, planned->y, false );
+    if( !tile->visible )
+      tile->cold->prefetched = true;
+    __atomic_fetch_add( &statPrefetched, 1, __ATOMIC_RELAXED );
+    budget--;
+  }
+}
+
+/*
+ * Whether an invisible tile is still worth loading: it is near the view, as
+ * far as the prefetch plan reaches.
+ */
+static bool prefetchWanted( const sTileTexture *tile )
+{
+  const sTileBounds *bounds;
+
+  if( (tile->z < 0) || (tile->z >= TILE_INDEX_ZOOMS) )
+    return false;
+
+  bounds = &(prefetchBounds[ tile->z ]);
+
+  return (tile->x >= bounds->minX) && (tile->x <= bounds->maxX) &&
+    (tile->y >= bounds->minY) && (tile->y <= bounds->maxY);
+}
+
+/*
+ * Frees the invisible tiles still waiting in a deque that are no longer
+ * near the view, e.g. those left behind by zooming, so the deques stay
+ * short however fast the view moves. Tiles pinned by a loader, which wants
+ * them as ancestors, are left alone.
+ */
+static void cancelStaleLoads( void )
+{
+  LoadWorker worker;
+  TileTexture tile, next;
+  int i;
+
+  threading_mutex_lock( &loadQueueMutex );
+
+  for( i = 0; i < workerCount; i++ )
+  {
+    worker = &(workers[i]);
+
+    threading_mutex_lock( &(worker->mutex) );
+
+    for( tile = worker->invisibleHead; tile != NULL; tile = next )
+    {
+      next = tile->nextInQueue;
+
+      if( prefetchWanted( tile ) ||
+	  !tileMap_remove( tileMap, tileKey_make( tile->z, tile->x, tile->y ),
+			   tileIsUnpinned ) )
+	continue;
+
+      queueUnlink( &(worker->invisibleHead), &(worker->invisibleTail), tile );
+      tile->queueWorker = -1;
+      // if a loader has already reserved the tile, it will find one less
+      if( queuedCount > 0 )
+	__atomic_fetch_sub( &queuedCount, 1, __ATOMIC_RELAXED );
+
+      tileFree( tile );
+      __atomic_fetch_add( &statCancelled, 1, __ATOMIC_RELAXED );
+    }
+
+    validateLoadQueues( worker );
+    threading_mutex_unlock( &(worker->mutex) );
+  }
+
+  threading_mutex_unlock( &loadQueueMutex );
+}
+
+/*
+ * True once a loader has finished with the tile. Its type and data may be
+ * read without locking after that.
+ */
+static bool tileIsLoaded( const sTileTexture *tile )
+{
+  return __atomic_load_n( &(tile->loadState), __ATOMIC_ACQUIRE ) == LOAD_DONE;
+}
+
+/* For loaders, which may read a stale value without loadQueueMutex */
+static bool tileIsVisible( const sTileTexture *tile )
+{
+  return __atomic_load_n( &(tile->visible), __ATOMIC_RELAXED );
+}
+
+/* Must be called with loadQueueMutex locked */
+static void lruUnlink( TileTexture tile )
+{
+  if( tile->lruNewer == NULL )
+    lruNewest = tile->lruOlder;
+  else
+    tile->lruNewer->lruOlder = tile->lruOlder;
+
+  if( tile->lruOlder == NULL )
+    lruOldest = tile->lruNewer;
+  else
+    tile->lruOlder->lruNewer = tile->lruNewer;
+
+  tile->lruNewer = NULL;
+  tile->lruOlder = NULL;
+}
+
+/* Must be called with loadQueueMutex locked */
+static void lruPushNewest( TileTexture tile )
+{
+  assert( tile->lruNewer == NULL );
+  assert( tile->lruOlder == NULL );
+
+  tile->lruOlder = lruNewest;
+  if( lruNewest == NULL )
+    lruOldest = tile;
+  else
+    lruNewest->lruNewer = tile;
+  lruNewest = tile;
+}
+
+/*
+ * Must be called with loadQueueMutex locked. Pins are checked when the tile
+ * is removed from the map.
+ */
+static bool tileIsEvictable( const sTileTexture *tile )
+{
+  return (tile->loadState == LOAD_DONE) && !tile->visible &&
+    (tile->refsCount == 0);
+}
+
+/*
+ * Must be called with loadQueueMutex locked, from the GL thread, once the
+ * tile has been removed from the map
+ */
+static void tileFree( TileTexture tile )
+{
+  lruUnlink( tile );
+  __atomic_fetch_sub( &tileCount, 1, __ATOMIC_RELAXED );
+  __atomic_fetch_sub( &cacheBytes,
+		      sizeof( sTileTexture ) + sizeof( sTileTexCold ),
+		      __ATOMIC_RELAXED );
+
+  if( tile->cold->prefetched )
+    __atomic_fetch_add( &statPrefetchWasted, 1, __ATOMIC_RELAXED );
+
+  switch( tile->type )
+  {
+    case TILE_HAS_TEXTURE:
+      if( tile->atlasSlot != -1 )
+	tileAtlas_free( tile->atlasSlot );
+      __atomic_fetch_sub( &cacheBytes, tile->cold->loadedTile.pngData.size,
+			  __ATOMIC_RELAXED );
+      tileSource_release( &(tile->cold->loadedTile.pngData) );
+      pixelPool_release( tile->cold->loadedTile.pixels );
+      if( tile->cold->loadedTile.lz4Pixels != NULL )
+      {
+	__atomic_fetch_sub( &lz4Bytes, tile->cold->loadedTile.lz4Size,
+			    __ATOMIC_RELAXED );
+	free( tile->cold->loadedTile.lz4Pixels );
+      }
       break;
 
     case TILE_REFS_TEXTURE:
-      *u0 = tile->typeData.otherTile.u1;
-      *u1 = tile->typeData.otherTile.u2;
-      *v0 = tile->typeData.otherTile.v1;
-      *v1 = tile->typeData.otherTile.v2;
+      assert( tile->cold->otherTile.otherTile->refsCount > 0 );
+      tile->cold->otherTile.otherTile->refsCount--;
       break;
 
     default:
-      assert( FALSE );
+      break;
+  }
+
+  slab_free( coldSlab, tile->cold );
+  slab_free( tileSlab, tile );
+}
+
+void tileTex_trimCache( void )
+{
+  TileTexture tile, newer;
+  int toScan;
+  uint64_t traceStart = TRACE_START();
+
+  assert( workerCount > 0 );  // tileTex_init failed or was not called
+
+  // called once per frame, after drawing
+  tileAtlas_endFrame();
+  uploadsLeft = TILE_UPLOADS_PER_FRAME;
+  prefetchRun();
+
+  threading_mutex_lock( &loadQueueMutex );
+
+  // tiles given a second chance are moved to the newest end, so stop after
+  // one pass over the list
+  toScan = tileCount;
+
+  for( tile = lruOldest;
+       (tile != NULL) && (cacheBytes > cacheBudget) && (toScan > 0);
+       tile = newer, toScan-- )
+  {
+    newer = tile->lruNewer;
+
+    if( tile->referenced )
+    {
+      tile->referenced = false;
+      lruUnlink( tile );
+      lruPushNewest( tile );
+      continue;
+    }
+
+    if( !tileIsEvictable( tile ) )
+      continue;
+
+    if( !tileMap_remove( tileMap, tileKey_make( tile->z, tile->x, tile->y ),
+			 tileIsUnpinned ) )
+      continue;
+
+    tileFree( tile );
+    __atomic_fetch_add( &statEvictions, 1, __ATOMIC_RELAXED );
   }
+
+  trimLz4Tier();
+
+  threading_mutex_unlock( &loadQueueMutex );
+
+  TRACE_END( traceStart, "trim cache" );
+}
+
+/*
+ * Drops the LZ4 copies of the least recently used tiles until the tier fits
+ * in its budget. The tiles keep their PNG data, and are decoded from it
+ * when needed again. Must be called with loadQueueMutex locked.
+ */
+static void trimLz4Tier( void )
+{
+  TileTexture tile;
+
+  for( tile = lruOldest;
+       (tile != NULL) &&
+	 (__atomic_load_n( &lz4Bytes, __ATOMIC_RELAXED ) > lz4Budget);
+       tile = tile->lruNewer )
+  {
+    // loaders only touch a tile's LZ4 copy until it is loaded
+    if( (tile->type != TILE_HAS_TEXTURE) || !tileIsLoaded( tile ) ||
+	(tile->cold->loadedTile.lz4Pixels == NULL) )
+      continue;
+
+    __atomic_fetch_sub( &lz4Bytes, tile->cold->loadedTile.lz4Size,
+			__ATOMIC_RELAXED );
+    free( tile->cold->loadedTile.lz4Pixels );
+    tile->cold->loadedTile.lz4Pixels = NULL;
+    __atomic_fetch_add( &statLz4Dropped, 1, __ATOMIC_RELAXED );
+  }
+}
+
+void tileTex_getStats( TileTexStats stats )
+{
+  int i;
+
+  stats->hits = __atomic_load_n( &statHits, __ATOMIC_RELAXED );
+  stats->misses = __atomic_load_n( &statMisses, __ATOMIC_RELAXED );
+  stats->evictions = __atomic_load_n( &statEvictions, __ATOMIC_RELAXED );
+  stats->loaded = __atomic_load_n( &statLoaded, __ATOMIC_RELAXED );
+  stats->stolen = __atomic_load_n( &statStolen, __ATOMIC_RELAXED );
+  stats->prefetched = __atomic_load_n( &statPrefetched, __ATOMIC_RELAXED );
+  stats->prefetchHits = __atomic_load_n( &statPrefetchHits, __ATOMIC_RELAXED );
+  stats->prefetchWasted = __atomic_load_n( &statPrefetchWasted,
+					   __ATOMIC_RELAXED );
+  stats->cancelled = __atomic_load_n( &statCancelled, __ATOMIC_RELAXED );
+  stats->queued = __atomic_load_n( &queuedCount, __ATOMIC_RELAXED );
+  stats->cacheBytes = __atomic_load_n( &cacheBytes, __ATOMIC_RELAXED );
+  stats->cacheBudget = cacheBudget;
+  stats->tileCount = __atomic_load_n( &tileCount, __ATOMIC_RELAXED );
+  stats->decodes = __atomic_load_n( &statDecodes, __ATOMIC_RELAXED );
+  stats->lz4Hits = __atomic_load_n( &statLz4Hits, __ATOMIC_RELAXED );
+  stats->lz4Dropped = __atomic_load_n( &statLz4Dropped, __ATOMIC_RELAXED );
+  stats->lz4Bytes = __atomic_load_n( &lz4Bytes, __ATOMIC_RELAXED );
+  stats->lz4Budget = lz4Budget;
+  stats->diskHits = __atomic_load_n( &statDiskHits, __ATOMIC_RELAXED );
+  stats->diskWrites = __atomic_load_n( &statDiskWrites, __ATOMIC_RELAXED );
+  stats->visibleQueued = __atomic_load_n( &pendingVisibleCount,
+					  __ATOMIC_RELAXED );
+  for( i = 0; i < TILE_TEX_LOAD_BUCKETS; i++ )
+    stats->loadTimes[i] = __atomic_load_n( &(statLoadTimes[i]),
+					   __ATOMIC_RELAXED );
 }
@@ -6,6 +6,7 @@
 #define TILE_TEXTURE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "GLES2/gl2.h"
@@ -13,16 +14,94 @@
 
 #include <voxi/util/err.h>
 
+#include "tileIndex.h"
+#include "tilePrefetch.h"
+
 typedef struct sTileTexture *TileTexture;
 
+/* load time histogram buckets: under 1 ms, 1-2 ms, 2-4 ms... and the rest */
+#define TILE_TEX_LOAD_BUCKETS 12
+
 // TODO: Create enum TILE_NEW
 typedef enum { TILE_NEW, TILE_HAS_TEXTURE, TILE_REFS_TEXTURE, TILE_NO_DATA } TileTexType;
 
-Error tileTex_init( const char *tilePathParam, int inMemoryCountParam );
+/* Cache counters, for sizing the cache budget */
+typedef struct
+{
+  uint64_t hits;       // tileTex_get found the tile in the cache
+  uint64_t misses;     // tileTex_get had to create the tile
+  uint64_t evictions;  // tiles freed to stay within the budget
+  uint64_t loaded;     // tiles read by the loader threads
+  uint64_t stolen;     // tiles a loader took from another loader's deque
+  uint64_t prefetched;      // tiles created by prefetching
+  uint64_t prefetchHits;    // prefetched tiles that became visible
+  uint64_t prefetchWasted;  // prefetched tiles evicted without being visible
+  uint64_t cancelled;  // queued tiles freed unloaded when the view moved on
+  int queued;          // tiles waiting for a loader
+  int visibleQueued;   // visible tiles not loaded yet
+  uint64_t decodes;    // tile images decoded
+  uint64_t lz4Hits;    // tiles uploaded again from their LZ4 copy
+  uint64_t lz4Dropped; // LZ4 copies dropped to stay within their budget
+  size_t lz4Bytes;     // LZ4 copies of decoded tiles currently held
+  size_t lz4Budget;
+  uint64_t diskHits;   // tiles read from the disk cache instead of decoded
+  uint64_t diskWrites; // tiles saved in the disk cache
+  size_t cacheBytes;   // tile structs + compressed tile data currently held
+  size_t cacheBudget;
+  int tileCount;
+  uint64_t loadTimes[ TILE_TEX_LOAD_BUCKETS ];  // loads, by how long they took
+} sTileTexStats, *TileTexStats;
+
+/* Decode and upload tiles as 16 bit RGB565. Must be called before
+   tileTex_init. */
+void tileTex_setRGB565( bool rgb565Param );
+Error tileTex_init( const char *tilePathParam, size_t cacheBudgetParam,
+		    int loaderCountParam );
 void tileTex_setVisible( TileTexture tile, bool isVisible );
 TileTexture tileTex_get(int z, uint32_t x, uint32_t y);
+/* The tiles currently visible, and the boat's course (degrees true) and
+   speed (knots). Tiles along the predicted track of the view are
+   prefetched. Render thread only. */
+void tileTex_setView( int z, const TileBounds bounds );
+void tileTex_setMotion( float course, float speed );
+/* Saves decoded tiles in the directory path, to be read back instead of
+   decoded, also in later runs. Must be called before tileTex_init. */
+Error tileTex_setDiskCache( const char *path );
+/* Whether the render thread draws tiles as they arrive (the default), or
+   waits for the visible tiles. Only then are uploads limited to a few per
+   frame. Render thread only. */
+void tileTex_setProgressive( bool progressive );
+/* Bytes of LZ4 compressed decoded tiles to keep, 0 (the default) for none.
+   Render thread only. */
+void tileTex_setLz4Budget( size_t bytes );
+/* Replaces tilePrefetch_defaultPolicy. Render thread only. */
+void tileTex_setPrefetchPolicy( const sPrefetchPolicy *policy );
+/* Fills tiles with up to maxTiles tiles worth loading at the next start,
+   the visible ones first, then the prefetch plan. Returns how many. Render
+   thread only. */
+int tileTex_getWarmSet( PrefetchTile tiles, int maxTiles );
+/* Requests the tiles, e.g. a saved warm set, as if they were prefetched.
+   Needs no GL context, so it may be called before graphics_init. */
+void tileTex_preload( const sPrefetchTile *tiles, int count );
+/* Returns the atlas page texture to draw the tile from, or -1 */
 GLuint tileTex_makeTextureID( TileTexture tile );
 void tileTex_waitVisibleLoaded( void );
+/* The tile's texture coordinates in its atlas page, once
+   tileTex_makeTextureID has returned a texture for it in this frame */
 void tileTex_getUV( TileTexture tile, float *u0, float *v0, float *u1, float *v1 );
+/* What to draw for the tile now, without waiting: the atlas page and the
+   tile's UVs in it, possibly from an ancestor. -1 if there is nothing. */
+GLuint tileTex_getTexture( TileTexture tile, float *u0, float *v0, float *u1,
+			   float *v1 );
+/* Whether what tileTex_getTexture returned for the tile in this frame was
+   its own texture, or its ancestor's if it is missing, rather than a stand
+   in until it is loaded and uploaded */
+bool tileTex_isFinal( TileTexture tile );
+/* Evicts least recently used tiles until the cache is within budget. Must be
+   called once per frame, after drawing, from the thread owning the GL
+   context. */
+void tileTex_trimCache( void );
+/* Takes no lock, so the counters may be from moments apart */
+void tileTex_getStats( TileTexStats stats );
 
 #endif
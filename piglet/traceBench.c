@@ -0,0 +1,227 @@
+/*
+ *  traceBench.c
+ *
+ * Replays a view trace (see viewTrace.h), recorded with piglet -r, against
+ * a tile set, and reports frame time percentiles, time blocked waiting for
+ * visible tiles, tile loading counters and peak RSS as JSON, for comparing
+ * builds and cache settings.
+ *
+ * usage: traceBench [options] <tile directory or archive> <trace>
+ *   -d <display>         display backend, see displayBackend.h
+ *   -s <width>x<height>  surface size
+ *   -l <loaders>         loader threads
+ *   -c <MB>              tile cache budget
+ *   -z <MB>              LZ4 tier budget, 0 for none
+ *   -k <directory>       disk cache of decoded tiles
+ *   -w                   wait for the visible tiles every frame, rather
+ *                        than draw progressively
+ *   -5                   RGB565 rendering
+ *   -t <file>            write the timing of loading and drawing steps, as
+ *                        Chrome trace JSON (see eventTrace.h)
+ *
+ * The views are rendered back to back, one per frame, whatever the times
+ * recorded, so that a run depends on the trace and the settings only, not
+ * on how fast the machine that recorded it was. A frame's time is the wall
+ * time of graphics_setMap and graphics_redraw, which waits for the GPU when
+ * rendering offscreen.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "benchStats.h"
+#include "displayBackend.h"
+#include "eventTrace.h"
+#include "graphics.h"
+#include "tileTexture.h"
+#include "viewTrace.h"
+
+/*
+ * Local function prototypes
+ */
+static void usage( const char *program );
+
+/*
+ * Start of code
+ */
+int main( int argc, char **argv )
+{
+  const char *displayName = NULL, *diskCache = NULL, *eventTraceFile = NULL;
+  unsigned int width = 0, height = 0;
+  int loaders = 3, cacheMB = 32, lz4MB = 16, option, i;
+  bool progressive = true, rgb565 = false;
+  sViewTrace trace;
+  sTileTexStats stats;
+  sGraphicsStats graphicsStats;
+  struct rusage rusage;
+  double *frameTimes, start, total = 0;
+  FILE *json;
+  Error error;
+
+  while( (option = getopt( argc, argv, "d:s:l:c:z:k:w5t:" )) != -1 )
+    switch( option )
+    {
+      case 'd':
+	displayName = optarg;
+	break;
+
+      case 's':
+	if( sscanf( optarg, "%ux%u", &width, &height ) != 2 )
+	  usage( argv[0] );
+	break;
+
+      case 'l':
+	loaders = atoi( optarg );
+	break;
+
+      case 'c':
+	cacheMB = atoi( optarg );
+	break;
+
+      case 'z':
+	lz4MB = atoi( optarg );
+	break;
+
+      case 'k':
+	diskCache = optarg;
+	break;
+
+      case 'w':
+	progressive = false;
+	break;
+
+      case '5':
+	rgb565 = true;
+	break;
+
+      case 't':
+	eventTraceFile = optarg;
+	eventTrace_enable( true );
+	break;
+
+      default:
+	usage( argv[0] );
+    }
+
+  if( (argc - optind != 2) || (loaders < 1) )
+    usage( argv[0] );
+
+  error = graphics_setDisplay( displayName, width, height );
+  if( error != NULL )
+  {
+    ErrReport( error );
+    usage( argv[0] );
+  }
+
+  // the modules report progress on stdout; keep it for the JSON alone
+  fflush( stdout );
+  json = fdopen( dup( STDOUT_FILENO ), "w" );
+  assert( json != NULL );
+  dup2( STDERR_FILENO, STDOUT_FILENO );
+
+  error = viewTrace_load( argv[ optind + 1 ], &trace );
+  if( error != NULL )
+  {
+    ErrReport( error );
+    return 1;
+  }
+
+  frameTimes = malloc( trace.count * sizeof( double ) );
+  assert( frameTimes != NULL );
+
+  tileTex_setRGB565( rgb565 );
+  if( diskCache != NULL )
+  {
+    error = tileTex_setDiskCache( diskCache );
+    if( error != NULL )
+    {
+      ErrReport( error );
+      return 1;
+    }
+  }
+  error = tileTex_init( argv[ optind ], (size_t) cacheMB * 1024 * 1024,
+			loaders );
+  if( error != NULL )
+  {
+    ErrReport( error );
+    return 1;
+  }
+
+  graphics_setRGB565( rgb565 );
+  graphics_init();
+  graphics_setProgressive( progressive );
+  tileTex_setLz4Budget( (size_t) lz4MB * 1024 * 1024 );
+
+  for( i = 0; i < trace.count; i++ )
+  {
+    start = benchStats_now();
+    graphics_setMap( trace.states[i].zoom, &(trace.states[i].center) );
+    graphics_redraw( trace.states[i].zoom, 0, 0, 0, 0 );
+    frameTimes[i] = benchStats_now() - start;
+    total += frameTimes[i];
+  }
+
+  if( eventTraceFile != NULL )
+  {
+    error = eventTrace_write( eventTraceFile );
+    if( error != NULL )
+      ErrReport( error );
+  }
+
+  tileTex_getStats( &stats );
+  graphics_getStats( &graphicsStats );
+  getrusage( RUSAGE_SELF, &rusage );
+  benchStats_sort( frameTimes, trace.count );
+
+  fprintf( json, "{\n" );
+  fprintf( json, "  \"tiles\": " );
+  benchStats_writeJsonString( json, argv[ optind ] );
+  fprintf( json, ",\n  \"trace\": " );
+  benchStats_writeJsonString( json, argv[ optind + 1 ] );
+  fprintf( json, ",\n  \"settings\": { \"display\": " );
+  benchStats_writeJsonString( json, displayBackend_find( displayName )->name );
+  fprintf( json, ", \"loaders\": %d, "
+	   "\"cacheMB\": %d, \"lz4MB\": %d, \"diskCache\": %s, "
+	   "\"progressive\": %s, \"rgb565\": %s },\n",
+	   loaders, cacheMB, lz4MB,
+	   (diskCache != NULL) ? "true" : "false",
+	   progressive ? "true" : "false", rgb565 ? "true" : "false" );
+  fprintf( json, "  \"frames\": %d,\n", trace.count );
+  fprintf( json, "  \"seconds\": %.3f,\n", total );
+  fprintf( json, "  \"frameMs\": { \"mean\": %.3f, \"p50\": %.3f, "
+	   "\"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+	   total * 1000 / trace.count,
+	   benchStats_percentile( frameTimes, trace.count, 0.50 ) * 1000,
+	   benchStats_percentile( frameTimes, trace.count, 0.95 ) * 1000,
+	   benchStats_percentile( frameTimes, trace.count, 0.99 ) * 1000,
+	   frameTimes[ trace.count - 1 ] * 1000 );
+  fprintf( json, "  \"blockedSeconds\": %.3f,\n", graphicsStats.waitSeconds );
+  fprintf( json, "  \"skippedTilesPerFrame\": %.3f,\n",
+	   (double) graphicsStats.tilesSkipped / graphicsStats.frames );
+  fprintf( json, "  \"tilesLoaded\": %llu,\n",
+	   (unsigned long long) stats.loaded );
+  fprintf( json, "  \"tilesDecoded\": %llu,\n",
+	   (unsigned long long) stats.decodes );
+  fprintf( json, "  \"lz4Hits\": %llu,\n", (unsigned long long) stats.lz4Hits );
+  fprintf( json, "  \"diskHits\": %llu,\n",
+	   (unsigned long long) stats.diskHits );
+  fprintf( json, "  \"evictions\": %llu,\n",
+	   (unsigned long long) stats.evictions );
+  fprintf( json, "  \"peakRssKB\": %ld\n", rusage.ru_maxrss );
+  fprintf( json, "}\n" );
+  fflush( json );
+
+  // loaders may still be loading, don't wait for them
+  _exit( 0 );
+}
+
+static void usage( const char *program )
+{
+  fprintf( stderr, "usage: %s [-d display] [-s <width>x<height>] [-l loaders] "
+	   "[-c cache MB] [-z LZ4 MB] [-k disk cache] [-w] [-5] "
+	   "[-t event trace] <tile directory or archive> <trace>\n", program );
+  exit( 1 );
+}
@@ -0,0 +1,229 @@
+/*
+ *  uploadBench.c
+ *
+ * Compares getting a tile onto the GPU as PNG, decoded and uploaded as RGB
+ * or RGB565 into an atlas page, with ETC1, uploaded as it is with
+ * glCompressedTexImage2D, and the texture memory each takes.
+ *
+ * usage: uploadBench <256x256 PNG tile> [uploads]
+ *
+ * The tile is transcoded to ETC1 in memory, the same way tileEtc does it.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <png.h>
+
+#include "GLES2/gl2.h"
+
+#include "etc1.h"
+#include "graphics.h"
+#include "tileAtlas.h"
+#include "tileDecoder.h"
+
+#define PAGE_SIZE 2048
+#define SLOTS_PER_ROW (PAGE_SIZE / TILE_ATLAS_TILE_SIZE)
+/* distinct textures the ETC1 uploads cycle through */
+#define ETC1_TEXTURES 64
+
+/*
+ * Local function prototypes
+ */
+static unsigned char *readFile( const char *filename, size_t *size );
+static double now( void );
+
+/*
+ * Start of code
+ */
+int main( int argc, char **argv )
+{
+  int uploads = 500, i, slot;
+  size_t pngSize, etc1Size;
+  unsigned char *png, *rgb, *etc1;
+  uint16_t *rgb565;
+  png_image image;
+  GLuint page, page565, textures[ ETC1_TEXTURES ];
+  const char *extensions;
+  double start, decodeTime, rgbTime, rgb565Time, etc1Time = 0;
+  bool hasETC1;
+
+  if( argc < 2 )
+  {
+    fprintf( stderr, "usage: %s <256x256 PNG tile> [uploads]\n", argv[0] );
+    return 1;
+  }
+  if( argc > 2 )
+    uploads = atoi( argv[2] );
+
+  png = readFile( argv[1], &pngSize );
+
+  // PNG decoding, as the loaders do it for every tile
+  rgb = malloc( TILE_ATLAS_TILE_SIZE * TILE_ATLAS_TILE_SIZE * 3 );
+  assert( rgb != NULL );
+
+  start = now();
+  for( i = 0; i < uploads; i++ )
+  {
+    memset( &image, 0, sizeof( image ) );
+    image.version = PNG_IMAGE_VERSION;
+    if( !png_image_begin_read_from_memory( &image, png, pngSize ) )
+    {
+      fprintf( stderr, "%s: %s\n", argv[1], image.message );
+      return 1;
+    }
+    if( (image.width != TILE_ATLAS_TILE_SIZE) ||
+	(image.height != TILE_ATLAS_TILE_SIZE) )
+    {
+      fprintf( stderr, "%s is not %dx%d\n", argv[1], TILE_ATLAS_TILE_SIZE,
+	       TILE_ATLAS_TILE_SIZE );
+      return 1;
+    }
+    image.format = PNG_FORMAT_RGB;
+    png_image_finish_read( &image, NULL, rgb, 0, NULL );
+  }
+  decodeTime = now() - start;
+
+  // as the loaders convert rows in RGB565 mode
+  rgb565 = malloc( TILE_ATLAS_TILE_SIZE * TILE_ATLAS_TILE_SIZE * 2 );
+  assert( rgb565 != NULL );
+  tileDecoder_rgbTo565( rgb, rgb565, TILE_ATLAS_TILE_SIZE * TILE_ATLAS_TILE_SIZE );
+
+  etc1Size = etc1_imageSize( TILE_ATLAS_TILE_SIZE, TILE_ATLAS_TILE_SIZE );
+  etc1 = malloc( etc1Size );
+  assert( etc1 != NULL );
+  etc1_encodeImage( rgb, TILE_ATLAS_TILE_SIZE, TILE_ATLAS_TILE_SIZE,
+		    TILE_ATLAS_TILE_SIZE * 3, etc1 );
+
+  graphics_init();
+
+  extensions = (const char *) glGetString( GL_EXTENSIONS );
+  hasETC1 = (extensions != NULL) &&
+    (strstr( extensions, "GL_OES_compressed_ETC1_RGB8_texture" ) != NULL);
+
+  // RGB into the slots of one atlas page, as tileAtlas_upload does
+  glGenTextures( 1, &page );
+  glBindTexture( GL_TEXTURE_2D, page );
+  glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, PAGE_SIZE, PAGE_SIZE, 0, GL_RGB,
+		GL_UNSIGNED_BYTE, NULL );
+  glFinish();
+
+  start = now();
+  for( i = 0; i < uploads; i++ )
+  {
+    slot = i % (SLOTS_PER_ROW * SLOTS_PER_ROW);
+    glTexSubImage2D( GL_TEXTURE_2D, 0, (slot % SLOTS_PER_ROW) * TILE_ATLAS_TILE_SIZE,
+		     (slot / SLOTS_PER_ROW) * TILE_ATLAS_TILE_SIZE,
+		     TILE_ATLAS_TILE_SIZE, TILE_ATLAS_TILE_SIZE, GL_RGB,
+		     GL_UNSIGNED_BYTE, rgb );
+  }
+  glFinish();
+  rgbTime = now() - start;
+  assert( glGetError() == GL_NO_ERROR );
+
+  glGenTextures( 1, &page565 );
+  glBindTexture( GL_TEXTURE_2D, page565 );
+  glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, PAGE_SIZE, PAGE_SIZE, 0, GL_RGB,
+		GL_UNSIGNED_SHORT_5_6_5, NULL );
+  glFinish();
+
+  start = now();
+  for( i = 0; i < uploads; i++ )
+  {
+    slot = i % (SLOTS_PER_ROW * SLOTS_PER_ROW);
+    glTexSubImage2D( GL_TEXTURE_2D, 0, (slot % SLOTS_PER_ROW) * TILE_ATLAS_TILE_SIZE,
+		     (slot / SLOTS_PER_ROW) * TILE_ATLAS_TILE_SIZE,
+		     TILE_ATLAS_TILE_SIZE, TILE_ATLAS_TILE_SIZE, GL_RGB,
+		     GL_UNSIGNED_SHORT_5_6_5, rgb565 );
+  }
+  glFinish();
+  rgb565Time = now() - start;
+  assert( glGetError() == GL_NO_ERROR );
+
+  // ETC1 replaces whole textures, as tileAtlas_uploadETC1 does
+  if( hasETC1 )
+  {
+    glGenTextures( ETC1_TEXTURES, textures );
+    for( i = 0; i < ETC1_TEXTURES; i++ )
+    {
+      glBindTexture( GL_TEXTURE_2D, textures[i] );
+      glCompressedTexImage2D( GL_TEXTURE_2D, 0, ETC1_GL_FORMAT,
+			      TILE_ATLAS_TILE_SIZE, TILE_ATLAS_TILE_SIZE, 0,
+			      etc1Size, etc1 );
+    }
+    glFinish();
+
+    start = now();
+    for( i = 0; i < uploads; i++ )
+    {
+      glBindTexture( GL_TEXTURE_2D, textures[ i % ETC1_TEXTURES ] );
+      glCompressedTexImage2D( GL_TEXTURE_2D, 0, ETC1_GL_FORMAT,
+			      TILE_ATLAS_TILE_SIZE, TILE_ATLAS_TILE_SIZE, 0,
+			      etc1Size, etc1 );
+    }
+    glFinish();
+    etc1Time = now() - start;
+    assert( glGetError() == GL_NO_ERROR );
+  }
+
+  printf( "%d uploads of %s (%zu bytes of PNG)\n", uploads, argv[1], pngSize );
+  printf( "%-6s %12s %12s %14s\n", "", "decode ms", "upload ms",
+	  "texture bytes" );
+  printf( "%-6s %12.3f %12.3f %14d\n", "RGB", decodeTime * 1000 / uploads,
+	  rgbTime * 1000 / uploads,
+	  TILE_ATLAS_TILE_SIZE * TILE_ATLAS_TILE_SIZE * 3 );
+  printf( "%-6s %12.3f %12.3f %14d\n", "RGB565", decodeTime * 1000 / uploads,
+	  rgb565Time * 1000 / uploads,
+	  TILE_ATLAS_TILE_SIZE * TILE_ATLAS_TILE_SIZE * 2 );
+  if( hasETC1 )
+    printf( "%-6s %12.3f %12.3f %14zu\n", "ETC1", 0.0,
+	    etc1Time * 1000 / uploads, etc1Size );
+  else
+    printf( "ETC1 is not supported by this GPU\n" );
+  printf( "(the driver may keep RGB textures at 4 bytes per texel)\n" );
+
+  return 0;
+}
+
+static unsigned char *readFile( const char *filename, size_t *size )
+{
+  unsigned char *data;
+  FILE *file;
+  long length;
+
+  file = fopen( filename, "rb" );
+  if( file == NULL )
+  {
+    perror( filename );
+    exit( 1 );
+  }
+
+  fseek( file, 0, SEEK_END );
+  length = ftell( file );
+  fseek( file, 0, SEEK_SET );
+
+  data = malloc( length );
+  assert( data != NULL );
+
+  if( fread( data, length, 1, file ) != 1 )
+  {
+    perror( filename );
+    exit( 1 );
+  }
+  fclose( file );
+
+  *size = length;
+  return data;
+}
+
+static double now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,70 @@
+/*
+   viewTrace.c
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "viewTrace.h"
+
+Error viewTrace_load( const char *filename, ViewTrace trace )
+{
+  char line[ 256 ];
+  sViewState state;
+  int capacity = 0, lineNumber = 0;
+  FILE *file;
+
+  trace->states = NULL;
+  trace->count = 0;
+
+  file = fopen( filename, "r" );
+  if( file == NULL )
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not open view trace '%s'",
+		   filename );
+
+  while( fgets( line, sizeof( line ), file ) != NULL )
+  {
+    lineNumber++;
+    if( (line[0] == '#') || (line[0] == '\n') )
+      continue;
+
+    if( sscanf( line, "%lf %" SCNu32 " %" SCNu32 " %f", &(state.time),
+		&(state.center.x), &(state.center.y), &(state.zoom) ) != 4 )
+    {
+      fclose( file );
+      viewTrace_free( trace );
+      return ErrNew( ERR_APP, 0, NULL, "%s:%d: not a view state", filename,
+		     lineNumber );
+    }
+
+    if( trace->count == capacity )
+    {
+      capacity = (capacity == 0) ? 1024 : capacity * 2;
+      trace->states = realloc( trace->states, capacity * sizeof( sViewState ) );
+      assert( trace->states != NULL );
+    }
+    trace->states[ trace->count++ ] = state;
+  }
+
+  fclose( file );
+
+  if( trace->count == 0 )
+    return ErrNew( ERR_APP, 0, NULL, "View trace '%s' is empty", filename );
+
+  return NULL;
+}
+
+void viewTrace_free( ViewTrace trace )
+{
+  free( trace->states );
+  trace->states = NULL;
+  trace->count = 0;
+}
+
+void viewTrace_write( FILE *file, const sViewState *state )
+{
+  fprintf( file, "%.4f %" PRIu32 " %" PRIu32 " %.6f\n", state->time,
+	   state->center.x, state->center.y, state->zoom );
+}
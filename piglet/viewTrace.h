@@ -0,0 +1,40 @@
+/*
+   viewTrace.h
+
+   A recorded sequence of views, one per frame, as piglet -r writes it and
+   traceBench replays it. A trace is a text file with a line per frame:
+
+     <seconds since start> <center x> <center y> <zoom>
+
+   with the center in tile coordinates (see graphics.h). Lines starting
+   with # are comments.
+*/
+
+#ifndef VIEW_TRACE_H
+#define VIEW_TRACE_H
+
+#include <stdio.h>
+
+#include <voxi/util/err.h>
+
+#include "graphics.h"
+
+typedef struct
+{
+  double time;
+  sTileCoordinate center;
+  float zoom;
+} sViewState, *ViewState;
+
+typedef struct
+{
+  sViewState *states;
+  int count;
+} sViewTrace, *ViewTrace;
+
+Error viewTrace_load( const char *filename, ViewTrace trace );
+void viewTrace_free( ViewTrace trace );
+/* Appends a line for the state to a trace being recorded */
+void viewTrace_write( FILE *file, const sViewState *state );
+
+#endif
@@ -0,0 +1,119 @@
+/*
+   warmSet.c
+
+   Warm set file format (native byte order, it is a cache and not portable):
+
+     header        sWarmFileHeader
+     tiles         tileCount times sWarmFileTile
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "warmSet.h"
+
+#define WARM_FILE_MAGIC "PIGLWARM"
+#define WARM_FILE_VERSION 1
+
+typedef struct
+{
+  char magic[8];  // WARM_FILE_MAGIC, not null terminated
+  uint32_t version;
+  float zoom;
+  uint32_t centerX, centerY;
+  uint32_t tileCount;
+} sWarmFileHeader;
+
+typedef struct
+{
+  uint32_t z, x, y;
+} sWarmFileTile;
+
+Error warmSet_load( const char *filename, WarmSet set )
+{
+  sWarmFileHeader header;
+  sWarmFileTile fileTile;
+  uint32_t i;
+  FILE *file;
+
+  file = fopen( filename, "rb" );
+  if( file == NULL )
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not open warm set '%s'",
+		   filename );
+
+  if( (fread( &header, sizeof( header ), 1, file ) != 1) ||
+      (memcmp( header.magic, WARM_FILE_MAGIC, sizeof( header.magic ) ) != 0) ||
+      (header.version != WARM_FILE_VERSION) ||
+      (header.tileCount > WARM_SET_MAX_TILES) )
+    goto DAMAGED;
+
+  set->zoom = header.zoom;
+  set->centerX = header.centerX;
+  set->centerY = header.centerY;
+  set->tileCount = header.tileCount;
+
+  for( i = 0; i < header.tileCount; i++ )
+  {
+    if( (fread( &fileTile, sizeof( fileTile ), 1, file ) != 1) ||
+	(fileTile.z >= TILE_INDEX_ZOOMS) )
+      goto DAMAGED;
+
+    set->tiles[i].z = fileTile.z;
+    set->tiles[i].x = fileTile.x;
+    set->tiles[i].y = fileTile.y;
+  }
+
+  fclose( file );
+  return NULL;
+
+ DAMAGED:
+  fclose( file );
+  set->tileCount = 0;
+  return ErrNew( ERR_APP, 0, NULL, "Warm set '%s' is damaged", filename );
+}
+
+Error warmSet_save( const char *filename, const sWarmSet *set )
+{
+  sWarmFileHeader header;
+  sWarmFileTile fileTile;
+  char tempName[ 1024 ];
+  bool ok;
+  FILE *file;
+  int i;
+
+  snprintf( tempName, sizeof( tempName ), "%s.new", filename );
+
+  file = fopen( tempName, "wb" );
+  if( file == NULL )
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not create warm set '%s'",
+		   tempName );
+
+  memset( &header, 0, sizeof( header ) );
+  memcpy( header.magic, WARM_FILE_MAGIC, sizeof( header.magic ) );
+  header.version = WARM_FILE_VERSION;
+  header.zoom = set->zoom;
+  header.centerX = set->centerX;
+  header.centerY = set->centerY;
+  header.tileCount = set->tileCount;
+
+  ok = fwrite( &header, sizeof( header ), 1, file ) == 1;
+
+  for( i = 0; ok && (i < set->tileCount); i++ )
+  {
+    fileTile.z = set->tiles[i].z;
+    fileTile.x = set->tiles[i].x;
+    fileTile.y = set->tiles[i].y;
+    ok = fwrite( &fileTile, sizeof( fileTile ), 1, file ) == 1;
+  }
+
+  if( (fclose( file ) != 0) || !ok || (rename( tempName, filename ) != 0) )
+  {
+    remove( tempName );
+    return ErrNew( ERR_ERRNO, errno, NULL, "Could not write warm set '%s'",
+		   filename );
+  }
+
+  return NULL;
+}
@@ -0,0 +1,34 @@
+/*
+   warmSet.h
+
+   The tiles of the last session's view, and the view itself, saved now and
+   then so that the next start can load them while EGL is still starting,
+   rather than begin with an empty tile cache.
+*/
+
+#ifndef WARM_SET_H
+#define WARM_SET_H
+
+#include <stdint.h>
+
+#include <voxi/util/err.h>
+
+#include "tilePrefetch.h"
+
+/* the visible tiles plus a prefetch plan */
+#define WARM_SET_MAX_TILES 256
+
+typedef struct
+{
+  float zoom;
+  uint32_t centerX, centerY;  // tile coordinates, see graphics.h
+  int tileCount;
+  sPrefetchTile tiles[ WARM_SET_MAX_TILES ];  // most wanted first
+} sWarmSet, *WarmSet;
+
+/* Fails if the file is missing or damaged */
+Error warmSet_load( const char *filename, WarmSet set );
+/* Replaces the file atomically, so a crash leaves the previous set */
+Error warmSet_save( const char *filename, const sWarmSet *set );
+
+#endif